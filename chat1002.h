@@ -10,16 +10,13 @@
 
 #include <stdio.h>
 
-/* the maximum number of characters we expect in a line of input (including the terminating null)  */
+/* the size of the buffers that hold short pieces of input, such as the name of a snapshot (including the terminating null)  */
 #define MAX_INPUT 256
 
 /* the maximum number of characters allowed in the name of an intent (including the terminating null)  */
 #define MAX_INTENT 32
 
-/* the maximum number of characters allowed in the name of an entity (including the terminating null)  */
-#define MAX_ENTITY 64
-
-/* the maximum number of characters allowed in a response (including the terminating null) */
+/* the least room chatbot_reply() gives the chatbot for its output (longer responses get more; elsewhere they are truncated) */
 #define MAX_RESPONSE 256
 
 /* the maximum number of intents allowed in a array (including the terminating null) */
@@ -31,62 +28,336 @@
 #define KB_INVALID -2
 #define KB_NOMEM -3
 
-/* functions defined in main.c */
+/* what a built-in word means as the first word of input (see VOCAB) */
+#define VERB_NONE 0
+#define VERB_EXIT 1
+#define VERB_LOAD 2
+#define VERB_SAVE 3
+#define VERB_RESET 4
+#define VERB_TELL 5
+#define VERB_QUESTION 6
+#define VERB_EXPORT 7
+#define VERB_IMPORT 8
+#define VERB_SNAPSHOT 9
+#define VERB_ROLLBACK 10
+
+/* what a built-in word can stand for (see VOCAB) */
+#define PRONOUN_NONE 0
+#define PRONOUN_PERSON 1
+#define PRONOUN_THING 2
+
+/* the kinds of slot a template can have (see template.c) */
+#define SLOT_ENTITY 0
+#define SLOT_USER 1
+#define SLOT_BOT 2
+#define SLOT_FILE 3
+#define SLOT_COUNT 4
+#define SLOT_KINDS 5
+
+/* the kinds of request the scheduler tells apart (see sched.c) */
+#define REQUEST_QUESTION 0
+#define REQUEST_ADMIN 1
+#define REQUEST_OTHER 2
+
+/* the most parts (runs of plain text and slots) a template can have */
+#define MAX_PARTS 16
+
+/* the longest key normalize_key() keeps without allocating */
+#define MAX_KEY 128
+
+/* the size of the buffer session_recall() needs */
+#define SESSION_ENTITY 256
+
+/* lets the CPU start loading memory that will be needed soon */
+#ifdef __GNUC__
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+#define PREFETCH(p)
+#endif
+
+/* a word in a line of input, as found by tokenize() */
+typedef struct token
+{
+    int offset;         /* offset of the first character of the word in the line */
+    int length;         /* number of characters in the word */
+    unsigned long hash; /* case-folded hash of the word (see hash_token()) */
+} TOKEN;
+
+/* a word built into the chatbot (see vocabgen.c) */
+typedef struct vocab
+{
+    const char *word;       /* the word, in lower case */
+    int verb;               /* VERB_* for the command it starts, or VERB_NONE */
+    int intent;             /* index in all_intents, if it is a question word; otherwise -1 */
+    const char *smalltalk;  /* the response if it is a smalltalk topic; otherwise NULL */
+    int pronoun;            /* PRONOUN_* for what it stands for, if it is a pronoun */
+} VOCAB;
+
+/* the questions knowledge_read() put under an entity already spelt
+   differently, other than in case, spacing and punctuation (see
+   normalize_same()) */
+typedef struct collisions
+{
+    int count;              /* number of such questions */
+    char known[MAX_INPUT];  /* the spelling the entity already had, for the first of them */
+    char read[MAX_INPUT];   /* the spelling it was read as, for the first of them */
+} COLLISIONS;
+
+/* what knowledge_compact() did */
+typedef struct compaction
+{
+    long bytes_before;  /* bytes the questions, the index, the entities and the dictionary took before */
+    long bytes_after;   /* bytes they take afterwards */
+    long build_ns;      /* time taken to copy them, while lookups carried on */
+    long pause_ns;      /* time the knowledge base was held for writing */
+} COMPACTION;
+
+/* the totals of the compactions done by compact.c */
+typedef struct compact_stats
+{
+    long runs;             /* number of compactions done */
+    long skipped;          /* number not done, because of snapshots or a change made meanwhile */
+    long bytes_reclaimed;  /* total bytes of memory given back to the system */
+    long bytes_live;       /* bytes the knowledge base took after the last compaction */
+    long build_ns;         /* total time taken copying */
+    long pause_ns;         /* total time the knowledge base was held for writing */
+    long max_pause_ns;     /* longest time the knowledge base was held for writing */
+} COMPACT_STATS;
+
+/* functions defined in main.c (server.c and loadgen.c define their own prompt_user()) */
+int prompt_user(char **buf, int *size, const char *format, ...);
+
+/* functions defined in tokenizer.c */
 int compare_token(const char *token1, const char *token2);
-void prompt_user(char *buf, int n, const char *format, ...);
+int tokenize(const char *line, TOKEN tokens[], int max);
+unsigned long hash_token(const char *s, int len);
+int compare_span(const char *span, int len, const char *token);
+int vocab_slot(unsigned long hash, unsigned long displacement, int slots);
+
+/* functions defined in vocab.c (generated by vocabgen.c) */
+const VOCAB *vocab_find(const char *word, int len, unsigned long hash);
 
 /* functions defined in chatbot.c */
 const char *chatbot_botname();
 const char *chatbot_username();
-int chatbot_main(int inc, char *inv[], char *response, int n);
-int chatbot_is_exit(const char *intent);
-int chatbot_do_exit(int inc, char *inv[], char *response, int n);
-int chatbot_is_load(const char *intent);
-int chatbot_do_load(int inc, char *inv[], char *response, int n);
-int chatbot_is_question(const char *intent);
-int chatbot_do_question(int inc, char *inv[], char *response, int n);
-int chatbot_is_reset(const char *intent);
-int chatbot_do_reset(int inc, char *inv[], char *response, int n);
-int chatbot_is_save(const char *intent);
-int chatbot_do_save(int inc, char *inv[], char *response, int n);
-int chatbot_is_smalltalk(const char *intent);
-int chatbot_do_smalltalk(int inc, char *inv[], char *resonse, int n);
+int chatbot_main(const char *line, int inc, const TOKEN inv[], char *response, int n);
+int chatbot_reply(const char *line, int inc, const TOKEN inv[], char **response, int *size,
+                  int (*handler)(const char *, int, const TOKEN[], char *, int));
+int chatbot_is_exit(const char *intent, int len);
+int chatbot_do_exit(const char *line, int inc, const TOKEN inv[], char *response, int n);
+int chatbot_is_load(const char *intent, int len);
+int chatbot_do_load(const char *line, int inc, const TOKEN inv[], char *response, int n);
+int chatbot_is_question(const char *intent, int len);
+int chatbot_do_question(const char *line, int inc, const TOKEN inv[], char *response, int n);
+int chatbot_is_tell(const char *intent, int len);
+int chatbot_do_tell(const char *line, int inc, const TOKEN inv[], char *response, int n);
+int chatbot_is_reset(const char *intent, int len);
+int chatbot_do_reset(const char *line, int inc, const TOKEN inv[], char *response, int n);
+int chatbot_is_save(const char *intent, int len);
+int chatbot_do_save(const char *line, int inc, const TOKEN inv[], char *response, int n);
+int chatbot_is_export(const char *intent, int len);
+int chatbot_do_export(const char *line, int inc, const TOKEN inv[], char *response, int n);
+int chatbot_is_import(const char *intent, int len);
+int chatbot_do_import(const char *line, int inc, const TOKEN inv[], char *response, int n);
+int chatbot_is_snapshot(const char *intent, int len);
+int chatbot_do_snapshot(const char *line, int inc, const TOKEN inv[], char *response, int n);
+int chatbot_is_rollback(const char *intent, int len);
+int chatbot_do_rollback(const char *line, int inc, const TOKEN inv[], char *response, int n);
+int chatbot_is_smalltalk(const char *intent, int len);
+int chatbot_do_smalltalk(const char *line, int inc, const TOKEN inv[], char *response, int n);
 
 /* functions defined in knowledge.c */
-int knowledge_get(const char *intent, const char *entity, char *response, int n);
-int knowledge_put(const char *intent, const char *entity, const char *response);
+int knowledge_intent(const char *intent, int len);
+int knowledge_get(const char *intent, const char *entity, int len, char *response, int n);
+int knowledge_put(const char *intent, const char *entity, int len, const char *response);
+int knowledge_about(const char *entity, int len, char *responses[], int n);
 void knowledge_reset();
-int knowledge_read(FILE *f);
+int knowledge_count();
+int knowledge_read(FILE *f, COLLISIONS *collisions);
+int knowledge_load_put(const char *intent, const char *entity, int len, const char *response,
+                       COLLISIONS *collisions);
 void knowledge_write(FILE *f);
+void knowledge_write_workers(int workers);
+long knowledge_export(FILE *f, void (*progress)(long records));
+long knowledge_import(FILE *f, void (*progress)(long records));
+int knowledge_snapshot(const char *name);
+int knowledge_rollback(const char *name);
+int knowledge_compact(COMPACTION *result);
+long knowledge_garbage(long *live);
 
 typedef struct question
 {
-    char entity[MAX_ENTITY];
-    char response[MAX_RESPONSE];
-    struct question *next;
+    int entity;         /* ID of the entity (see intern.c) */
+    int response_len;   /* number of characters in the response */
+    int stored_len;     /* number of bytes the response takes in response */
+    short intent;       /* index of the intent in all_intents */
+    short templated;    /* 1 if the response has slots (see template.c) */
+    int generation;     /* the generation of the knowledge base it was added in */
+    char response[];    /* the response; compressed if stored_len < response_len */
 
 } QUESTION;
 
 typedef struct intent
 {
     char intent[MAX_INTENT];
-    QUESTION *head_ptr;
-    QUESTION *tail_ptr;
+    int *order;         /* IDs of the entities it has questions about, in the order they were added */
+    int order_size;     /* the number of IDs order has room for */
 } INTENT;
 
-typedef struct smalltalk
+/* a lookup to be done by knowledge_probe() */
+typedef struct probe
 {
-    char topic[MAX_ENTITY];
-    char response[MAX_RESPONSE];
+    int intent;               /* index of the intent in all_intents */
+    const char *entity;       /* the entity (need not be null-terminated) */
+    int len;                  /* number of characters in the entity */
+    char *response;           /* a buffer to receive the response */
+    int n;                    /* the size of the response buffer */
+    int status;               /* set to KB_OK or KB_NOTFOUND */
+    int entity_id;            /* used by knowledge_probe() */
+} PROBE;
+
+/* a line of input to be handled by chatbot_main_batch() */
+typedef struct request
+{
+    const char *line;   /* the line of input */
+    int inc;            /* the number of words in the line */
+    const TOKEN *inv;   /* the position of each word in the line, as found by tokenize() */
+    char *response;     /* a buffer to receive the response */
+    int n;              /* the size of the response buffer */
+    int done;           /* set to chatbot_main()'s return value by chatbot_task() */
+} REQUEST;
+
+/* a work-stealing thread pool (see pool.c) */
+typedef struct pool POOL;
+
+/* the most questions chatbot_main_batch() looks up together */
+#define MAX_BATCH 32
+
+/* the number of records knowledge_export() and knowledge_import() move between
+   reports of their progress */
+#define STREAM_CHUNK 65536
+
+extern INTENT all_intents[MAX_NO_OF_INTENT];
+
+/* functions defined in chatbot.c and knowledge.c for handling batches of requests. */
+int chatbot_main_batch(REQUEST requests[], int count);
+void chatbot_task(void *request);
+void knowledge_probe(PROBE probes[], int count);
+
+/* functions defined in pool.c */
+POOL *pool_create(int workers, int pin);
+int pool_submit(POOL *pool, void (*fn)(void *arg), void *arg);
+void pool_wait(POOL *pool);
+void pool_destroy(POOL *pool);
+int pool_cores();
+
+/* functions defined in compress.c */
+int compress_response(const char *response, int len, unsigned char *out);
+int decompress_response(const unsigned char *in, int in_len, char *response, int n);
+void compress_release(const unsigned char *in, int in_len);
+int compress_rebuild(const unsigned char *in, int in_len, int len, unsigned char *out);
+int compress_rebuild_end(int keep);
+void compress_reset();
+long compress_dictionary_bytes();
+long compress_dead_bytes();
+
+/* an entity, normalized for looking up (see normalize.c) */
+typedef struct key
+{
+    char *text;             /* the key (not null-terminated); points to space if it fits */
+    int length;             /* number of characters in the key */
+    unsigned long hash;     /* hash_token() of the key */
+    char space[MAX_KEY];
+} KEY;
+
+/* functions defined in normalize.c */
+int normalize_key(KEY *key, const char *entity, int len);
+void normalize_free(KEY *key);
+int normalize_same(const char *a, int a_len, const char *b, int b_len);
+int normalize_load(FILE *f);
+void normalize_reset();
+
+/* functions defined in intern.c */
+int intern_lookup(const KEY *key);
+int intern_entity(const KEY *key, const char *entity, int len);
+const char *intern_string(int id, int *len);
+void intern_reset();
+void intern_prefetch(unsigned long hash);
+int intern_count();
+int intern_rebuild(const unsigned char *live);
+void intern_rebuild_end(int keep);
+long intern_bytes();
+
+/* functions defined in session.c */
+int session_open(unsigned long key);
+void session_close();
+void session_remember(int intent, const char *entity, int len);
+int session_recall(int pronoun, char *entity);
+double session_take(double cost, double rate, double burst);
+
+/* functions defined in sched.c */
+int sched_start(int admin_workers, double rate);
+int sched_classify(const char *line, int inc, const TOKEN inv[]);
+int sched_main(const char *line, int inc, const TOKEN inv[], char *response, int n);
+void sched_stop();
+
+/* a run of plain text, or a slot, in a template */
+typedef struct part
+{
+    const char *text;   /* the plain text, if this is not a slot */
+    int length;         /* the number of characters of plain text */
+    int slot;           /* the SLOT_* of the slot, or -1 for plain text */
+} PART;
+
+/* text with slots in it, split into its parts by template_compile() */
+typedef struct template
+{
+    int count;
+    PART parts[MAX_PARTS];
+} TEMPLATE;
+
+/* the values to fill the slots of a template with, by SLOT_*; NULL if none */
+typedef struct slots
+{
+    const char *value[SLOT_KINDS];
+    int length[SLOT_KINDS];
+} SLOTS;
+
+/* functions defined in template.c */
+int template_copy(char *out, int at, int n, const char *s, int len);
+int template_compile(const char *text, int len, TEMPLATE *template);
+int template_render(const TEMPLATE *template, const SLOTS *slots, char *out, int n);
+int template_has_slots(const char *text, int len);
+int template_number(long value, char *buffer);
 
-} SMALLTALK;
+/* functions defined in compact.c */
+int compact_start(double interval, FILE *log);
+int compact_now();
+void compact_stats(COMPACT_STATS *stats);
+void compact_stop();
 
-INTENT all_intents[MAX_NO_OF_INTENT];
+/* functions defined in shard.c */
+int shard_start(int count);
+int shard_count();
+int shard_get(const char *intent, const char *entity, int len, char *response, int n);
+int shard_put(const char *intent, const char *entity, int len, const char *response);
+int shard_about(const char *entity, int len, char *responses[], int n);
+void shard_begin_load();
+void shard_load_put(const char *intent, const char *entity, int len, const char *response);
+int shard_end_load(COLLISIONS *collisions);
+void shard_write(FILE *f);
+long shard_export(FILE *f, void (*progress)(long records));
+void shard_reset();
+int shard_questions();
+int shard_snapshot(const char *name);
+int shard_rollback(const char *name);
 
 /* functions defined in knowledge.c for utility purposes. */
-void init_knowledge();
-QUESTION *create_question(const char *entity, const char *response);
-SMALLTALK *create_smalltalk(const char *topic, const char *response);
+QUESTION *create_question(int entity, const char *response);
+void copy_response(const QUESTION *question_ptr, char *response, int n);
+int read_line(FILE *f, char **buffer, int *size);
+void write_field(FILE *f, const char *s, int len);
+int split_record(char *line, char *fields[], int lengths[], int max);
 char *ltrim(char *s);
 char *rtrim(char *s);
 char *trim(char *s);
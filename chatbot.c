@@ -10,11 +10,15 @@
  * works as described here.
  *
  * Input parameters:
+ *   line     - the line of input
  *   inc      - the number of words in the question
- *   inv      - an array of pointers to each word in the question
+ *   inv      - the position of each word in the line, as found by tokenize()
  *   response - a buffer to receive the response
  *   n        - the size of the response buffer
  *
+ * Words are never copied out of the line; a word is the inv[i].length
+ * characters starting at line + inv[i].offset.
+ *
  * The first word indicates the intent. If the intent is not recognised, the
  * chatbot should respond with "I do not understand [intent]." or similar, and
  * ignore the rest of the input.
@@ -23,14 +27,19 @@
  *    - for WHAT, WHERE and WHO, it may be "is" or "are".
  *    - for SAVE, it may be "as" or "to".
  *    - for LOAD, it may be "from".
+ *    - for EXPORT, it may be "to".
+ *    - for IMPORT, it may be "from".
+ *    - for ROLLBACK, it may be "to".
+ *    - for TELL, it may be "me", followed by "about".
  * The word is otherwise ignored and may be omitted.
  *
  * The remainder of the input (including the second word, if it is not one of the
  * above) is the entity.
  *
  * The chatbot's answer should be stored in the output buffer, and be no longer
- * than n characters long (you can use snprintf() to do this). The contents of
- * this buffer will be printed by the main loop.
+ * than n characters long. The chatbot's own answers are templates (see
+ * template.c), compiled once and filled in by say(). The contents of this
+ * buffer will be printed by the main loop.
  *
  * The behaviour of the other functions is described individually in a comment
  * immediately before the function declaration.
@@ -44,8 +53,169 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include "chat1002.h"
 
+/* the chatbot's own answers */
+#define MSG_GOODBYE 0
+#define MSG_NO_PATH 1
+#define MSG_NOT_FOUND 2
+#define MSG_LOADED 3
+#define MSG_INVALID_QUESTION 4
+#define MSG_SAD 5
+#define MSG_THANKS 6
+#define MSG_PUT_FAILED 7
+#define MSG_NO_MEMORY 8
+#define MSG_GET_FAILED 9
+#define MSG_TELL_WHAT 10
+#define MSG_UNKNOWN_ENTITY 11
+#define MSG_NOTHING_TO_RESET 12
+#define MSG_RESET 13
+#define MSG_OPEN_FAILED 14
+#define MSG_SAVED 15
+#define MSG_EXPORT_NO_MEMORY 16
+#define MSG_WRITE_FAILED 17
+#define MSG_EXPORTED 18
+#define MSG_IMPORTED 19
+#define MSG_I_SEE 20
+#define MSG_SNAPSHOT_WHAT 21
+#define MSG_SNAPSHOT_TAKEN 22
+#define MSG_ROLLBACK_WHAT 23
+#define MSG_ROLLED_BACK 24
+#define MSG_NO_SNAPSHOT 25
+#define MSG_COLLIDED 26
+#define MESSAGE_COUNT 27
+
+static const char *message_text[MESSAGE_COUNT] = {
+	[MSG_GOODBYE] = "Goodbye!",
+	[MSG_NO_PATH] = "No file path detected.",
+	[MSG_NOT_FOUND] = "{file} not found.",
+	[MSG_LOADED] = "Successfully loaded {count} responses from {file}",
+	[MSG_INVALID_QUESTION] = "Invalid question!",
+	[MSG_SAD] = ":-(",
+	[MSG_THANKS] = "Thank You.",
+	[MSG_PUT_FAILED] = "Something went wrong!",
+	[MSG_NO_MEMORY] = "No memory currently!",
+	[MSG_GET_FAILED] = "Something when wrong!",
+	[MSG_TELL_WHAT] = "Tell you about what?",
+	[MSG_UNKNOWN_ENTITY] = "I don't know anything about {entity}.",
+	[MSG_NOTHING_TO_RESET] = "Nothing to reset.",
+	[MSG_RESET] = "{bot} Reset.",
+	[MSG_OPEN_FAILED] = "Error when opening file!",
+	[MSG_SAVED] = "My knowledge has been saved to {file}.",
+	[MSG_EXPORT_NO_MEMORY] = "Not enough memory to export my knowledge.",
+	[MSG_WRITE_FAILED] = "Error when writing to {file}.",
+	[MSG_EXPORTED] = "Exported {count} records to {file}.",
+	[MSG_IMPORTED] = "Successfully imported {count} records from {file}",
+	[MSG_I_SEE] = "I see.",
+	[MSG_SNAPSHOT_WHAT] = "What should I call the snapshot?",
+	[MSG_SNAPSHOT_TAKEN] = "Snapshot {entity} taken.",
+	[MSG_ROLLBACK_WHAT] = "Roll back to which snapshot?",
+	[MSG_ROLLED_BACK] = "Rolled back to {entity}.",
+	[MSG_NO_SNAPSHOT] = "I have no snapshot called {entity}.",
+	[MSG_COLLIDED] = ". {count} of them went under an entity I knew by another spelling, e.g. {entity}."};
+
+/* the answers, compiled the first time one is needed */
+static TEMPLATE messages[MESSAGE_COUNT];
+static pthread_once_t messages_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Compile the chatbot's answers into templates.
+ */
+static void compile_messages()
+{
+	for (int i = 0; i < MESSAGE_COUNT; i++)
+		template_compile(message_text[i], strlen(message_text[i]), &messages[i]);
+}
+
+/*
+ * Give one of the chatbot's answers.
+ *
+ * Input:
+ *  message  - the MSG_* of the answer
+ *  slots    - the values for its slots (the bot's name is filled in here), or
+ *             NULL if it has none
+ *  response - a buffer to receive the answer
+ *  n        - the size of the response buffer
+ */
+static void say(int message, SLOTS *slots, char *response, int n)
+{
+	pthread_once(&messages_once, compile_messages);
+	if (slots != NULL)
+	{
+		slots->value[SLOT_BOT] = chatbot_botname();
+		slots->length[SLOT_BOT] = strlen(slots->value[SLOT_BOT]);
+	}
+	template_render(&messages[message], slots, response, n);
+}
+
+/*
+ * Give one of the chatbot's answers that names a file and, optionally, a
+ * number of things.
+ *
+ * Input:
+ *  message  - the MSG_* of the answer
+ *  file     - the name of the file
+ *  count    - the number of things, or -1 if the answer has no number
+ *  response - a buffer to receive the answer
+ *  n        - the size of the response buffer
+ */
+static void say_file(int message, const char *file, long count, char *response, int n)
+{
+	SLOTS slots;
+	char digits[21];
+
+	memset(&slots, 0, sizeof(slots));
+	slots.value[SLOT_FILE] = file;
+	slots.length[SLOT_FILE] = strlen(file);
+	if (count >= 0)
+	{
+		slots.value[SLOT_COUNT] = digits;
+		slots.length[SLOT_COUNT] = template_number(count, digits);
+	}
+	say(message, &slots, response, n);
+}
+
+/*
+ * Add to an answer the questions a load put under an entity already spelt
+ * differently, with the first of them as an example.
+ *
+ * Input:
+ *  collisions - the collisions, as knowledge_read() found them
+ *  response   - the answer so far, which this adds to
+ *  n          - the size of the response buffer
+ */
+static void say_collisions(const COLLISIONS *collisions, char *response, int n)
+{
+	SLOTS slots;
+	char digits[21];
+	char example[2 * MAX_INPUT + 16];
+	int len = strlen(response);
+
+	memset(&slots, 0, sizeof(slots));
+	slots.value[SLOT_COUNT] = digits;
+	slots.length[SLOT_COUNT] = template_number(collisions->count, digits);
+	slots.value[SLOT_ENTITY] = example;
+	slots.length[SLOT_ENTITY] = snprintf(example, sizeof(example), "\"%s\" as \"%s\"", collisions->read,
+										 collisions->known);
+	say(MSG_COLLIDED, &slots, response + len, n - len);
+}
+
+/*
+ * Find what a word means as the first word of input.
+ *
+ * Input:
+ *  intent - the first character of the word
+ *  len    - the number of characters in the word
+ *
+ * Returns: the VERB_* for the word (VERB_NONE if it is not a command)
+ */
+static int find_verb(const char *intent, int len)
+{
+	const VOCAB *word = vocab_find(intent, len, hash_token(intent, len));
+	return word != NULL ? word->verb : VERB_NONE;
+}
+
 /*
  * Get the name of the chatbot.
  *
@@ -68,6 +238,149 @@ const char *chatbot_username()
 	return "User";
 }
 
+/*
+ * Find where the entity of a question starts. As it always has, the entity
+ * starts at the third word, whatever the second one is ("what is SIT", "who
+ * was Gerald"); a question of fewer than three words has no entity.
+ *
+ * Input:
+ *  line - the line of input
+ *  inc  - the number of words in the input
+ *  inv  - the position of each word in the line
+ *
+ * Returns: the index in inv of the first word of the entity, or -1 if the
+ * question has no entity
+ */
+static int find_entity(const char *line, int inc, const TOKEN inv[])
+{
+	return inc < 3 ? -1 : 2;
+}
+
+/*
+ * Find the length of the entity of a question, which runs from its first word
+ * to the end of the last word of input, together with any '+' and '#' ending
+ * it: tokenize() takes those for punctuation, but they are part of the
+ * entity's key ("C++", "C#"; see normalize.c).
+ *
+ * Input:
+ *  line  - the line of input
+ *  first - the index in inv of the first word of the entity
+ *  inc   - the number of words in the input
+ *  inv   - the position of each word in the line
+ *
+ * Returns: the number of characters in the entity
+ */
+static int entity_length(const char *line, int first, int inc, const TOKEN inv[])
+{
+	int end = inv[inc - 1].offset + inv[inc - 1].length;
+	while (line[end] == '+' || line[end] == '#')
+		end++;
+	return end - inv[first].offset;
+}
+
+/*
+ * Find the entity a one-word pronoun entity ("it", "he"...) stands for in the
+ * current conversation (see session.c).
+ *
+ * Input:
+ *  line   - the line of input
+ *  first  - the index in inv of the first word of the entity
+ *  inc    - the number of words in the input
+ *  inv    - the position of each word in the line
+ *  buffer - a buffer of SESSION_ENTITY characters to receive the entity
+ *
+ * Returns: the number of characters in the entity, or 0 if the entity is not
+ * a pronoun or the conversation has nothing it could stand for
+ */
+static int recall_entity(const char *line, int first, int inc, const TOKEN inv[], char *buffer)
+{
+	if (first != inc - 1)
+		return 0;
+
+	const VOCAB *word = vocab_find(line + inv[first].offset, inv[first].length, inv[first].hash);
+	if (word == NULL || word->pronoun == PRONOUN_NONE)
+		return 0;
+	return session_recall(word->pronoun, buffer);
+}
+
+/*
+ * Find the first word of input that names a .ini file and copy it out so that
+ * it can be passed to fopen().
+ *
+ * Input:
+ *  line     - the line of input
+ *  inc      - the number of words in the input
+ *  inv      - the position of each word in the line
+ *  filename - a buffer to receive the file name
+ *  n        - the size of the filename buffer
+ *
+ * Returns: 1, if a file name was found; 0, otherwise
+ */
+static int find_filename(const char *line, int inc, const TOKEN inv[], char *filename, int n)
+{
+	for (int i = 1; i < inc; i++)
+	{
+		const char *word = line + inv[i].offset;
+		for (int j = 0; j + 4 <= inv[i].length; j++)
+		{
+			if (strncmp(word + j, ".ini", 4) == 0)
+			{
+				snprintf(filename, n, "%.*s", inv[i].length, word);
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * Find the file named by the rest of an EXPORT or IMPORT command (after "to"
+ * or "from", if there is one) and copy it out so that it can be passed to
+ * fopen(). Unlike LOAD and SAVE, any name will do, and it is taken from the
+ * line as it is rather than from its words, so that "-" (which is not a word)
+ * can name the standard input or output. SNAPSHOT and ROLLBACK find the name
+ * of a snapshot the same way.
+ *
+ * Input:
+ *  line - the line of input
+ *  inc  - the number of words in the input
+ *  inv  - the position of each word in the line
+ *  path - a buffer to receive the file name
+ *  n    - the size of the path buffer
+ *
+ * Returns: 1, if a file name was found; 0, otherwise
+ */
+static int find_path(const char *line, int inc, const TOKEN inv[], char *path, int n)
+{
+	int skip = 0;
+	if (inc > 1 && (compare_span(line + inv[1].offset, inv[1].length, "to") == 0 ||
+					compare_span(line + inv[1].offset, inv[1].length, "from") == 0))
+	{
+		skip = 1;
+	}
+
+	const char *start = line + inv[skip].offset + inv[skip].length;
+	while (isspace((unsigned char)*start))
+		start++;
+	int len = strlen(start);
+	while (len > 0 && isspace((unsigned char)start[len - 1]))
+		len--;
+	if (len == 0)
+		return 0;
+
+	snprintf(path, n, "%.*s", len, start);
+	return 1;
+}
+
+/*
+ * Report how far an export or import has got, on the standard error so that it
+ * does not get mixed up with records on the standard output.
+ */
+static void report_progress(long records)
+{
+	fprintf(stderr, "%ld records\n", records);
+}
+
 /*
  * Get a response to user input.
  *
@@ -78,54 +391,264 @@ const char *chatbot_username()
  *   0, if the chatbot should continue chatting
  *   1, if the chatbot should stop (i.e. it detected the EXIT intent)
  */
-int chatbot_main(int inc, char *inv[], char *response, int n)
+int chatbot_main(const char *line, int inc, const TOKEN inv[], char *response, int n)
 {
-	if (strlen(all_intents[0].intent) == 0)
-	{
-		init_knowledge();
-	}
-
 	/* check for empty input */
 	if (inc < 1)
 	{
-		snprintf(response, n, "");
+		if (n > 0)
+			response[0] = '\0';
 		return 0;
 	}
 
-	/* look for an intent and invoke the corresponding do_* function */
-	if (chatbot_is_exit(inv[0]))
-		return chatbot_do_exit(inc, inv, response, n);
-	else if (chatbot_is_load(inv[0]))
-		return chatbot_do_load(inc, inv, response, n);
-	else if (chatbot_is_question(inv[0]))
-		return chatbot_do_question(inc, inv, response, n);
-	else if (chatbot_is_reset(inv[0]))
-		return chatbot_do_reset(inc, inv, response, n);
-	else if (chatbot_is_save(inv[0]))
-		return chatbot_do_save(inc, inv, response, n);
-	else if (chatbot_is_smalltalk(inv[0]))
-		return chatbot_do_smalltalk(inc, inv, response, n);
+	/* look for an intent and invoke the corresponding do_* function; the
+	   first word's hash from tokenize() finds it in the built-in words */
+	const VOCAB *word = vocab_find(line + inv[0].offset, inv[0].length, inv[0].hash);
+	switch (word != NULL ? word->verb : VERB_NONE)
+	{
+	case VERB_EXIT:
+		return chatbot_do_exit(line, inc, inv, response, n);
+	case VERB_LOAD:
+		return chatbot_do_load(line, inc, inv, response, n);
+	case VERB_QUESTION:
+		return chatbot_do_question(line, inc, inv, response, n);
+	case VERB_RESET:
+		return chatbot_do_reset(line, inc, inv, response, n);
+	case VERB_SAVE:
+		return chatbot_do_save(line, inc, inv, response, n);
+	case VERB_TELL:
+		return chatbot_do_tell(line, inc, inv, response, n);
+	case VERB_EXPORT:
+		return chatbot_do_export(line, inc, inv, response, n);
+	case VERB_IMPORT:
+		return chatbot_do_import(line, inc, inv, response, n);
+	case VERB_SNAPSHOT:
+		return chatbot_do_snapshot(line, inc, inv, response, n);
+	case VERB_ROLLBACK:
+		return chatbot_do_rollback(line, inc, inv, response, n);
+	default:
+		return chatbot_do_smalltalk(line, inc, inv, response, n);
+	}
+}
+
+/*
+ * Get a response to user input, as chatbot_main() (or sched_main()) does, into
+ * a buffer that grows to fit it.
+ *
+ * The buffer is first made big enough for any response but an answer to a
+ * question or TELL, which are the only ones that do not come mostly from the
+ * input. Since neither of those changes anything, either is simply asked
+ * again, with twice the room, for as long as its response fills the buffer.
+ *
+ * Input:
+ *   line     - the user input
+ *   inc      - the number of words in the input
+ *   inv      - the words, as found by tokenize()
+ *   response - pointer to the buffer, which may start as NULL
+ *   size     - pointer to the size of the buffer
+ *   handler  - chatbot_main() or sched_main()
+ *
+ * Returns: as the handler, or KB_NOMEM if the buffer could not be grown
+ */
+int chatbot_reply(const char *line, int inc, const TOKEN inv[], char **response, int *size,
+				  int (*handler)(const char *, int, const TOKEN[], char *, int))
+{
+	int needed = MAX_RESPONSE + strlen(line);
+	const VOCAB *word = inc > 0 ? vocab_find(line + inv[0].offset, inv[0].length, inv[0].hash) : NULL;
+	int verb = word != NULL ? word->verb : VERB_NONE;
+
+	while (1)
+	{
+		if (*size < needed)
+		{
+			char *new_response = (char *)realloc(*response, needed);
+			if (new_response == NULL)
+				return KB_NOMEM;
+			*response = new_response;
+			*size = needed;
+		}
+
+		int done = handler(line, inc, inv, *response, *size);
+		if ((verb != VERB_QUESTION && verb != VERB_TELL) || (int)strlen(*response) < *size - 1)
+			return done;
+		needed = *size * 2;
+	}
+}
+
+/*
+ * Ask the user for the response to a question that is not in the knowledge
+ * base, and put it there.
+ *
+ * Input:
+ *  line         - the line of input
+ *  inv          - the position of each word in the line
+ *  first        - the index in inv of the first word of the entity
+ *  intent_index - the index of the question's intent in all_intents
+ *  entity       - the entity (need not be null-terminated)
+ *  entity_len   - the number of characters in the entity
+ *  response     - a buffer to receive the answer
+ *  n            - the size of the response buffer
+ *
+ * Returns: as knowledge_put(), or KB_NOTFOUND if the user gave no response
+ */
+static int teach_question(const char *line, const TOKEN inv[], int first, int intent_index, const char *entity,
+						  int entity_len, char *response, int n)
+{
+	char *user_input = NULL;
+	int size = 0;
+	int status = KB_NOTFOUND;
+	int len = prompt_user(&user_input, &size, "I don't know. %.*s%.*s?",
+						  inv[first].offset - inv[0].offset, line + inv[0].offset, entity_len, entity);
+
+	// Display :-( if user input is empty.
+	if (len < 1)
+	{
+		say(MSG_SAD, NULL, response, n);
+	}
 	else
 	{
-		snprintf(response, n, "I don't understand \"%s\".", inv[0]);
-		return 0;
+		// Put new question into knowledge of chatbot.
+		status = knowledge_put(all_intents[intent_index].intent, entity, entity_len, user_input);
+		if (status == KB_OK)
+		{
+			say(MSG_THANKS, NULL, response, n);
+		}
+		else
+		{
+			say(MSG_PUT_FAILED, NULL, response, n);
+		}
 	}
+	free(user_input);
+	return status;
+}
+
+/*
+ * Get responses to a batch of requests.
+ *
+ * The responses are the same as calling chatbot_main() on each request in
+ * turn, but runs of questions are handled in stages: the intent and entity of
+ * every question in the run are worked out first, then all of them are looked
+ * up together with knowledge_probe() so that their cache misses overlap, and
+ * finally the responses are copied out. Anything that is not a question goes
+ * through chatbot_main() as usual, in order. A question that was not found is
+ * taught straight away, unless an earlier question in the run was taught, which
+ * may have put it in the knowledge base since the probe; then it is asked
+ * again with chatbot_do_question().
+ *
+ * Input:
+ *   requests - the requests
+ *   count    - the number of requests
+ *
+ * Returns: the number of requests handled; this is less than count if one of
+ * them was EXIT, in which case the requests after it are not handled
+ */
+int chatbot_main_batch(REQUEST requests[], int count)
+{
+	PROBE probes[MAX_BATCH];
+	int handled = 0;
+
+	while (handled < count)
+	{
+		// Resolve the intent and entity of the run of questions starting here.
+		int run = 0;
+		while (handled + run < count && run < MAX_BATCH)
+		{
+			REQUEST *request = &requests[handled + run];
+			if (request->inc < 1)
+				break;
+			const VOCAB *word = vocab_find(request->line + request->inv[0].offset,
+										   request->inv[0].length, request->inv[0].hash);
+			int intent = word != NULL ? word->intent : -1;
+			int first = find_entity(request->line, request->inc, request->inv);
+			if (intent < 0 || first < 0)
+				break;
+
+			// A pronoun depends on the questions before it, so it ends the run.
+			if (first == request->inc - 1)
+			{
+				const TOKEN *word = &request->inv[first];
+				const VOCAB *pronoun = vocab_find(request->line + word->offset, word->length, word->hash);
+				if (pronoun != NULL && pronoun->pronoun != PRONOUN_NONE)
+					break;
+			}
+
+			PROBE *probe = &probes[run];
+			probe->intent = intent;
+			probe->entity = request->line + request->inv[first].offset;
+			probe->len = entity_length(request->line, first, request->inc, request->inv);
+			probe->response = request->response;
+			probe->n = request->n;
+			run++;
+		}
+
+		// Anything other than a question (or a question about a pronoun) is
+		// handled by itself.
+		if (run == 0)
+		{
+			REQUEST *request = &requests[handled++];
+			if (chatbot_main(request->line, request->inc, request->inv, request->response, request->n))
+				break;
+			continue;
+		}
+
+		// Look up the whole run at once; knowledge_probe() copies out the
+		// responses it finds, and the rest are taught.
+		knowledge_probe(probes, run);
+		int taught = 0;
+		for (int i = 0; i < run; i++)
+		{
+			REQUEST *request = &requests[handled + i];
+			int status = probes[i].status;
+			if (status != KB_OK && taught)
+			{
+				chatbot_do_question(request->line, request->inc, request->inv, request->response, request->n);
+				continue;
+			}
+			if (status != KB_OK)
+			{
+				int first = find_entity(request->line, request->inc, request->inv);
+				status = teach_question(request->line, request->inv, first, probes[i].intent, probes[i].entity,
+										probes[i].len, request->response, request->n);
+				taught = status == KB_OK;
+			}
+			if (status == KB_OK)
+				session_remember(probes[i].intent, probes[i].entity, probes[i].len);
+		}
+		handled += run;
+	}
+
+	return handled;
+}
+
+/*
+ * Get the response to a request as a task for a thread pool, e.g.
+ *
+ *   pool_submit(pool, chatbot_task, &request);
+ *
+ * Input:
+ *   request - the REQUEST; its done field is set to chatbot_main()'s return
+ *             value
+ */
+void chatbot_task(void *request)
+{
+	REQUEST *r = (REQUEST *)request;
+	r->done = chatbot_main(r->line, r->inc, r->inv, r->response, r->n);
 }
 
 /*
  * Determine whether an intent is EXIT.
  *
  * Input:
- *  intent - the intent
+ *  intent - the first character of the intent
+ *  len    - the number of characters in the intent
  *
  * Returns:
  *  1, if the intent is "exit" or "quit"
  *  0, otherwise
  */
-int chatbot_is_exit(const char *intent)
+int chatbot_is_exit(const char *intent, int len)
 {
-	return compare_token(intent, "exit") == 0 ||
-		   compare_token(intent, "quit") == 0;
+	return find_verb(intent, len) == VERB_EXIT;
 }
 
 /*
@@ -137,10 +660,10 @@ int chatbot_is_exit(const char *intent)
  * Returns:
  *   0 (the chatbot always continues chatting after a question)
  */
-int chatbot_do_exit(int inc, char *inv[], char *response, int n)
+int chatbot_do_exit(const char *line, int inc, const TOKEN inv[], char *response, int n)
 {
-	int quit = chatbot_do_reset(inc, inv, response, n);
-	snprintf(response, n, "Goodbye!");
+	chatbot_do_reset(line, inc, inv, response, n);
+	say(MSG_GOODBYE, NULL, response, n);
 
 	return 1;
 }
@@ -149,15 +672,16 @@ int chatbot_do_exit(int inc, char *inv[], char *response, int n)
  * Determine whether an intent is LOAD.
  *
  * Input:
- *  intent - the intent
+ *  intent - the first character of the intent
+ *  len    - the number of characters in the intent
  *
  * Returns:
  *  1, if the intent is "load"
  *  0, otherwise
  */
-int chatbot_is_load(const char *intent)
+int chatbot_is_load(const char *intent, int len)
 {
-	return compare_token(intent, "load") == 0;
+	return find_verb(intent, len) == VERB_LOAD;
 }
 
 /*
@@ -169,27 +693,15 @@ int chatbot_is_load(const char *intent)
  * Returns:
  *   0 (the chatbot always continues chatting after loading knowledge)
  */
-int chatbot_do_load(int inc, char *inv[], char *response, int n)
+int chatbot_do_load(const char *line, int inc, const TOKEN inv[], char *response, int n)
 {
-	char *filename = NULL, *word;
+	char filename[FILENAME_MAX];
 	FILE *file;
 
-	// Check if there is a word contain .ini inside inv[], if there is,
-	// that is the filename.
-	for (int i = 1; i < inc; i++)
-	{
-		word = inv[i];
-		if (strstr(word, ".ini"))
-		{
-			filename = word;
-			break;
-		}
-	}
-
 	// If filename is not found in inv, return no file detected.
-	if (filename == NULL)
+	if (find_filename(line, inc, inv, filename, sizeof(filename)) == 0)
 	{
-		snprintf(response, n, "No file path detected.");
+		say(MSG_NO_PATH, NULL, response, n);
 		return 0;
 	}
 
@@ -197,14 +709,17 @@ int chatbot_do_load(int inc, char *inv[], char *response, int n)
 	file = fopen(filename, "r");
 	if (file == NULL)
 	{
-		snprintf(response, n, "%s not found.", filename);
+		say_file(MSG_NOT_FOUND, filename, -1, response, n);
 	}
 	else
 	{
 		// Read the open file and get back number of lines read.
-		int lines_read = knowledge_read(file);
-		snprintf(response, n, "Successfully loaded %d responses from %s",
-				 lines_read, filename);
+		COLLISIONS collisions;
+		int lines_read = knowledge_read(file, &collisions);
+		say_file(MSG_LOADED, filename, lines_read, response, n);
+		if (collisions.count > 0)
+			say_collisions(&collisions, response, n);
+		fclose(file);
 	}
 
 	return 0;
@@ -214,22 +729,16 @@ int chatbot_do_load(int inc, char *inv[], char *response, int n)
  * Determine whether an intent is a question.
  *
  * Input:
- *  intent - the intent
+ *  intent - the first character of the intent
+ *  len    - the number of characters in the intent
  *
  * Returns:
  *  1, if the intent is "what", "where", or "who"
  *  0, otherwise
  */
-int chatbot_is_question(const char *intent)
+int chatbot_is_question(const char *intent, int len)
 {
-	for (int i = 0; i < MAX_NO_OF_INTENT - 1; i++)
-	{
-		if (compare_token(intent, all_intents[i].intent) == 0)
-		{
-			return 1;
-		}
-	}
-	return 0;
+	return knowledge_intent(intent, len) >= 0;
 }
 
 /*
@@ -245,97 +754,141 @@ int chatbot_is_question(const char *intent)
  * Returns:
  *   0 (the chatbot always continues chatting after a question)
  */
-int chatbot_do_question(int inc, char *inv[], char *response, int n)
+int chatbot_do_question(const char *line, int inc, const TOKEN inv[], char *response, int n)
 {
-	if (inc < 3)
+	// The entity runs from the third word on.
+	int first = find_entity(line, inc, inv);
+	if (first < 0)
 	{
-		snprintf(response, n, "Invalid question!");
+		say(MSG_INVALID_QUESTION, NULL, response, n);
 		return 0;
 	}
 
-	char *intent = inv[0];
-
-	// Create pointer to point to entity. Must be not NULL.
-	char *entity = (char *)malloc(MAX_ENTITY);
-	if (entity == NULL)
+	// The entity is a span of the line, running from its first word to the
+	// end of the last word of input, unless it is a pronoun standing for an
+	// entity asked about before.
+	int intent_index = knowledge_intent(line + inv[0].offset, inv[0].length);
+	const char *intent = all_intents[intent_index].intent;
+	const char *entity = line + inv[first].offset;
+	int entity_len = entity_length(line, first, inc, inv);
+	char recalled[SESSION_ENTITY];
+	int recalled_len = recall_entity(line, first, inc, inv, recalled);
+	if (recalled_len > 0)
 	{
-		return KB_NOMEM;
+		entity = recalled;
+		entity_len = recalled_len;
 	}
-	strcpy(entity, "");
 
-	// Create pointer to point to whole_question. Must be not NULL.
-	char *whole_question = (char *)malloc(MAX_INPUT);
-	if (whole_question == NULL)
+	// Try to get response from knowledge and return into response buffer.
+	int status = knowledge_get(intent, entity, entity_len, response, n);
+
+	// If entity is not found, as user to input response for new entity.
+	if (status == KB_NOTFOUND)
+		status = teach_question(line, inv, first, intent_index, entity, entity_len, response, n);
+	// Entity is found, knowledge_get() has already put the response in place.
+	else if (status == KB_NOMEM)
+		say(MSG_NO_MEMORY, NULL, response, n);
+	else if (status != KB_OK)
+		say(MSG_GET_FAILED, NULL, response, n);
+
+	// Remember the entity so that a pronoun can stand for it later.
+	if (status == KB_OK)
+		session_remember(intent_index, entity, entity_len);
+
+	return 0;
+}
+
+/*
+ * Determine whether an intent is TELL.
+ *
+ * Input:
+ *  intent - the first character of the intent
+ *  len    - the number of characters in the intent
+ *
+ * Returns:
+ *  1, if the intent is "tell"
+ *  0, otherwise
+ */
+int chatbot_is_tell(const char *intent, int len)
+{
+	return find_verb(intent, len) == VERB_TELL;
+}
+
+/*
+ * Tell the user everything known about an entity, i.e. its response to every
+ * question word, as in "TELL ME ABOUT SIT".
+ *
+ * See the comment at the top of the file for a description of how this
+ * function is used.
+ *
+ * Returns:
+ *   0 (the chatbot always continues chatting after telling)
+ */
+int chatbot_do_tell(const char *line, int inc, const TOKEN inv[], char *response, int n)
+{
+	char stack_buffers[MAX_NO_OF_INTENT * MAX_RESPONSE];
+	char *responses[MAX_NO_OF_INTENT];
+
+	// Skip "me" and "about"; the rest is the entity.
+	int first = 1;
+	if (first < inc && compare_span(line + inv[first].offset, inv[first].length, "me") == 0)
+		first++;
+	if (first < inc && compare_span(line + inv[first].offset, inv[first].length, "about") == 0)
+		first++;
+	if (first >= inc)
 	{
-		return KB_NOMEM;
+		say(MSG_TELL_WHAT, NULL, response, n);
+		return 0;
 	}
-	strcpy(whole_question, "I don't know. ");
 
-	// Derive entity and whole_question from inv[] here.
-	int i = 0;
-	while (1)
+	const char *entity = line + inv[first].offset;
+	int entity_len = entity_length(line, first, inc, inv);
+	char recalled[SESSION_ENTITY];
+	int recalled_len = recall_entity(line, first, inc, inv, recalled);
+	if (recalled_len > 0)
 	{
-		// Check for the end of entity which will be NULL.
-		if (i > 1)
-		{
-			if (inv[i] == NULL)
-			{
-				entity[strlen(entity) - 1] = '\0';
-				whole_question[strlen(whole_question) - 1] = '\0';
-				break;
-			}
-
-			// If current inv[i] is not NULL, add it to entity string.
-			strcat(entity, inv[i]);
-			strcat(entity, " ");
-		}
-		strcat(whole_question, inv[i]);
-		strcat(whole_question, " ");
-		i++;
+		entity = recalled;
+		entity_len = recalled_len;
 	}
 
-	// Try to get response from knowledge and return into response buffer.
-	int status = knowledge_get(intent, entity, response, n);
-
-	// If entity is not found, as user to input response for new entity.
-	if (status == KB_NOTFOUND)
+	// No one response can be longer than all of them joined up; the buffers
+	// are only allocated when there is more room than usual.
+	char *buffers = n <= MAX_RESPONSE ? stack_buffers : (char *)malloc((size_t)MAX_NO_OF_INTENT * n);
+	if (buffers == NULL)
 	{
-		char user_input[MAX_INPUT];
-		strcat(whole_question, "?");
-		prompt_user(user_input, MAX_INPUT, whole_question);
+		say(MSG_NO_MEMORY, NULL, response, n);
+		return 0;
+	}
+	for (int i = 0; i < MAX_NO_OF_INTENT; i++)
+		responses[i] = buffers + (size_t)i * n;
 
-		// Display :-( if user input is empty.
-		if (compare_token(user_input, "") == 0)
-		{
-			snprintf(response, n, ":-(");
-		}
-		else
-		{
-			// Put new question into knowledge of chatbot.Î
-			status = knowledge_put(intent, entity, user_input);
-			if (status == KB_OK)
-			{
-				snprintf(response, n, "Thank You.");
-			}
-			else
-			{
-				snprintf(response, n, "Something went wrong!");
-			}
-		}
+	// All of the entity's responses come from one lookup; join them up,
+	// truncating if there are too many.
+	if (knowledge_about(entity, entity_len, responses, n) == 0)
+	{
+		SLOTS slots;
+		memset(&slots, 0, sizeof(slots));
+		slots.value[SLOT_ENTITY] = entity;
+		slots.length[SLOT_ENTITY] = entity_len;
+		say(MSG_UNKNOWN_ENTITY, &slots, response, n);
+		if (buffers != stack_buffers)
+			free(buffers);
+		return 0;
 	}
-	// Entity is found, display the respective response.
-	else if (status == KB_OK)
+
+	int length = 0;
+	response[0] = '\0';
+	for (int i = 0; i < MAX_NO_OF_INTENT; i++)
 	{
-		snprintf(response, n, "%s", response);
+		if (responses[i][0] == '\0')
+			continue;
+		if (length > 0)
+			length = template_copy(response, length, n, " ", 1);
+		length = template_copy(response, length, n, responses[i], strlen(responses[i]));
 	}
-	else if (status == KB_NOMEM)
-		snprintf(response, n, "No memory currently!");
-	else
-		snprintf(response, n, "Something when wrong!");
 
-	// Free pointers used.
-	free(entity);
-	free(whole_question);
+	if (buffers != stack_buffers)
+		free(buffers);
 	return 0;
 }
 
@@ -343,15 +896,16 @@ int chatbot_do_question(int inc, char *inv[], char *response, int n)
  * Determine whether an intent is RESET.
  *
  * Input:
- *  intent - the intent
+ *  intent - the first character of the intent
+ *  len    - the number of characters in the intent
  *
  * Returns:
  *  1, if the intent is "reset"
  *  0, otherwise
  */
-int chatbot_is_reset(const char *intent)
+int chatbot_is_reset(const char *intent, int len)
 {
-	return compare_token(intent, "reset") == 0;
+	return find_verb(intent, len) == VERB_RESET;
 }
 
 /*
@@ -363,16 +917,18 @@ int chatbot_is_reset(const char *intent)
  * Returns:
  *   0 (the chatbot always continues chatting after beign reset)
  */
-int chatbot_do_reset(int inc, char *inv[], char *response, int n)
+int chatbot_do_reset(const char *line, int inc, const TOKEN inv[], char *response, int n)
 {
 	// Reset knowledge.
-	if (all_intents[0].head_ptr == NULL && all_intents[1].head_ptr == NULL && all_intents[2].head_ptr == NULL && all_intents[3].head_ptr == NULL && all_intents[4].head_ptr == NULL && all_intents[5].head_ptr == NULL)
+	if (knowledge_count() == 0)
 	{
-		snprintf(response, n, "Nothing to reset.");
+		say(MSG_NOTHING_TO_RESET, NULL, response, n);
 		return 0;
 	}
 	knowledge_reset();
-	snprintf(response, n, "Chatbot Reset.");
+	SLOTS slots;
+	memset(&slots, 0, sizeof(slots));
+	say(MSG_RESET, &slots, response, n);
 	return 0;
 }
 
@@ -380,15 +936,16 @@ int chatbot_do_reset(int inc, char *inv[], char *response, int n)
  * Determine whether an intent is SAVE.
  *
  * Input:
- *  intent - the intent
+ *  intent - the first character of the intent
+ *  len    - the number of characters in the intent
  *
  * Returns:
  *  1, if the intent is "what", "where", or "who"
  *  0, otherwise
  */
-int chatbot_is_save(const char *intent)
+int chatbot_is_save(const char *intent, int len)
 {
-	return compare_token(intent, "save") == 0;
+	return find_verb(intent, len) == VERB_SAVE;
 }
 
 /*
@@ -400,61 +957,258 @@ int chatbot_is_save(const char *intent)
  * Returns:
  *   0 (the chatbot always continues chatting after saving knowledge)
  */
-int chatbot_do_save(int inc, char *inv[], char *response, int n)
+int chatbot_do_save(const char *line, int inc, const TOKEN inv[], char *response, int n)
 {
-	char *filename = NULL, *word;
+	char filename[FILENAME_MAX];
 	FILE *file;
 
-	// Check if there is a word contain .ini inside inv[], if there is,
-	// that is the filename.
-	for (int i = 1; i < inc; i++)
+	// If filename is not found in inv, return no file detected.
+	if (find_filename(line, inc, inv, filename, sizeof(filename)) == 0)
 	{
-		word = inv[i];
-		if (strstr(word, ".ini"))
-		{
-			filename = word;
-			break;
-		}
+		say(MSG_NO_PATH, NULL, response, n);
+		return 0;
 	}
 
 	// Open user file in write mode and write current knowledge into user file.
 	file = fopen(filename, "w");
 	if (file == NULL)
 	{
-		snprintf(response, n, "Error when opening file!");
+		say(MSG_OPEN_FAILED, NULL, response, n);
 		return 0;
 	}
 
 	// Write into file.
 	knowledge_write(file);
-	snprintf(response, n, "My knowledge has been saved to %s.", filename);
+	say_file(MSG_SAVED, filename, -1, response, n);
 	fclose(file);
 
 	return 0;
 }
 
 /*
- * Determine which an intent is smalltalk.
+ * Determine whether an intent is EXPORT.
  *
+ * Input:
+ *  intent - the first character of the intent
+ *  len    - the number of characters in the intent
+ *
+ * Returns:
+ *  1, if the intent is "export"
+ *  0, otherwise
+ */
+int chatbot_is_export(const char *intent, int len)
+{
+	return find_verb(intent, len) == VERB_EXPORT;
+}
+
+/*
+ * Export the chatbot's knowledge to a file as a stream of records (see
+ * knowledge_export()). The file "-" is the standard output, so the knowledge
+ * can be piped straight into another program.
+ *
+ * See the comment at the top of the file for a description of how this
+ * function is used.
+ *
+ * Returns:
+ *   0 (the chatbot always continues chatting after exporting knowledge)
+ */
+int chatbot_do_export(const char *line, int inc, const TOKEN inv[], char *response, int n)
+{
+	char path[FILENAME_MAX];
+
+	if (find_path(line, inc, inv, path, sizeof(path)) == 0)
+	{
+		say(MSG_NO_PATH, NULL, response, n);
+		return 0;
+	}
+
+	int to_stdout = strcmp(path, "-") == 0;
+	FILE *file = to_stdout ? stdout : fopen(path, "w");
+	if (file == NULL)
+	{
+		say(MSG_OPEN_FAILED, NULL, response, n);
+		return 0;
+	}
+
+	long records = knowledge_export(file, report_progress);
+	if (records < 0)
+		say(MSG_EXPORT_NO_MEMORY, NULL, response, n);
+	else if (ferror(file))
+		say_file(MSG_WRITE_FAILED, path, -1, response, n);
+	else
+		say_file(MSG_EXPORTED, path, records, response, n);
+	if (!to_stdout)
+		fclose(file);
+
+	return 0;
+}
+
+/*
+ * Determine whether an intent is IMPORT.
  *
  * Input:
- *  intent - the intent
+ *  intent - the first character of the intent
+ *  len    - the number of characters in the intent
  *
  * Returns:
- *  1, if the intent is the first word of one of the smalltalk phrases
+ *  1, if the intent is "import"
+ *  0, otherwise
+ */
+int chatbot_is_import(const char *intent, int len)
+{
+	return find_verb(intent, len) == VERB_IMPORT;
+}
+
+/*
+ * Import a stream of records (see knowledge_import()) from a file into the
+ * chatbot's knowledge. The file "-" is the standard input.
+ *
+ * See the comment at the top of the file for a description of how this
+ * function is used.
+ *
+ * Returns:
+ *   0 (the chatbot always continues chatting after importing knowledge)
+ */
+int chatbot_do_import(const char *line, int inc, const TOKEN inv[], char *response, int n)
+{
+	char path[FILENAME_MAX];
+
+	if (find_path(line, inc, inv, path, sizeof(path)) == 0)
+	{
+		say(MSG_NO_PATH, NULL, response, n);
+		return 0;
+	}
+
+	int from_stdin = strcmp(path, "-") == 0;
+	FILE *file = from_stdin ? stdin : fopen(path, "r");
+	if (file == NULL)
+	{
+		say_file(MSG_NOT_FOUND, path, -1, response, n);
+		return 0;
+	}
+
+	long stored = knowledge_import(file, report_progress);
+	say_file(MSG_IMPORTED, path, stored, response, n);
+	if (!from_stdin)
+		fclose(file);
+
+	return 0;
+}
+
+/*
+ * Determine whether an intent is SNAPSHOT.
+ *
+ * Input:
+ *  intent - the first character of the intent
+ *  len    - the number of characters in the intent
+ *
+ * Returns:
+ *  1, if the intent is "snapshot"
  *  0, otherwise
  */
-int chatbot_is_smalltalk(const char *intent)
+int chatbot_is_snapshot(const char *intent, int len)
 {
-	for (int i = 0; i < MAX_NO_OF_INTENT - 1; i++)
+	return find_verb(intent, len) == VERB_SNAPSHOT;
+}
+
+/*
+ * Name the current version of the chatbot's knowledge (see
+ * knowledge_snapshot()), so that it can be rolled back to.
+ *
+ * See the comment at the top of the file for a description of how this
+ * function is used.
+ *
+ * Returns:
+ *   0 (the chatbot always continues chatting after taking a snapshot)
+ */
+int chatbot_do_snapshot(const char *line, int inc, const TOKEN inv[], char *response, int n)
+{
+	char name[MAX_INPUT];
+	SLOTS slots;
+
+	if (find_path(line, inc, inv, name, sizeof(name)) == 0)
 	{
-		if (compare_token(intent, all_intents[i].intent) == 0)
-		{
-			return 0;
-		}
+		say(MSG_SNAPSHOT_WHAT, NULL, response, n);
+		return 0;
 	}
 
-	return 1;
+	int status = knowledge_snapshot(name);
+	if (status == KB_NOMEM)
+	{
+		say(MSG_NO_MEMORY, NULL, response, n);
+		return 0;
+	}
+	else if (status != KB_OK)
+	{
+		say(MSG_PUT_FAILED, NULL, response, n);
+		return 0;
+	}
+
+	memset(&slots, 0, sizeof(slots));
+	slots.value[SLOT_ENTITY] = name;
+	slots.length[SLOT_ENTITY] = strlen(name);
+	say(MSG_SNAPSHOT_TAKEN, &slots, response, n);
+	return 0;
+}
+
+/*
+ * Determine whether an intent is ROLLBACK.
+ *
+ * Input:
+ *  intent - the first character of the intent
+ *  len    - the number of characters in the intent
+ *
+ * Returns:
+ *  1, if the intent is "rollback"
+ *  0, otherwise
+ */
+int chatbot_is_rollback(const char *intent, int len)
+{
+	return find_verb(intent, len) == VERB_ROLLBACK;
+}
+
+/*
+ * Return the chatbot's knowledge to a snapshot (see knowledge_rollback()).
+ *
+ * See the comment at the top of the file for a description of how this
+ * function is used.
+ *
+ * Returns:
+ *   0 (the chatbot always continues chatting after rolling back)
+ */
+int chatbot_do_rollback(const char *line, int inc, const TOKEN inv[], char *response, int n)
+{
+	char name[MAX_INPUT];
+	SLOTS slots;
+
+	if (find_path(line, inc, inv, name, sizeof(name)) == 0)
+	{
+		say(MSG_ROLLBACK_WHAT, NULL, response, n);
+		return 0;
+	}
+
+	memset(&slots, 0, sizeof(slots));
+	slots.value[SLOT_ENTITY] = name;
+	slots.length[SLOT_ENTITY] = strlen(name);
+	say(knowledge_rollback(name) == KB_OK ? MSG_ROLLED_BACK : MSG_NO_SNAPSHOT, &slots, response, n);
+	return 0;
+}
+
+/*
+ * Determine which an intent is smalltalk.
+ *
+ *
+ * Input:
+ *  intent - the first character of the intent
+ *  len    - the number of characters in the intent
+ *
+ * Returns:
+ *  1, if the intent is the first word of one of the smalltalk phrases
+ *  0, otherwise
+ */
+int chatbot_is_smalltalk(const char *intent, int len)
+{
+	return find_verb(intent, len) == VERB_NONE;
 }
 
 /*
@@ -467,59 +1221,33 @@ int chatbot_is_smalltalk(const char *intent)
  *   0, if the chatbot should continue chatting
  *   1, if the chatbot should stop chatting (e.g. the smalltalk was "goodbye" etc.)
  */
-int chatbot_do_smalltalk(int inc, char *inv[], char *response, int n)
+int chatbot_do_smalltalk(const char *line, int inc, const TOKEN inv[], char *response, int n)
 {
-	// All defined smalltalks topic and response.
-	SMALLTALK *smalltalk_ptrs[7] = {
-		create_smalltalk("hello", "Greetings."),
-		create_smalltalk("how", "An interesting question. I never really thought about it."),
-		create_smalltalk("weather", "Both good and bad weather should always be appreciated."),
-		create_smalltalk("life", "Life always has it's ups and downs."),
-		create_smalltalk("hot", "Know what else is hot? You."),
-		create_smalltalk("purpose", "An interesting question. Currently, I am here for your personal needs but maybe I will mean more to someone else ;-;")};
-
-	// Bot response to user.
-	char *bot_response = (char *)malloc(MAX_RESPONSE);
-	if (bot_response == NULL)
+	// Response length so far. Responses are appended straight into the
+	// response buffer, which truncates them if there are too many.
+	int len = 0;
+	if (n > 0)
 	{
-		snprintf(response, n, "No memory currently!");
-		exit(0);
+		response[0] = '\0';
 	}
-	strcpy(bot_response, "");
-
-	// Check of response for user input is found.
-	int response_found = 0;
 
-	// Loop through all the word of input of user.
+	// Loop through all the word of input of user, appending the response to
+	// every smalltalk topic among them (see vocabgen.c for the topics).
 	for (int x = 0; x < inc; x++)
 	{
-		int i = 0;
-		// Loop through all the smalltalks until a common topic is found.
-		while (1)
+		const VOCAB *word = vocab_find(line + inv[x].offset, inv[x].length, inv[x].hash);
+		if (word != NULL && word->smalltalk != NULL)
 		{
-			if (smalltalk_ptrs[i] == NULL)
-			{
-				break;
-			}
-			// If topic is found, concat the response into bot_response.
-			if (compare_token(inv[x], smalltalk_ptrs[i]->topic) == 0)
-			{
-				strcat(bot_response, smalltalk_ptrs[i]->response);
-				strcat(bot_response, " ");
-				response_found = 1;
-			}
-			i++;
+			len = template_copy(response, len, n, word->smalltalk, strlen(word->smalltalk));
+			len = template_copy(response, len, n, " ", 1);
 		}
 	}
 
-	// If no response is found, Add this to bot_response.
-	if (response_found == 0)
+	// If no response is found, say this instead.
+	if (len == 0)
 	{
-		strcat(bot_response, "I see.");
+		say(MSG_I_SEE, NULL, response, n);
 	}
 
-	snprintf(response, n, "%s", bot_response);
-	// Free pointers used.
-	free(bot_response);
 	return 0;
-}
+}
\ No newline at end of file
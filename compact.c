@@ -0,0 +1,178 @@
+/*
+ * ICT1002 (C Language) Group Project.
+ *
+ * This file implements the compactor: a thread that moves the knowledge base
+ * into one block of memory (see knowledge_compact()) whenever enough of the
+ * memory it has used has become garbage, and keeps count of what it has done.
+ *
+ * compact_start() starts the thread.
+ * compact_now() compacts the knowledge base straight away.
+ * compact_stats() gets the totals of every compaction so far.
+ * compact_stop() stops the thread.
+ *
+ * The thread looks at the knowledge base every interval, and compacts it once
+ * at least COMPACT_MIN_GARBAGE bytes, and at least one byte in COMPACT_RATIO
+ * of what it takes, have been freed or replaced since the last compaction
+ * (see knowledge_garbage()). Lookups carry on while the new block is being
+ * built; only swapping it in holds them up, and that time is what the
+ * statistics call the pause. The bytes reclaimed are measured as how much the
+ * memory resident in the process went down by, where the system says.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "chat1002.h"
+
+/* the least garbage worth compacting for, in bytes */
+#define COMPACT_MIN_GARBAGE (1L << 20)
+
+/* compact when at least 1 / COMPACT_RATIO of the knowledge base is garbage */
+#define COMPACT_RATIO 4
+
+static pthread_mutex_t compact_lock = PTHREAD_MUTEX_INITIALIZER;  /* protects everything below */
+static pthread_cond_t compact_wake = PTHREAD_COND_INITIALIZER;    /* signalled by compact_stop() */
+static COMPACT_STATS totals;
+static pthread_t compactor;
+static int running = 0;
+static int stopping = 0;
+static double compact_interval = 1.0;
+static FILE *compact_log = NULL;
+
+/*
+ * Measure the memory resident in this process.
+ *
+ * Returns: the number of bytes, or 0 if it cannot be measured
+ */
+static long resident_bytes()
+{
+	long pages = 0;
+	FILE *f = fopen("/proc/self/statm", "r");
+	if (f == NULL)
+		return 0;
+	if (fscanf(f, "%*d %ld", &pages) != 1)
+		pages = 0;
+	fclose(f);
+	return pages * sysconf(_SC_PAGESIZE);
+}
+
+/*
+ * The compactor thread.
+ */
+static void *compact_thread(void *arg)
+{
+	pthread_mutex_lock(&compact_lock);
+	while (!stopping)
+	{
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		long ns = deadline.tv_nsec + (long)((compact_interval - (long)compact_interval) * 1e9);
+		deadline.tv_sec += (long)compact_interval + ns / 1000000000L;
+		deadline.tv_nsec = ns % 1000000000L;
+		pthread_cond_timedwait(&compact_wake, &compact_lock, &deadline);
+		if (stopping)
+			break;
+		pthread_mutex_unlock(&compact_lock);
+
+		long live;
+		long garbage = knowledge_garbage(&live);
+		if (garbage >= COMPACT_MIN_GARBAGE && garbage * COMPACT_RATIO >= live)
+			compact_now();
+
+		pthread_mutex_lock(&compact_lock);
+	}
+	pthread_mutex_unlock(&compact_lock);
+	return NULL;
+}
+
+/*
+ * Start the compactor thread. The knowledge base must not be sharded, since
+ * the shards' knowledge bases are in other processes.
+ *
+ * Input:
+ *   interval - the number of seconds between looks at the knowledge base
+ *   log      - a file to write a line to for each compaction, or NULL
+ *
+ * Returns: 0 if successful; otherwise -1
+ */
+int compact_start(double interval, FILE *log)
+{
+	if (running || interval <= 0 || shard_count() > 0)
+		return -1;
+
+	compact_interval = interval;
+	compact_log = log;
+	stopping = 0;
+	if (pthread_create(&compactor, NULL, compact_thread, NULL) != 0)
+		return -1;
+	running = 1;
+	return 0;
+}
+
+/*
+ * Compact the knowledge base now, adding what was done to the totals.
+ *
+ * Returns: as knowledge_compact()
+ */
+int compact_now()
+{
+	COMPACTION result;
+	long resident = resident_bytes();
+	int status = knowledge_compact(&result);
+	long reclaimed = resident > 0 ? resident - resident_bytes() : 0;
+
+	pthread_mutex_lock(&compact_lock);
+	if (status == KB_OK)
+	{
+		totals.runs++;
+		totals.bytes_reclaimed += reclaimed;
+		totals.bytes_live = result.bytes_after;
+		totals.build_ns += result.build_ns;
+		totals.pause_ns += result.pause_ns;
+		if (result.pause_ns > totals.max_pause_ns)
+			totals.max_pause_ns = result.pause_ns;
+		if (compact_log != NULL)
+		{
+			fprintf(compact_log, "compacted %ld kB to %ld kB, reclaiming %ld kB (copied in %.1f ms, paused %.1f us)\n",
+					result.bytes_before / 1024, result.bytes_after / 1024, reclaimed / 1024,
+					result.build_ns / 1e6, result.pause_ns / 1e3);
+			fflush(compact_log);
+		}
+	}
+	else if (status == KB_INVALID)
+	{
+		totals.skipped++;
+	}
+	pthread_mutex_unlock(&compact_lock);
+	return status;
+}
+
+/*
+ * Get the totals of every compaction done so far.
+ *
+ * Input:
+ *   stats - receives the totals
+ */
+void compact_stats(COMPACT_STATS *stats)
+{
+	pthread_mutex_lock(&compact_lock);
+	*stats = totals;
+	pthread_mutex_unlock(&compact_lock);
+}
+
+/*
+ * Stop the compactor thread, waiting for any compaction it is doing to finish.
+ */
+void compact_stop()
+{
+	if (!running)
+		return;
+
+	pthread_mutex_lock(&compact_lock);
+	stopping = 1;
+	pthread_cond_signal(&compact_wake);
+	pthread_mutex_unlock(&compact_lock);
+	pthread_join(compactor, NULL);
+	running = 0;
+}
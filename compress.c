@@ -0,0 +1,423 @@
+/*
+ * ICT1002 (C Language) Group Project.
+ *
+ * This file implements compression of the responses in the knowledge base.
+ *
+ * Responses are made of words, and the same words turn up again and again
+ * ("SIT", "the", "teaches", "section of ICT1002."...). Every distinct word
+ * (with the space after it, if any) is stored once in a shared dictionary,
+ * and a compressed response is the list of its words' numbers, each written
+ * in as few bytes as it needs: one byte for the first 128 words in the
+ * dictionary, two for the next 16256, and so on.
+ *
+ * Decompressing is a copy of each word in turn straight into the caller's
+ * buffer, stopping when the buffer is full.
+ *
+ * Every word counts the uses the compressed responses make of it. A response
+ * that is freed or replaced gives its uses back with compress_release(), and
+ * the words no response uses any more (with those added for a response that
+ * did not compress) are dead: compress_dead_bytes() says how much of the
+ * dictionary they take. Words are never taken out of the dictionary, since
+ * that would change the numbers of the words after them; instead
+ * knowledge_compact() moves the live responses into a new dictionary of
+ * their words alone with compress_rebuild(), and swaps it in with
+ * compress_rebuild_end().
+ *
+ * The dictionary is shared by the whole knowledge base and is not locked
+ * here: compress_response(), compress_release(), compress_rebuild_end() and
+ * compress_reset() must only be called by someone holding the knowledge base
+ * for writing, and decompress_response(), compress_rebuild() and the others by
+ * someone holding it for reading or writing (and compress_rebuild() by one
+ * thread at a time).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "chat1002.h"
+
+/* a word in a dictionary */
+typedef struct word
+{
+	int offset;  /* offset of the word in the dictionary's text */
+	int length;  /* number of characters in the word */
+	int next;    /* next word in the same hash bucket, or -1 */
+	int uses;    /* number of times the compressed responses use it */
+} WORD;
+
+/* a dictionary of words */
+typedef struct dictionary
+{
+	char *text;        /* the characters of every word, one after another */
+	int text_length;
+	int text_size;
+	WORD *words;       /* the words, by number */
+	int word_count;
+	int word_size;
+	int *buckets;      /* hash table of word numbers; -1 if empty */
+	int bucket_count;  /* always a power of two */
+	long dead_bytes;   /* bytes taken by the words no response uses */
+	int failed;        /* set if a word could not be added while rebuilding */
+} DICTIONARY;
+
+static DICTIONARY dictionary;  /* the dictionary the responses are compressed with */
+static DICTIONARY rebuilt;     /* the dictionary compress_rebuild() is building to replace it */
+
+/*
+ * Hash the characters of a word (case-sensitively).
+ */
+static unsigned long hash_word(const char *s, int len)
+{
+	unsigned long hash = 2166136261UL;
+	for (int i = 0; i < len; i++)
+		hash = ((hash ^ (unsigned char)s[i]) * 16777619UL) & 0xffffffffUL;
+	return hash;
+}
+
+/*
+ * Determine the number of bytes a word takes in a dictionary.
+ */
+static long word_bytes(int length)
+{
+	return length + (long)sizeof(WORD);
+}
+
+/*
+ * Double the hash table of a dictionary (or create it) and put every word back
+ * in it.
+ *
+ * Returns: 0, or -1 if there was not enough memory
+ */
+static int grow_buckets(DICTIONARY *d)
+{
+	int new_count = d->bucket_count == 0 ? 1024 : d->bucket_count * 2;
+	int *new_buckets = (int *)malloc(new_count * sizeof(int));
+	if (new_buckets == NULL)
+		return -1;
+
+	for (int i = 0; i < new_count; i++)
+		new_buckets[i] = -1;
+	for (int i = 0; i < d->word_count; i++)
+	{
+		int b = hash_word(d->text + d->words[i].offset, d->words[i].length) & (new_count - 1);
+		d->words[i].next = new_buckets[b];
+		new_buckets[b] = i;
+	}
+
+	free(d->buckets);
+	d->buckets = new_buckets;
+	d->bucket_count = new_count;
+	return 0;
+}
+
+/*
+ * Find the number of a word in a dictionary, adding it if it is new. A new
+ * word has no uses yet.
+ *
+ * Returns: the number of the word, or -1 if there was not enough memory
+ */
+static int word_number(DICTIONARY *d, const char *s, int len)
+{
+	if (d->word_count >= d->bucket_count && grow_buckets(d) != 0)
+		return -1;
+
+	int b = hash_word(s, len) & (d->bucket_count - 1);
+	for (int i = d->buckets[b]; i >= 0; i = d->words[i].next)
+	{
+		if (d->words[i].length == len && memcmp(d->text + d->words[i].offset, s, len) == 0)
+			return i;
+	}
+
+	// The word is new.
+	if (d->word_count == d->word_size)
+	{
+		int new_size = d->word_size == 0 ? 1024 : d->word_size * 2;
+		WORD *new_words = (WORD *)realloc(d->words, new_size * sizeof(WORD));
+		if (new_words == NULL)
+			return -1;
+		d->words = new_words;
+		d->word_size = new_size;
+	}
+	if (d->text_length + len > d->text_size)
+	{
+		int new_size = d->text_size == 0 ? 8192 : d->text_size;
+		while (d->text_length + len > new_size)
+			new_size *= 2;
+		char *new_text = (char *)realloc(d->text, new_size);
+		if (new_text == NULL)
+			return -1;
+		d->text = new_text;
+		d->text_size = new_size;
+	}
+
+	memcpy(d->text + d->text_length, s, len);
+	d->words[d->word_count].offset = d->text_length;
+	d->words[d->word_count].length = len;
+	d->words[d->word_count].next = d->buckets[b];
+	d->words[d->word_count].uses = 0;
+	d->buckets[b] = d->word_count;
+	d->text_length += len;
+	d->dead_bytes += word_bytes(len);
+
+	return d->word_count++;
+}
+
+/*
+ * Count one more or one less use of a word, keeping track of the bytes taken
+ * by the words with none.
+ */
+static void use_word(DICTIONARY *d, int number, int change)
+{
+	WORD *word = &d->words[number];
+	if (word->uses + change < 0)
+		return;
+	if (word->uses == 0)
+		d->dead_bytes -= word_bytes(word->length);
+	word->uses += change;
+	if (word->uses == 0)
+		d->dead_bytes += word_bytes(word->length);
+}
+
+/*
+ * Read the number of a word from a compressed response.
+ *
+ * Input:
+ *   in - the compressed response
+ *   i  - the offset of the number; moved past it
+ *
+ * Returns: the number
+ */
+static int read_number(const unsigned char *in, int *i)
+{
+	int number = 0;
+	int shift = 0;
+	while (in[*i] & 0x80)
+	{
+		number |= (in[(*i)++] & 0x7f) << shift;
+		shift += 7;
+	}
+	return number | (in[(*i)++] << shift);
+}
+
+/*
+ * Write the number of a word to a compressed response, seven bits at a time,
+ * lowest first, with the top bit set on every byte but the last.
+ *
+ * Input:
+ *   number - the number
+ *   out    - the compressed response, or NULL to only count the bytes
+ *   at     - the offset to write the number at
+ *   n      - the most bytes the compressed response may take
+ *
+ * Returns: the offset after the number, or -1 if it would not fit
+ */
+static int write_number(int number, unsigned char *out, int at, int n)
+{
+	do
+	{
+		if (at >= n)
+			return -1;
+		if (out != NULL)
+			out[at] = (number & 0x7f) | (number > 0x7f ? 0x80 : 0);
+		at++;
+		number >>= 7;
+	} while (number > 0);
+	return at;
+}
+
+/*
+ * Compress a response.
+ *
+ * Input:
+ *   response - the response
+ *   len      - the number of characters in the response
+ *   out      - a buffer of at least len bytes to receive the compressed response
+ *
+ * Returns: the number of bytes of compressed response, or -1 if compressing
+ * would not make the response any smaller (in which case it should be kept
+ * as it is)
+ */
+int compress_response(const char *response, int len, unsigned char *out)
+{
+	int out_len = 0;
+	int i = 0;
+
+	while (i < len)
+	{
+		// A word runs up to and including the next space.
+		int start = i;
+		while (i < len && response[i] != ' ')
+			i++;
+		if (i < len)
+			i++;
+
+		int number = word_number(&dictionary, response + start, i - start);
+		if (number < 0)
+			return -1;
+		out_len = write_number(number, out, out_len, len);
+		if (out_len < 0)
+			return -1;
+	}
+	if (out_len >= len)
+		return -1;
+
+	// Only now that it is kept does the response use its words.
+	for (i = 0; i < out_len;)
+		use_word(&dictionary, read_number(out, &i), 1);
+	return out_len;
+}
+
+/*
+ * Decompress a response into a buffer, truncating it if the buffer is too
+ * small. The result is null-terminated.
+ *
+ * Input:
+ *   in       - the compressed response
+ *   in_len   - the number of bytes of compressed response
+ *   response - a buffer to receive the response
+ *   n        - the size of the response buffer
+ *
+ * Returns: the number of characters written, not counting the null
+ */
+int decompress_response(const unsigned char *in, int in_len, char *response, int n)
+{
+	int len = 0;
+	int i = 0;
+
+	if (n <= 0)
+		return 0;
+
+	while (i < in_len && len < n - 1)
+	{
+		const WORD *word = &dictionary.words[read_number(in, &i)];
+		int copy = word->length < n - 1 - len ? word->length : n - 1 - len;
+		memcpy(response + len, dictionary.text + word->offset, copy);
+		len += copy;
+	}
+	response[len] = '\0';
+
+	return len;
+}
+
+/*
+ * Give back the uses a compressed response made of its words, when it is
+ * freed or replaced.
+ *
+ * Input:
+ *   in     - the compressed response
+ *   in_len - the number of bytes of compressed response
+ */
+void compress_release(const unsigned char *in, int in_len)
+{
+	for (int i = 0; i < in_len;)
+		use_word(&dictionary, read_number(in, &i), -1);
+}
+
+/*
+ * Compress a response again, with the dictionary being built to replace the
+ * current one, from the way it is compressed with the current one.
+ *
+ * Input:
+ *   in     - the response, compressed with the current dictionary
+ *   in_len - the number of bytes of compressed response
+ *   len    - the number of characters in the response
+ *   out    - a buffer of at least len bytes to receive the response compressed
+ *            with the new dictionary; or NULL to only measure it, in which
+ *            case its words do not count as used
+ *
+ * Returns: the number of bytes of compressed response; -1 if it would not be
+ * smaller than the response (in which case it should be kept as it is); or
+ * KB_NOMEM if the new dictionary could not grow, after which the new
+ * dictionary cannot be used
+ */
+int compress_rebuild(const unsigned char *in, int in_len, int len, unsigned char *out)
+{
+	int out_len = 0;
+
+	for (int i = 0; i < in_len && out_len >= 0;)
+	{
+		const WORD *word = &dictionary.words[read_number(in, &i)];
+		int number = word_number(&rebuilt, dictionary.text + word->offset, word->length);
+		if (number < 0)
+		{
+			rebuilt.failed = 1;
+			return KB_NOMEM;
+		}
+		out_len = write_number(number, out, out_len, len);
+	}
+	if (out_len < 0 || out_len >= len)
+		return -1;
+
+	if (out != NULL)
+	{
+		for (int i = 0; i < out_len;)
+			use_word(&rebuilt, read_number(out, &i), 1);
+	}
+	return out_len;
+}
+
+/*
+ * Free a dictionary's memory, leaving it empty.
+ */
+static void free_dictionary(DICTIONARY *d)
+{
+	free(d->text);
+	free(d->words);
+	free(d->buckets);
+	memset(d, 0, sizeof(DICTIONARY));
+}
+
+/*
+ * Finish with the dictionary built by compress_rebuild(): either replace the
+ * current dictionary with it, once every compressed response has been
+ * replaced by its compress_rebuild() form, or throw it away.
+ *
+ * Input:
+ *   keep - non-zero to replace the current dictionary; zero to throw the new
+ *          one away
+ *
+ * Returns: KB_OK, or KB_NOMEM if the new dictionary could not be built (in
+ * which case it is thrown away whatever keep says)
+ */
+int compress_rebuild_end(int keep)
+{
+	int status = rebuilt.failed ? KB_NOMEM : KB_OK;
+	if (keep && status == KB_OK)
+	{
+		free_dictionary(&dictionary);
+		dictionary = rebuilt;
+		memset(&rebuilt, 0, sizeof(DICTIONARY));
+	}
+	else
+	{
+		free_dictionary(&rebuilt);
+	}
+	return status;
+}
+
+/*
+ * Empty the dictionary. Only do this when there are no compressed responses
+ * left.
+ */
+void compress_reset()
+{
+	free_dictionary(&dictionary);
+	free_dictionary(&rebuilt);
+}
+
+/*
+ * Get the number of bytes the dictionary takes up.
+ */
+long compress_dictionary_bytes()
+{
+	return (long)dictionary.text_size + (long)dictionary.word_size * sizeof(WORD) +
+		   (long)dictionary.bucket_count * sizeof(int);
+}
+
+/*
+ * Get the number of bytes the words no response uses take up in the
+ * dictionary.
+ */
+long compress_dead_bytes()
+{
+	return dictionary.dead_bytes;
+}
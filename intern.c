@@ -0,0 +1,375 @@
+/*
+ * ICT1002 (C Language) Group Project.
+ *
+ * This file implements the table of entities known to the knowledge base.
+ *
+ * Every distinct entity is stored here once and given a number, its ID. A
+ * question refers to its entity by ID, so an entity asked about under several
+ * intents is stored only once, and two questions are about the same entity
+ * exactly when their IDs are the same. Entities are the same if they have the
+ * same key (see normalize.c); each is kept as it was first spelt, beside its
+ * key.
+ *
+ * intern_entity() finds the ID of an entity, adding it if it is new.
+ * intern_lookup() finds the ID of an entity without adding it.
+ * intern_string() gets the spelling of an entity from its ID.
+ * intern_prefetch() starts loading the part of the table a lookup will need.
+ * intern_reset() forgets every entity.
+ * intern_rebuild() and intern_rebuild_end() replace the table with one
+ * holding only the entities questions still refer to.
+ *
+ * The table is laid out as separate arrays rather than an array of records,
+ * so that a lookup reads as little memory as possible: an open-addressed hash
+ * table of the keys' hashes alone, sixteen to a cache line, so a probe
+ * usually reads just one line; beside it the ID in each slot, read only when
+ * a hash matches; and, by ID, where each key is in the packed text, read
+ * only to confirm the match. The questions (and so the responses) are kept
+ * apart from all of these, in knowledge.c.
+ *
+ * An entity stays in the table when the last question about it goes (after a
+ * rollback, say), since nothing here knows which entities questions refer to.
+ * knowledge_compact() tells intern_rebuild() which ones they do, and it builds
+ * a new table without the others: their text and slots are left out, and the
+ * IDs after the last live one are given up, to be handed out again. The IDs
+ * of the live entities do not change, since the index is laid out by ID.
+ *
+ * The table is part of the knowledge base and is not locked here:
+ * intern_entity(), intern_reset() and intern_rebuild_end() must only be called
+ * by someone holding the knowledge base for writing, and the others by
+ * someone holding it for reading or writing.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "chat1002.h"
+
+/* the fewest slots the hash table has */
+#define MIN_SLOTS 512
+
+/* a table of entities */
+typedef struct table
+{
+	char *text;                 /* every key, then its entity, each null-terminated, one after another */
+	int text_length;
+	int text_size;
+	int *offsets;               /* offset of each key in text, by ID; the entity follows it */
+	int *key_lengths;           /* number of characters in each key, by ID */
+	int *lengths;               /* number of characters in each entity, by ID */
+	int count;                  /* number of IDs handed out */
+	int size;                   /* number of IDs the arrays have room for */
+	unsigned int *slot_hashes;  /* hash table of the entities' hashes; 0 if empty */
+	int *slot_ids;              /* the ID of the entity in each slot */
+	int slot_count;             /* always a power of two */
+} TABLE;
+
+static TABLE table;    /* the table being used */
+static TABLE rebuilt;  /* the table built by intern_rebuild(), until intern_rebuild_end() */
+
+/*
+ * Get the hash a key is kept under in slot_hashes, which is never 0.
+ */
+static unsigned int slot_hash(unsigned long hash)
+{
+	return (unsigned int)hash != 0 ? (unsigned int)hash : 1;
+}
+
+/*
+ * Put an ID in the first empty slot for its hash.
+ */
+static void put_slot(TABLE *t, unsigned int hash, int id)
+{
+	int s = hash & (t->slot_count - 1);
+	while (t->slot_hashes[s] != 0)
+		s = (s + 1) & (t->slot_count - 1);
+	t->slot_hashes[s] = hash;
+	t->slot_ids[s] = id;
+}
+
+/*
+ * Double the hash table (or create it) and put every entity back in it.
+ *
+ * Returns: KB_OK, or KB_NOMEM if there was not enough memory
+ */
+static int grow_slots()
+{
+	TABLE grown = table;
+	grown.slot_count = table.slot_count == 0 ? MIN_SLOTS : table.slot_count * 2;
+	grown.slot_hashes = (unsigned int *)calloc(grown.slot_count, sizeof(unsigned int));
+	grown.slot_ids = (int *)malloc(grown.slot_count * sizeof(int));
+	if (grown.slot_hashes == NULL || grown.slot_ids == NULL)
+	{
+		free(grown.slot_hashes);
+		free(grown.slot_ids);
+		return KB_NOMEM;
+	}
+
+	for (int i = 0; i < table.slot_count; i++)
+	{
+		if (table.slot_hashes[i] != 0)
+			put_slot(&grown, table.slot_hashes[i], table.slot_ids[i]);
+	}
+
+	free(table.slot_hashes);
+	free(table.slot_ids);
+	table = grown;
+	return KB_OK;
+}
+
+/*
+ * Find the slot a key is in, or the empty slot it would go in.
+ */
+static int find_slot(const KEY *key)
+{
+	unsigned int hash = slot_hash(key->hash);
+	int s = hash & (table.slot_count - 1);
+	while (table.slot_hashes[s] != 0)
+	{
+		if (table.slot_hashes[s] == hash)
+		{
+			int id = table.slot_ids[s];
+			if (table.key_lengths[id] == key->length &&
+				memcmp(key->text, table.text + table.offsets[id], key->length) == 0)
+				break;
+		}
+		s = (s + 1) & (table.slot_count - 1);
+	}
+	return s;
+}
+
+/*
+ * Find the ID of an entity without adding it to the table.
+ *
+ * Input:
+ *   key - the key of the entity, from normalize_key()
+ *
+ * Returns: the ID of the entity, or -1 if it is not in the table
+ */
+int intern_lookup(const KEY *key)
+{
+	if (table.slot_count == 0)
+		return -1;
+
+	int s = find_slot(key);
+	return table.slot_hashes[s] != 0 ? table.slot_ids[s] : -1;
+}
+
+/*
+ * Find the ID of an entity, adding it to the table if it is new.
+ *
+ * Input:
+ *   key    - the key of the entity, from normalize_key()
+ *   entity - the entity as it is spelt (need not be null-terminated)
+ *   len    - the number of characters in the entity
+ *
+ * Returns: the ID of the entity, or KB_NOMEM if there was not enough memory
+ */
+int intern_entity(const KEY *key, const char *entity, int len)
+{
+	int id = intern_lookup(key);
+	if (id >= 0)
+		return id;
+
+	// The entity is new. The hash table is kept at most half full, so that a
+	// probe seldom runs past the first empty slot.
+	if (table.count >= table.slot_count / 2 && grow_slots() != KB_OK)
+		return KB_NOMEM;
+	if (table.count == table.size)
+	{
+		int new_size = table.size == 0 ? 256 : table.size * 2;
+		int *new_offsets = (int *)realloc(table.offsets, new_size * sizeof(int));
+		if (new_offsets == NULL)
+			return KB_NOMEM;
+		table.offsets = new_offsets;
+		int *new_key_lengths = (int *)realloc(table.key_lengths, new_size * sizeof(int));
+		if (new_key_lengths == NULL)
+			return KB_NOMEM;
+		table.key_lengths = new_key_lengths;
+		int *new_lengths = (int *)realloc(table.lengths, new_size * sizeof(int));
+		if (new_lengths == NULL)
+			return KB_NOMEM;
+		table.lengths = new_lengths;
+		table.size = new_size;
+	}
+	int needed = key->length + 1 + len + 1;
+	if (table.text_length + needed > table.text_size)
+	{
+		int new_size = table.text_size == 0 ? 4096 : table.text_size;
+		while (table.text_length + needed > new_size)
+			new_size *= 2;
+		char *new_text = (char *)realloc(table.text, new_size);
+		if (new_text == NULL)
+			return KB_NOMEM;
+		table.text = new_text;
+		table.text_size = new_size;
+	}
+
+	char *text = table.text + table.text_length;
+	memcpy(text, key->text, key->length);
+	text[key->length] = '\0';
+	memcpy(text + key->length + 1, entity, len);
+	text[key->length + 1 + len] = '\0';
+	table.offsets[table.count] = table.text_length;
+	table.key_lengths[table.count] = key->length;
+	table.lengths[table.count] = len;
+	table.text_length += needed;
+
+	int s = find_slot(key);
+	table.slot_hashes[s] = slot_hash(key->hash);
+	table.slot_ids[s] = table.count;
+
+	return table.count++;
+}
+
+/*
+ * Get the spelling of an entity. The string stays valid until the next call to
+ * intern_entity(), intern_reset() or intern_rebuild_end().
+ *
+ * Input:
+ *   id  - the ID of the entity
+ *   len - if not NULL, receives the number of characters in the entity
+ *
+ * Returns: the entity, null-terminated
+ */
+const char *intern_string(int id, int *len)
+{
+	if (len != NULL)
+		*len = table.lengths[id];
+	return table.text + table.offsets[id] + table.key_lengths[id] + 1;
+}
+
+/*
+ * Free the memory of a table and empty it.
+ */
+static void free_table(TABLE *t)
+{
+	free(t->text);
+	free(t->offsets);
+	free(t->key_lengths);
+	free(t->lengths);
+	free(t->slot_hashes);
+	free(t->slot_ids);
+	memset(t, 0, sizeof(TABLE));
+}
+
+/*
+ * Forget every entity. Only do this when no question refers to one.
+ */
+void intern_reset()
+{
+	free_table(&table);
+	free_table(&rebuilt);
+}
+
+/*
+ * Get the number of IDs handed out, every one of which is less than it.
+ */
+int intern_count()
+{
+	return table.count;
+}
+
+/*
+ * Build a new table holding only some of the entities, to replace the table
+ * with by intern_rebuild_end(). Each entity keeps its ID.
+ *
+ * Input:
+ *   live - for each ID below intern_count(), non-zero if the entity is to be
+ *          kept
+ *
+ * Returns: KB_OK, or KB_NOMEM if there was not enough memory
+ */
+int intern_rebuild(const unsigned char *live)
+{
+	TABLE *t = &rebuilt;
+	free_table(t);
+
+	int live_count = 0;
+	for (int id = 0; id < table.count; id++)
+	{
+		if (!live[id])
+			continue;
+		live_count++;
+		t->count = id + 1;
+		t->text_length += table.key_lengths[id] + 1 + table.lengths[id] + 1;
+	}
+	if (live_count == 0)
+		return KB_OK;
+
+	// Every array is made just big enough; the IDs of dead entities before
+	// the last live one are kept, but hold no text and have no slot.
+	t->size = t->count;
+	t->text_size = t->text_length;
+	t->slot_count = MIN_SLOTS;
+	while (t->count >= t->slot_count / 2)
+		t->slot_count *= 2;
+	t->text = (char *)malloc(t->text_size);
+	t->offsets = (int *)calloc(t->size, sizeof(int));
+	t->key_lengths = (int *)calloc(t->size, sizeof(int));
+	t->lengths = (int *)calloc(t->size, sizeof(int));
+	t->slot_hashes = (unsigned int *)calloc(t->slot_count, sizeof(unsigned int));
+	t->slot_ids = (int *)malloc(t->slot_count * sizeof(int));
+	if (t->text == NULL || t->offsets == NULL || t->key_lengths == NULL || t->lengths == NULL ||
+		t->slot_hashes == NULL || t->slot_ids == NULL)
+	{
+		free_table(t);
+		return KB_NOMEM;
+	}
+
+	int at = 0;
+	for (int id = 0; id < t->count; id++)
+	{
+		if (!live[id])
+			continue;
+		int bytes = table.key_lengths[id] + 1 + table.lengths[id] + 1;
+		memcpy(t->text + at, table.text + table.offsets[id], bytes);
+		t->offsets[id] = at;
+		t->key_lengths[id] = table.key_lengths[id];
+		t->lengths[id] = table.lengths[id];
+		put_slot(t, slot_hash(hash_token(t->text + at, t->key_lengths[id])), id);
+		at += bytes;
+	}
+	return KB_OK;
+}
+
+/*
+ * Finish with the table built by intern_rebuild(): either replace the table
+ * with it, or throw it away.
+ *
+ * Input:
+ *   keep - non-zero to replace the table; zero to throw the new one away
+ */
+void intern_rebuild_end(int keep)
+{
+	if (keep)
+	{
+		free_table(&table);
+		table = rebuilt;
+		memset(&rebuilt, 0, sizeof(TABLE));
+	}
+	else
+	{
+		free_table(&rebuilt);
+	}
+}
+
+/*
+ * Get the number of bytes the table takes up.
+ */
+long intern_bytes()
+{
+	return (long)table.text_size + (long)table.size * 3 * sizeof(int) +
+		   (long)table.slot_count * (sizeof(unsigned int) + sizeof(int));
+}
+
+/*
+ * Start loading the slot a lookup of an entity starts at, for a lookup to
+ * come.
+ *
+ * Input:
+ *   hash - the hash of the entity's key
+ */
+void intern_prefetch(unsigned long hash)
+{
+	if (table.slot_count > 0)
+		PREFETCH(&table.slot_hashes[slot_hash(hash) & (table.slot_count - 1)]);
+}
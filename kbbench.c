@@ -0,0 +1,592 @@
+/*
+ * ICT1002 (C Language) Group Project.
+ *
+ * This file implements a benchmark of loading the knowledge base and looking up
+ * questions in it, reporting the time to load it, the time per lookup and,
+ * where the processor and kernel allow it, the cache misses per lookup.
+ *
+ * Usage:
+ *   gcc -O2 -pthread -o kbbench kbbench.c tokenizer.c chatbot.c knowledge.c \
+ *       pool.c shard.c compress.c intern.c vocab.c session.c template.c \
+ *       normalize.c
+ *   ./kbbench [-b] [-v] [-w workers] [-s workers] [knowledge file] [lookups]
+ *
+ * The knowledge file (default sample.ini) is loaded, then every question in
+ * it is asked in a random order, along with as many questions about entities
+ * that are not there, until the given number of lookups (default 1000000)
+ * have been made. The same order is used on every run, so runs can be
+ * compared.
+ *
+ * With -b, the same lookups are then made MAX_BATCH at a time with
+ * knowledge_probe(), and asked again as lines of input ("who is ...") both one
+ * at a time with chatbot_main() and in batches with chatbot_main_batch(),
+ * reporting the time per probe and the requests a second of each.
+ *
+ * With -v, the first words of lines of input (the built-in words, mixed with
+ * as many words from the entities) are then recognised as many times as there
+ * are lookups, both with vocab_find() and with the chain of compare_span()
+ * calls chatbot_main() used before there was a table of built-in words,
+ * reporting the time per word of each.
+ *
+ * With -w, the lines of input are also run as chatbot_task()s in a thread pool
+ * (see pool.c) of every size from one worker up to the given number, first
+ * with the workers free to run anywhere and then with them pinned to cores,
+ * reporting the requests a second of each.
+ *
+ * With -s, the knowledge base is then saved to /dev/null with knowledge_write()
+ * SAVE_ROUNDS times by every number of workers from one up to the given
+ * number (see knowledge_write_workers()), after one save to start them,
+ * reporting the time per save of each.
+ *
+ * The cache misses are counted with perf_event_open(); if the counters cannot
+ * be opened (e.g. in a virtual machine, or when perf_event_paranoid forbids
+ * it) they are reported as unavailable and only the time is shown.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "chat1002.h"
+
+/* a question to ask */
+typedef struct lookup
+{
+	int intent;
+	char entity[MAX_INPUT];
+	int len;
+} LOOKUP;
+
+/* a cache event to count */
+typedef struct counter
+{
+	const char *name;
+	unsigned int type;
+	unsigned long long config;
+	int fd;
+	long long value;
+} COUNTER;
+
+static COUNTER counters[] = {
+	{"L1D read misses", PERF_TYPE_HW_CACHE,
+	 PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), -1, 0},
+	{"LLC read misses", PERF_TYPE_HW_CACHE,
+	 PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), -1, 0}};
+
+#define COUNTER_COUNT (int)(sizeof(counters) / sizeof(counters[0]))
+
+/* the most requests given to the thread pool before waiting for them all */
+#define POOL_WINDOW 4096
+
+/* the number of times the knowledge base is saved by each number of workers */
+#define SAVE_ROUNDS 10
+
+/* a first word of input to recognise */
+typedef struct word
+{
+	const char *text;
+	int len;
+	unsigned long hash;
+} WORD;
+
+/* the words chatbot_main() started with, in the order it tried them before
+ * they were put in a table (see vocabgen.c) */
+static const char *chain_words[] = {"exit", "quit", "load", "who", "what", "when", "where", "why", "how",
+									"reset", "save", "tell", "export", "import", "snapshot", "rollback",
+									"hello", "weather", "life", "hot", "purpose"};
+
+#define CHAIN_COUNT (int)(sizeof(chain_words) / sizeof(chain_words[0]))
+
+/*
+ * Get the nanoseconds since a time.
+ */
+static double elapsed_ns(const struct timespec *start)
+{
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+/*
+ * Answer the chatbot's questions (it never asks any here).
+ */
+int prompt_user(char **buf, int *size, const char *format, ...)
+{
+	return -1;
+}
+
+/*
+ * Open a counter for this thread, leaving it stopped.
+ *
+ * Returns: the file descriptor of the counter, or -1 if it is not available
+ */
+static int open_counter(unsigned int type, unsigned long long config)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*
+ * Read the questions in a knowledge file, in the same format knowledge_read()
+ * reads.
+ *
+ * Returns: the number of questions read, up to max
+ */
+static int read_lookups(const char *file, LOOKUP lookups[], int max)
+{
+	FILE *f = fopen(file, "r");
+	char line[MAX_INPUT + MAX_RESPONSE + 4];
+	int intent = -1;
+	int count = 0;
+
+	if (f == NULL)
+		return 0;
+	while (count < max && fgets(line, sizeof(line), f) != NULL)
+	{
+		char *s = trim(line);
+		char *equals = strchr(s, '=');
+		if (s[0] == '[' && s[strlen(s) - 1] == ']' && equals == NULL)
+		{
+			intent = knowledge_intent(s + 1, strlen(s) - 2);
+		}
+		else if (equals != NULL && intent >= 0 && equals - s < MAX_INPUT)
+		{
+			lookups[count].intent = intent;
+			lookups[count].len = equals - s;
+			memcpy(lookups[count].entity, s, lookups[count].len);
+			lookups[count].entity[lookups[count].len] = '\0';
+			count++;
+		}
+	}
+	fclose(f);
+	return count;
+}
+
+/*
+ * Turn the lookups into lines of input asking the same questions.
+ *
+ * Returns: the requests (with no response buffers), or NULL if there was not
+ * enough memory
+ */
+static REQUEST *make_requests(const LOOKUP lookups[], int count)
+{
+	REQUEST *requests = (REQUEST *)calloc(count, sizeof(REQUEST));
+	if (requests == NULL)
+		return NULL;
+	for (int i = 0; i < count; i++)
+	{
+		int len = strlen(all_intents[lookups[i].intent].intent) + lookups[i].len + 4;
+		char *line = (char *)malloc(len + 1);
+		TOKEN *inv = (TOKEN *)malloc((len / 2 + 1) * sizeof(TOKEN));
+		if (line == NULL || inv == NULL)
+			return NULL;
+		snprintf(line, len + 1, "%s is %s", all_intents[lookups[i].intent].intent, lookups[i].entity);
+		requests[i].line = line;
+		requests[i].inv = inv;
+		requests[i].inc = tokenize(line, inv, len / 2 + 1);
+	}
+	return requests;
+}
+
+/*
+ * Make the lookups MAX_BATCH at a time with knowledge_probe().
+ *
+ * Returns: the nanoseconds taken; *found receives the number found
+ */
+static double time_probes(const LOOKUP lookups[], int count, long total, long *found)
+{
+	PROBE probes[MAX_BATCH];
+	char responses[MAX_BATCH][MAX_RESPONSE];
+	struct timespec start;
+
+	*found = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i = 0; i < total; i += MAX_BATCH)
+	{
+		int batch = total - i < MAX_BATCH ? total - i : MAX_BATCH;
+		for (int j = 0; j < batch; j++)
+		{
+			const LOOKUP *lookup = &lookups[(i + j) % count];
+			probes[j].intent = lookup->intent;
+			probes[j].entity = lookup->entity;
+			probes[j].len = lookup->len;
+			probes[j].response = responses[j];
+			probes[j].n = MAX_RESPONSE;
+		}
+		knowledge_probe(probes, batch);
+		for (int j = 0; j < batch; j++)
+			*found += probes[j].status == KB_OK;
+	}
+	return elapsed_ns(&start);
+}
+
+/*
+ * Ask the questions as lines of input, either one at a time with
+ * chatbot_main() or MAX_BATCH at a time with chatbot_main_batch().
+ *
+ * Returns: the nanoseconds taken
+ */
+static double time_requests(const REQUEST requests[], int count, long total, int batched)
+{
+	REQUEST batch[MAX_BATCH];
+	char responses[MAX_BATCH][MAX_RESPONSE];
+	struct timespec start;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i = 0; i < total; i += MAX_BATCH)
+	{
+		int size = total - i < MAX_BATCH ? total - i : MAX_BATCH;
+		for (int j = 0; j < size; j++)
+		{
+			batch[j] = requests[(i + j) % count];
+			batch[j].response = responses[j];
+			batch[j].n = MAX_RESPONSE;
+		}
+		if (batched)
+			chatbot_main_batch(batch, size);
+		else
+		{
+			for (int j = 0; j < size; j++)
+				chatbot_main(batch[j].line, batch[j].inc, batch[j].inv, batch[j].response, batch[j].n);
+		}
+	}
+	return elapsed_ns(&start);
+}
+
+/*
+ * Ask the questions as lines of input, run by a thread pool as
+ * chatbot_task()s, POOL_WINDOW at a time.
+ *
+ * Returns: the nanoseconds taken, or -1 if the pool could not be started
+ */
+static double time_pool(const REQUEST requests[], int count, long total, int workers, int pin)
+{
+	REQUEST *window = (REQUEST *)malloc(POOL_WINDOW * sizeof(REQUEST));
+	char *responses = (char *)malloc(POOL_WINDOW * MAX_RESPONSE);
+	POOL *pool = pool_create(workers, pin);
+	struct timespec start;
+	double ns = -1;
+
+	if (window != NULL && responses != NULL && pool != NULL)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (long i = 0; i < total; i += POOL_WINDOW)
+		{
+			int size = total - i < POOL_WINDOW ? total - i : POOL_WINDOW;
+			for (int j = 0; j < size; j++)
+			{
+				window[j] = requests[(i + j) % count];
+				window[j].response = responses + j * MAX_RESPONSE;
+				window[j].n = MAX_RESPONSE;
+				if (pool_submit(pool, chatbot_task, &window[j]) != 0)
+					chatbot_task(&window[j]);
+			}
+			pool_wait(pool);
+		}
+		ns = elapsed_ns(&start);
+	}
+
+	if (pool != NULL)
+		pool_destroy(pool);
+	free(window);
+	free(responses);
+	return ns;
+}
+
+/*
+ * Recognise a word the way chatbot_main() did before there was a table of
+ * built-in words: by comparing it with each of them in turn.
+ *
+ * Returns: the index of the word in chain_words, or -1 if it is not one
+ */
+static int find_in_chain(const char *word, int len)
+{
+	for (int i = 0; i < CHAIN_COUNT; i++)
+	{
+		if (compare_span(word, len, chain_words[i]) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * Make a list of first words: each built-in word in turn, alternating with the
+ * first word of each lookup's entity.
+ *
+ * Returns: the words (pointing into the lookups and chain_words), or NULL if
+ * there was not enough memory
+ */
+static WORD *make_words(const LOOKUP lookups[], int count)
+{
+	WORD *words = (WORD *)malloc(2 * count * sizeof(WORD));
+	if (words == NULL)
+		return NULL;
+	for (int i = 0; i < count; i++)
+	{
+		TOKEN token;
+		WORD *builtin = &words[2 * i];
+		WORD *other = &words[2 * i + 1];
+		builtin->text = chain_words[i % CHAIN_COUNT];
+		builtin->len = strlen(builtin->text);
+		builtin->hash = hash_token(builtin->text, builtin->len);
+		if (tokenize(lookups[i].entity, &token, 1) > 0)
+		{
+			other->text = lookups[i].entity + token.offset;
+			other->len = token.length;
+			other->hash = token.hash;
+		}
+		else
+			*other = *builtin;
+	}
+	return words;
+}
+
+/*
+ * Recognise the words, either with vocab_find() or with find_in_chain(). As in
+ * chatbot_main(), the hash of each word is already known.
+ *
+ * Returns: the nanoseconds taken; *found receives the number recognised
+ */
+static double time_words(const WORD words[], int count, long total, int chained, long *found)
+{
+	struct timespec start;
+
+	*found = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i = 0; i < total; i++)
+	{
+		const WORD *word = &words[i % count];
+		if (chained)
+			*found += find_in_chain(word->text, word->len) >= 0;
+		else
+		{
+			const VOCAB *vocab = vocab_find(word->text, word->len, word->hash);
+			*found += vocab != NULL && (vocab->verb != VERB_NONE || vocab->smalltalk != NULL);
+		}
+	}
+	return elapsed_ns(&start);
+}
+
+/*
+ * Save the knowledge base to /dev/null SAVE_ROUNDS times, after saving it once
+ * to start the workers.
+ *
+ * Returns: the nanoseconds taken, or -1 if /dev/null could not be opened
+ */
+static double time_saves(int workers)
+{
+	FILE *f = fopen("/dev/null", "w");
+	struct timespec start;
+
+	if (f == NULL)
+		return -1;
+	knowledge_write_workers(workers);
+	knowledge_write(f);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < SAVE_ROUNDS; i++)
+		knowledge_write(f);
+	double ns = elapsed_ns(&start);
+	fclose(f);
+	return ns;
+}
+
+int main(int argc, char *argv[])
+{
+	int batches = 0;
+	int words = 0;
+	int max_workers = 0;
+	int max_savers = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "bvw:s:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'b':
+			batches = 1;
+			break;
+		case 'v':
+			words = 1;
+			break;
+		case 'w':
+			max_workers = atoi(optarg);
+			break;
+		case 's':
+			max_savers = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-b] [-v] [-w workers] [-s workers] [knowledge file] [lookups]\n", argv[0]);
+			return 1;
+		}
+	}
+	const char *file = optind < argc ? argv[optind] : "sample.ini";
+	long total = optind + 1 < argc ? atol(argv[optind + 1]) : 1000000;
+	char response[MAX_RESPONSE];
+
+	// Each question is asked as it is, and again about an entity that is not
+	// in the knowledge base. (What is added must be letters, since punctuation
+	// is left out when an entity is normalized.)
+	int max = 1 << 20;
+	LOOKUP *lookups = (LOOKUP *)malloc(2 * max * sizeof(LOOKUP));
+	if (lookups == NULL)
+		return 1;
+	int count = read_lookups(file, lookups, max);
+	for (int i = 0; i < count; i++)
+	{
+		lookups[count + i] = lookups[i];
+		if (lookups[i].len + 2 < MAX_INPUT)
+			strcat(lookups[count + i].entity, "zq");
+		lookups[count + i].len = strlen(lookups[count + i].entity);
+	}
+	count *= 2;
+
+	FILE *f = fopen(file, "r");
+	if (f == NULL || count == 0)
+	{
+		fprintf(stderr, "kbbench: no questions in %s\n", file);
+		return 1;
+	}
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	knowledge_read(f, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	fclose(f);
+	double load_ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+	// Shuffle the questions with a fixed seed.
+	unsigned long seed = 12345;
+	for (int i = count - 1; i > 0; i--)
+	{
+		seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+		int j = (seed >> 33) % (i + 1);
+		LOOKUP t = lookups[i];
+		lookups[i] = lookups[j];
+		lookups[j] = t;
+	}
+
+	for (int c = 0; c < COUNTER_COUNT; c++)
+	{
+		counters[c].fd = open_counter(counters[c].type, counters[c].config);
+		if (counters[c].fd >= 0)
+		{
+			ioctl(counters[c].fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(counters[c].fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+
+	long found = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i = 0; i < total; i++)
+	{
+		const LOOKUP *lookup = &lookups[i % count];
+		found += knowledge_get(all_intents[lookup->intent].intent, lookup->entity, lookup->len, response,
+							   MAX_RESPONSE) == KB_OK;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	for (int c = 0; c < COUNTER_COUNT; c++)
+	{
+		if (counters[c].fd >= 0)
+		{
+			ioctl(counters[c].fd, PERF_EVENT_IOC_DISABLE, 0);
+			if (read(counters[c].fd, &counters[c].value, sizeof(counters[c].value)) != sizeof(counters[c].value))
+				counters[c].value = -1;
+			close(counters[c].fd);
+		}
+	}
+
+	double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+	printf("%d questions, %ld lookups, %ld found\n", knowledge_count(), total, found);
+	printf("%-18s %10.1f ms\n", "time to load", load_ns / 1e6);
+	printf("%-18s %10.1f ns\n", "time per lookup", ns / total);
+	for (int c = 0; c < COUNTER_COUNT; c++)
+	{
+		if (counters[c].fd >= 0 && counters[c].value >= 0)
+			printf("%-18s %10.2f per lookup\n", counters[c].name, (double)counters[c].value / total);
+		else
+			printf("%-18s %10s\n", counters[c].name, "unavailable");
+	}
+
+	if (batches || max_workers > 0)
+	{
+		REQUEST *requests = make_requests(lookups, count);
+		if (requests == NULL)
+		{
+			fprintf(stderr, "kbbench: not enough memory for the requests\n");
+			return 1;
+		}
+		if (batches)
+		{
+			long probed;
+			double probe_ns = time_probes(lookups, count, total, &probed);
+			double single_ns = time_requests(requests, count, total, 0);
+			double batched_ns = time_requests(requests, count, total, 1);
+			printf("%-18s %10.1f ns (%ld found)\n", "time per probe", probe_ns / total, probed);
+			printf("%-18s %10.0f per second\n", "single requests", total / single_ns * 1e9);
+			printf("%-18s %10.0f per second (%+.1f%%)\n", "batched requests", total / batched_ns * 1e9,
+				   (single_ns / batched_ns - 1) * 100);
+		}
+		for (int workers = 1; workers <= max_workers; workers++)
+		{
+			char label[32];
+			double free_ns = time_pool(requests, count, total, workers, 0);
+			double pinned_ns = time_pool(requests, count, total, workers, 1);
+			snprintf(label, sizeof(label), "%d worker%s", workers, workers == 1 ? "" : "s");
+			if (free_ns < 0 || pinned_ns < 0)
+				printf("%-18s %10s\n", label, "unavailable");
+			else
+				printf("%-18s %10.0f per second, %10.0f pinned\n", label, total / free_ns * 1e9,
+					   total / pinned_ns * 1e9);
+		}
+		for (int i = 0; i < count; i++)
+		{
+			free((char *)requests[i].line);
+			free((TOKEN *)requests[i].inv);
+		}
+		free(requests);
+	}
+
+	if (words)
+	{
+		WORD *list = make_words(lookups, count);
+		if (list == NULL)
+		{
+			fprintf(stderr, "kbbench: not enough memory for the words\n");
+			return 1;
+		}
+		long table_found, chain_found;
+		double table_ns = time_words(list, 2 * count, total, 0, &table_found);
+		double chain_ns = time_words(list, 2 * count, total, 1, &chain_found);
+		printf("%-18s %10.1f ns (%ld built in)\n", "vocab_find()", table_ns / total, table_found);
+		printf("%-18s %10.1f ns (%ld built in)\n", "compare_span()s", chain_ns / total, chain_found);
+		free(list);
+	}
+
+	for (int workers = 1; workers <= max_savers; workers++)
+	{
+		char label[32];
+		double save_ns = time_saves(workers);
+		snprintf(label, sizeof(label), "save, %d worker%s", workers, workers == 1 ? "" : "s");
+		if (save_ns < 0)
+			printf("%-18s %10s\n", label, "unavailable");
+		else
+			printf("%-18s %10.1f ms\n", label, save_ns / SAVE_ROUNDS / 1e6);
+	}
+	knowledge_write_workers(0);
+
+	knowledge_reset();
+	free(lookups);
+	return 0;
+}
@@ -0,0 +1,647 @@
+/*
+ * ICT1002 (C Language) Group Project.
+ *
+ * This file implements a property test of the knowledge base: a long random
+ * sequence of puts, gets, counts, snapshots, rollbacks, compactions, resets,
+ * saves and loads is run against the knowledge base and against a simple model
+ * of it at the same time, and every answer the knowledge base gives must be
+ * the one the model gives. Some of the gets are batches of them made with
+ * knowledge_probe(), each of which must also agree with knowledge_get().
+ *
+ * Usage:
+ *   gcc -g -O1 -fsanitize=address,undefined -pthread -o kbcheck kbcheck.c \
+ *       tokenizer.c chatbot.c knowledge.c pool.c shard.c compress.c intern.c \
+ *       vocab.c session.c template.c normalize.c
+ *   ./kbcheck [-n operations] [-s seed]
+ *
+ * The model keeps, for each intent, a plain array of the response to every
+ * entity and the order the entities were added in, and a copy of all of that
+ * for each snapshot. Entities are made from a few words and a number, each
+ * spelt in many ways (in any case, with spaces, underscores or nothing
+ * between the words, sometimes starting with '[' or ending with punctuation)
+ * that all have the same key, so the model's key is just the entity's number.
+ * Some of the words ("c", "c++", "c#") differ only in the marks normalize.c
+ * keeps in a word, and must stay different entities. Each
+ * entity keeps the spelling it was first put with until the knowledge base is
+ * reset, which is the spelling saved and filled into {entity} slots. A save
+ * must match the model's own rendering of the file byte for byte.
+ *
+ * The given number of operations (default 1000000) are run, starting from the
+ * given seed (default 1), and the number run a second is reported. At the
+ * first answer that differs from the model's, the operation and both answers
+ * are printed.
+ *
+ * Exit status: 0 if the knowledge base always agreed with the model;
+ * otherwise 1.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include "chat1002.h"
+
+/* the number of different entities */
+#define ENTITIES 96
+
+/* the intents questions are put in (the first MAX_NO_OF_INTENT - 1 of
+   all_intents) */
+#define INTENTS (MAX_NO_OF_INTENT - 1)
+
+/* the longest response put, which is longer than a response can be got */
+#define MAX_CHECK_RESPONSE (MAX_RESPONSE + 64)
+
+/* the longest response got, with its slots filled in (each with a spelling of
+   at most 64 characters) */
+#define MAX_CHECK_RENDERED (MAX_CHECK_RESPONSE + MAX_PARTS / 2 * 64)
+
+/* the most snapshots there can be (one for each of snapshot_names) */
+#define MAX_CHECK_SNAPSHOTS 3
+
+/* the knowledge base as the model has it */
+typedef struct state
+{
+	int counts[INTENTS];
+	unsigned char order[INTENTS][ENTITIES];  /* the entities of each intent, in the order they were added */
+	unsigned char present[INTENTS][ENTITIES];
+	char responses[INTENTS][ENTITIES][MAX_CHECK_RESPONSE];
+} STATE;
+
+/* a named copy of the model */
+typedef struct check_snapshot
+{
+	char name[16];
+	STATE state;
+} CHECK_SNAPSHOT;
+
+/* the words entities are made from (none ends in a plural ending, so that
+   no spelling is stemmed differently from another) */
+static const char *entity_words[] = {"alpha", "bravo", "charlie", "delta", "echo", "c", "c++", "c#"};
+
+/* the words responses are made from */
+static const char *response_words[] = {
+	"the", "campus", "is", "at", "Dover", "taught", "by", "ICT1002", "=", "[", "]", "{", "}",
+	"{entity}", "{user}", "{bot}", "C", "programming", "Singapore", "\xc3\xa9t\xc3\xa9", "a", "."};
+
+#define RESPONSE_WORD_COUNT (int)(sizeof(response_words) / sizeof(response_words[0]))
+
+static const char *snapshot_names[MAX_CHECK_SNAPSHOTS] = {"one", "two", "three"};
+
+static STATE model;
+static CHECK_SNAPSHOT snapshots[MAX_CHECK_SNAPSHOTS];
+static int snapshot_count = 0;
+static char spellings[ENTITIES][64];  /* as each entity was first spelt, or "" */
+static uint64_t random_state;
+static long operation;
+
+/*
+ * Answer the chatbot's questions (it never asks any here).
+ */
+int prompt_user(char **buf, int *size, const char *format, ...)
+{
+	return -1;
+}
+
+/*
+ * Get a random number (xorshift64*) less than a limit.
+ */
+static int random_below(int limit)
+{
+	random_state ^= random_state >> 12;
+	random_state ^= random_state << 25;
+	random_state ^= random_state >> 27;
+	return (int)((random_state * 2685821657736338717ULL >> 33) % limit);
+}
+
+/*
+ * Report a difference from the model and stop.
+ */
+static void mismatch(const char *what, const char *expected, const char *got)
+{
+	printf("operation %ld: %s\n  expected: %s\n  got:      %s\n", operation, what, expected, got);
+	exit(1);
+}
+
+/*
+ * Report a status that is not the one expected and stop.
+ */
+static void check_status(const char *what, int expected, int got)
+{
+	char e[16], g[16];
+	if (expected == got)
+		return;
+	snprintf(e, sizeof(e), "%d", expected);
+	snprintf(g, sizeof(g), "%d", got);
+	mismatch(what, e, g);
+}
+
+/*
+ * Spell an entity in one of the ways that has its key.
+ *
+ * Input:
+ *   entity  - the number of the entity
+ *   out     - receives the spelling, which has room for 64 characters
+ *
+ * Returns: the number of characters in the spelling
+ */
+static int spell_entity(int entity, char *out)
+{
+	// A '-' between two words would join them into one ("alpha-bravo"), and
+	// so is not a separator; a '.' at the end is not part of the word.
+	static const char *separators[] = {" ", "  ", "_", ""};
+	static const char *endings[] = {"", "", "", "?", ".", "!"};
+	const char *first = entity_words[entity % 8];
+	const char *second = entity_words[entity / 8 % 8];
+	char plain[64];
+	int len;
+
+	// Entities 0-63 are two words; the rest are a word and a number.
+	if (entity < 64)
+		len = snprintf(plain, sizeof(plain), "%s%s%s%s%s", random_below(8) == 0 ? "[" : "", first,
+					   separators[random_below(4)], second, endings[random_below(6)]);
+	else
+		len = snprintf(plain, sizeof(plain), "%s%s%s%d%s", random_below(8) == 0 ? "[" : "", first,
+					   separators[random_below(3)], entity, endings[random_below(6)]);
+
+	// Any letter may be in either case.
+	int style = random_below(4);
+	for (int i = 0; i < len; i++)
+	{
+		char c = plain[i];
+		if (style == 1 || (style == 2 && i == 0) || (style == 3 && random_below(2) == 0))
+			c = c >= 'a' && c <= 'z' ? c - 'a' + 'A' : c;
+		out[i] = c;
+	}
+	out[len] = '\0';
+	return len;
+}
+
+/*
+ * Make a response, which neither starts nor ends with a space and has no line
+ * breaks, so that it is saved and read back as it was put, and has no more
+ * slots than a template is sure to hold (see template_compile()).
+ *
+ * Input:
+ *   out - receives the response, which has room for MAX_CHECK_RESPONSE characters
+ */
+static void make_response(char *out)
+{
+	int words = random_below(10) == 0 ? random_below(80) : random_below(12);
+	int len = 0;
+	int slots = 0;
+	out[0] = '\0';
+	for (int i = 0; i < words; i++)
+	{
+		const char *word = response_words[random_below(RESPONSE_WORD_COUNT)];
+		int word_len = strlen(word);
+		if (len + word_len + 2 > MAX_CHECK_RESPONSE)
+			break;
+		if (word_len > 2 && word[0] == '{' && ++slots > MAX_PARTS / 2 - 1)
+			continue;
+		if (len > 0)
+			out[len++] = ' ';
+		memcpy(out + len, word, word_len + 1);
+		len += word_len;
+	}
+}
+
+/*
+ * Work out the response the knowledge base should give for a question: the
+ * whole response, with its slots filled in, cut short to fit n characters.
+ */
+static void render(int entity, const char *response, char *out, int n)
+{
+	int len = 0;
+	for (const char *s = response; *s != '\0' && len < n - 1;)
+	{
+		const char *value = NULL;
+		int skip = 0;
+		if (strncmp(s, "{entity}", 8) == 0)
+			value = spellings[entity], skip = 8;
+		else if (strncmp(s, "{user}", 6) == 0)
+			value = chatbot_username(), skip = 6;
+		else if (strncmp(s, "{bot}", 5) == 0)
+			value = chatbot_botname(), skip = 5;
+
+		if (value == NULL)
+		{
+			out[len++] = *s++;
+			continue;
+		}
+		for (; *value != '\0' && len < n - 1; value++)
+			out[len++] = *value;
+		s += skip;
+	}
+	out[len] = '\0';
+}
+
+/*
+ * Work out the knowledge file knowledge_write() should save.
+ *
+ * Returns: the text, which the caller must free(); *len receives its length
+ */
+static char *model_write(size_t *len)
+{
+	char *text = NULL;
+	FILE *f = open_memstream(&text, len);
+	for (int i = 0; i < INTENTS; i++)
+	{
+		if (model.counts[i] == 0)
+			continue;
+		fprintf(f, "\n[%s]\n", all_intents[i].intent);
+		for (int k = 0; k < model.counts[i]; k++)
+		{
+			int entity = model.order[i][k];
+			fprintf(f, "%s=%s\n", spellings[entity], model.responses[i][entity]);
+		}
+	}
+	fclose(f);
+	return text;
+}
+
+/*
+ * Save the knowledge base in memory.
+ *
+ * Returns: the text, which the caller must free(); *len receives its length
+ */
+static char *save_text(size_t *len)
+{
+	char *text = NULL;
+	FILE *f = open_memstream(&text, len);
+	knowledge_write(f);
+	fclose(f);
+	return text;
+}
+
+/*
+ * Put a question in both.
+ */
+static void check_put()
+{
+	int intent = random_below(INTENTS);
+	int entity = random_below(ENTITIES);
+	char spelling[64];
+	char response[MAX_CHECK_RESPONSE];
+	int len = spell_entity(entity, spelling);
+	make_response(response);
+
+	check_status("put", KB_OK, knowledge_put(all_intents[intent].intent, spelling, len, response));
+
+	if (spellings[entity][0] == '\0')
+		strcpy(spellings[entity], spelling);
+	if (!model.present[intent][entity])
+	{
+		model.present[intent][entity] = 1;
+		model.order[intent][model.counts[intent]++] = entity;
+	}
+	strcpy(model.responses[intent][entity], response);
+}
+
+/*
+ * Ask a question of both.
+ */
+static void check_get()
+{
+	int intent = random_below(INTENTS);
+	int entity = random_below(ENTITIES);
+	char spelling[64];
+	char expected[MAX_CHECK_RENDERED];
+	char got[MAX_CHECK_RENDERED];
+	int n = random_below(2) == 0 ? MAX_RESPONSE : MAX_CHECK_RENDERED;
+	int len = spell_entity(entity, spelling);
+
+	int status = knowledge_get(all_intents[intent].intent, spelling, len, got, n);
+	if (!model.present[intent][entity])
+	{
+		check_status("get of a question not put", KB_NOTFOUND, status);
+		return;
+	}
+	check_status("get", KB_OK, status);
+	render(entity, model.responses[intent][entity], expected, n);
+	if (strcmp(expected, got) != 0)
+		mismatch("get", expected, got);
+}
+
+/*
+ * Ask a batch of questions with knowledge_probe(), and each of them again with
+ * knowledge_get() and of the model.
+ */
+static void check_probe()
+{
+	PROBE probes[MAX_BATCH];
+	int entities[MAX_BATCH];
+	char spellings[MAX_BATCH][64];
+	char responses[MAX_BATCH][MAX_RESPONSE];
+	char expected[MAX_RESPONSE];
+	char got[MAX_RESPONSE];
+	int count = random_below(MAX_BATCH) + 1;
+
+	for (int i = 0; i < count; i++)
+	{
+		entities[i] = random_below(ENTITIES);
+		probes[i].intent = random_below(INTENTS);
+		probes[i].entity = spellings[i];
+		probes[i].len = spell_entity(entities[i], spellings[i]);
+		probes[i].response = responses[i];
+		probes[i].n = MAX_RESPONSE;
+	}
+	knowledge_probe(probes, count);
+
+	for (int i = 0; i < count; i++)
+	{
+		int intent = probes[i].intent;
+		int status = knowledge_get(all_intents[intent].intent, probes[i].entity, probes[i].len, got, MAX_RESPONSE);
+		check_status("probe, against get", status, probes[i].status);
+		if (!model.present[intent][entities[i]])
+		{
+			check_status("probe of a question not put", KB_NOTFOUND, probes[i].status);
+			continue;
+		}
+		check_status("probe", KB_OK, probes[i].status);
+		if (strcmp(got, responses[i]) != 0)
+			mismatch("probe, against get", got, responses[i]);
+		render(entities[i], model.responses[intent][entities[i]], expected, MAX_RESPONSE);
+		if (strcmp(expected, responses[i]) != 0)
+			mismatch("probe", expected, responses[i]);
+	}
+}
+
+/*
+ * Ask both everything about an entity.
+ */
+static void check_about()
+{
+	int entity = random_below(ENTITIES);
+	char spelling[64];
+	char buffers[MAX_NO_OF_INTENT][MAX_RESPONSE];
+	char *responses[MAX_NO_OF_INTENT];
+	char expected[MAX_RESPONSE];
+	int len = spell_entity(entity, spelling);
+	int found = 0;
+
+	for (int i = 0; i < MAX_NO_OF_INTENT; i++)
+		responses[i] = buffers[i];
+	int status = knowledge_about(spelling, len, responses, MAX_RESPONSE);
+	for (int i = 0; i < INTENTS; i++)
+	{
+		if (!model.present[i][entity])
+			continue;
+		found++;
+		render(entity, model.responses[i][entity], expected, MAX_RESPONSE);
+		if (strcmp(expected, buffers[i]) != 0)
+			mismatch("about", expected, buffers[i]);
+	}
+	check_status("about", found, status);
+}
+
+/*
+ * Count the questions in both.
+ */
+static void check_count()
+{
+	int count = 0;
+	for (int i = 0; i < INTENTS; i++)
+		count += model.counts[i];
+	check_status("count", count, knowledge_count());
+}
+
+/*
+ * Reset both.
+ */
+static void check_reset()
+{
+	knowledge_reset();
+	memset(&model, 0, sizeof(model));
+	memset(spellings, 0, sizeof(spellings));
+	snapshot_count = 0;
+	check_count();
+}
+
+/*
+ * Save the knowledge base, and compare it with the model's rendering.
+ *
+ * Returns: the saved text, which the caller must free(); *len receives its
+ * length
+ */
+static char *check_save(size_t *len)
+{
+	size_t expected_len;
+	char *expected = model_write(&expected_len);
+	char *text = save_text(len);
+	if (*len != expected_len || memcmp(expected, text, expected_len) != 0)
+		mismatch("save", expected, text);
+	free(expected);
+	return text;
+}
+
+/*
+ * Save the knowledge base, reset it, and load what was saved. Entities that
+ * were interned but have no questions are forgotten, as are the snapshots.
+ */
+static void check_load()
+{
+	size_t len;
+	char *text = check_save(&len);
+	int count = knowledge_count();
+
+	knowledge_reset();
+	FILE *f = fmemopen(text, len > 0 ? len : 1, "r");
+	COLLISIONS collisions = {0};
+	check_status("load", count, len > 0 ? knowledge_read(f, &collisions) : 0);
+	check_status("collisions on load", 0, collisions.count);
+	fclose(f);
+	free(text);
+
+	snapshot_count = 0;
+	for (int entity = 0; entity < ENTITIES; entity++)
+	{
+		int kept = 0;
+		for (int i = 0; i < INTENTS; i++)
+			kept |= model.present[i][entity];
+		if (!kept)
+			spellings[entity][0] = '\0';
+	}
+	check_count();
+}
+
+/*
+ * Name the current version in both.
+ */
+static void check_snapshot()
+{
+	const char *name = snapshot_names[random_below(MAX_CHECK_SNAPSHOTS)];
+	char spelling[16];
+	strcpy(spelling, name);
+	if (random_below(2) == 0)
+		spelling[0] = spelling[0] - 'a' + 'A';
+
+	check_status("snapshot", KB_OK, knowledge_snapshot(spelling));
+
+	// A snapshot of the same name is replaced by one at the end.
+	for (int i = 0; i < snapshot_count; i++)
+	{
+		if (strcasecmp(snapshots[i].name, name) == 0)
+		{
+			memmove(&snapshots[i], &snapshots[i + 1], (snapshot_count - i - 1) * sizeof(CHECK_SNAPSHOT));
+			snapshot_count--;
+			break;
+		}
+	}
+	strcpy(snapshots[snapshot_count].name, name);
+	snapshots[snapshot_count].state = model;
+	snapshot_count++;
+}
+
+/*
+ * Go back to a named version in both.
+ */
+static void check_rollback()
+{
+	const char *name = snapshot_names[random_below(MAX_CHECK_SNAPSHOTS)];
+	int i;
+	for (i = 0; i < snapshot_count; i++)
+	{
+		if (strcasecmp(snapshots[i].name, name) == 0)
+			break;
+	}
+
+	int status = knowledge_rollback(name);
+	if (i == snapshot_count)
+	{
+		check_status("rollback to a snapshot not taken", KB_NOTFOUND, status);
+		return;
+	}
+	check_status("rollback", KB_OK, status);
+	model = snapshots[i].state;
+	snapshot_count = i + 1;
+	check_count();
+}
+
+/*
+ * Compact the knowledge base, which it only does without snapshots; the
+ * model does not change, no garbage is left, not even words of the
+ * dictionary that no response uses, and everything left is counted in the
+ * size after.
+ *
+ * Half the time, a snapshot of the compacted knowledge base is then taken in
+ * both, some of its questions are each put once more with responses other
+ * questions have, and both roll back to it. What the puts replaced in the
+ * compacted block is still the snapshot's, so it is not garbage: apart from
+ * the dictionary (which a response that does not compress still adds words
+ * to), the rollback must leave the size as it was after compacting, and the
+ * garbage grown by exactly what the puts took, which it frees.
+ */
+static void check_compact()
+{
+	COMPACTION result;
+	check_status("compact", snapshot_count > 0 ? KB_INVALID : KB_OK, knowledge_compact(&result));
+	if (snapshot_count > 0)
+		return;
+	long live;
+	check_status("garbage after compact", 0, (int)knowledge_garbage(&live));
+	check_status("live bytes after compact", (int)result.bytes_after, (int)live);
+	long compacted = live - compress_dictionary_bytes();
+
+	int intent = random_below(INTENTS);
+	int count = model.counts[intent];
+	if (random_below(2) == 0 || count == 0)
+		return;
+	const char *name = snapshot_names[random_below(MAX_CHECK_SNAPSHOTS)];
+	check_status("snapshot after compact", KB_OK, knowledge_snapshot(name));
+	strcpy(snapshots[0].name, name);
+	snapshots[0].state = model;
+	snapshot_count = 1;
+
+	// No question is put twice, so none of what the puts take is freed
+	// before the rollback.
+	int puts = 1 + random_below(count);
+	int first = random_below(count);
+	for (int i = 0; i < puts; i++)
+	{
+		int entity = model.order[intent][(first + i) % count];
+		int other = model.order[intent][random_below(count)];
+		check_status("put after snapshot of compact", KB_OK,
+					 knowledge_put(all_intents[intent].intent, spellings[entity], strlen(spellings[entity]),
+								   model.responses[intent][other]));
+		if (other != entity)
+			strcpy(model.responses[intent][entity], model.responses[intent][other]);
+	}
+
+	long taken;
+	knowledge_garbage(&taken);
+	taken -= compress_dictionary_bytes() + compacted;
+	check_status("rollback to snapshot of compact", KB_OK, knowledge_rollback(name));
+	model = snapshots[0].state;
+	long garbage = knowledge_garbage(&live) - compress_dead_bytes();
+	check_status("live bytes after rollback to snapshot of compact", (int)compacted,
+				 (int)(live - compress_dictionary_bytes()));
+	check_status("garbage after rollback to snapshot of compact", (int)taken, (int)garbage);
+	check_count();
+}
+
+int main(int argc, char *argv[])
+{
+	long operations = 1000000;
+	uint64_t seed = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:s:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			operations = atol(optarg);
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n operations] [-s seed]\n", argv[0]);
+			return 1;
+		}
+	}
+	random_state = seed * 0x9E3779B97F4A7C15ULL + 1;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (operation = 1; operation <= operations; operation++)
+	{
+		int choice = random_below(1000);
+		if (choice < 450)
+			check_put();
+		else if (choice < 800)
+			check_get();
+		else if (choice < 850)
+			check_probe();
+		else if (choice < 900)
+			check_about();
+		else if (choice < 920)
+			check_count();
+		else if (choice < 940)
+		{
+			size_t len;
+			free(check_save(&len));
+		}
+		else if (choice < 955)
+			check_load();
+		else if (choice < 970)
+			check_snapshot();
+		else if (choice < 985)
+			check_rollback();
+		else if (choice < 995)
+			check_compact();
+		else
+			check_reset();
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+	printf("%ld operations in %.2f s (%.0f operations/s), all agreed with the model\n", operations, seconds,
+		   operations / seconds);
+	knowledge_reset();
+	return 0;
+}
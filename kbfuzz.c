@@ -0,0 +1,369 @@
+/*
+ * ICT1002 (C Language) Group Project.
+ *
+ * This file implements a fuzzing harness for the knowledge file parser,
+ * knowledge_read().
+ *
+ * Each input is read as a knowledge file. The knowledge base is then saved,
+ * reset, read back from what was saved and saved again: the second reading
+ * must find as many questions as the knowledge base had, with no entity
+ * spelt two ways, and the second save must be exactly the same as the first.
+ * Failing that, crashing, or upsetting a sanitizer is a failure.
+ *
+ * Usage:
+ *   with libFuzzer:
+ *     clang -g -O1 -fsanitize=fuzzer,address,undefined -DKBFUZZ_LIBFUZZER -pthread \
+ *         -o kbfuzz kbfuzz.c tokenizer.c chatbot.c knowledge.c pool.c shard.c \
+ *         compress.c intern.c vocab.c session.c template.c normalize.c
+ *     ./kbfuzz corpus/
+ *   with AFL:
+ *     afl-clang-fast -g -O1 -pthread -o kbfuzz kbfuzz.c ...
+ *     afl-fuzz -i corpus -o findings ./kbfuzz -
+ *   by itself:
+ *     gcc -g -O1 -fsanitize=address,undefined -pthread -o kbfuzz kbfuzz.c ...
+ *     ./kbfuzz [-n runs] [-s seed] [knowledge file]...
+ *     ./kbfuzz - < input
+ *
+ * By itself, it makes inputs from the knowledge files given (default
+ * sample.ini) by flipping, inserting and deleting bytes, inserting pieces of
+ * the syntax of a knowledge file ("[", "]", "=", line endings, question words,
+ * slots, runs of a character longer than any of the limits), and splicing two
+ * inputs together. It runs the given number of them (default 100000) and
+ * reports how many it ran a second. Before a failing input is reported it is
+ * written to kbfuzz-crash.ini, so it can be run again with
+ * "./kbfuzz - < kbfuzz-crash.ini", which runs the one input on the standard
+ * input (as AFL does).
+ *
+ * Exit status: 0 if every input passed; otherwise the program is aborted.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include "chat1002.h"
+
+/* the largest input tried */
+#define MAX_FUZZ_INPUT 65536
+
+/* the most knowledge files the inputs are made from */
+#define MAX_CORPUS 64
+
+/* the file a failing input is written to */
+#define CRASH_FILE "kbfuzz-crash.ini"
+
+/* set by the sanitizers, if the program is built with one */
+extern void __sanitizer_set_death_callback(void (*callback)(void)) __attribute__((weak));
+
+/* the input being run */
+static const uint8_t *current_data = NULL;
+static size_t current_size = 0;
+
+/* pieces of the syntax of a knowledge file, inserted whole */
+static const char *pieces[] = {
+	"\n", "\r\n", "[", "]", "=", " ", "\t", "[what]\n", "[who]\n", "[WHERE]\n", "[]\n", "[nothing]\n",
+	"=\n", "==", "{entity}", "{user}", "{bot}", "{", "}", "what", "is", "it", "SIT", "ICT 1002", "\0"};
+
+#define PIECE_COUNT (int)(sizeof(pieces) / sizeof(pieces[0]))
+
+/*
+ * Answer the chatbot's questions (it never asks any here).
+ */
+int prompt_user(char **buf, int *size, const char *format, ...)
+{
+	return -1;
+}
+
+/*
+ * Write the input being run to CRASH_FILE.
+ */
+static void save_crash()
+{
+	FILE *f = fopen(CRASH_FILE, "wb");
+	if (f == NULL)
+		return;
+	fwrite(current_data, 1, current_size, f);
+	fclose(f);
+}
+
+/*
+ * Report a failed check and stop.
+ */
+static void fail(const char *what)
+{
+	fprintf(stderr, "kbfuzz: %s\n", what);
+	save_crash();
+	abort();
+}
+
+/*
+ * Save the knowledge base in memory.
+ *
+ * Returns: the text, which the caller must free(); *len receives its length
+ */
+static char *save_text(size_t *len)
+{
+	char *text = NULL;
+	FILE *f = open_memstream(&text, len);
+	if (f == NULL)
+		fail("open_memstream() failed");
+	knowledge_write(f);
+	fclose(f);
+	return text;
+}
+
+/*
+ * Read a knowledge file held in memory.
+ *
+ * Returns: as knowledge_read()
+ */
+static int read_text(const void *text, size_t len, COLLISIONS *collisions)
+{
+	collisions->count = 0;
+	if (len == 0)
+		return 0;
+	FILE *f = fmemopen((void *)text, len, "r");
+	if (f == NULL)
+		fail("fmemopen() failed");
+	int count = knowledge_read(f, collisions);
+	fclose(f);
+	return count;
+}
+
+/*
+ * Run one input.
+ *
+ * Returns: 0 (a failure does not return)
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	if (size > MAX_FUZZ_INPUT)
+		return 0;
+	current_data = data;
+	current_size = size;
+
+	COLLISIONS collisions;
+	int read = read_text(data, size, &collisions);
+	int count = knowledge_count();
+	if (read < 0 || count > read)
+		fail("more questions in the knowledge base than were read");
+
+	size_t first_len;
+	char *first = save_text(&first_len);
+	knowledge_reset();
+	if (knowledge_count() != 0)
+		fail("questions left after reset");
+
+	if (read_text(first, first_len, &collisions) != count || knowledge_count() != count)
+		fail("the saved knowledge base reads back with a different number of questions");
+	if (collisions.count != 0)
+		fail("the saved knowledge base reads back with an entity spelt two ways");
+
+	size_t second_len;
+	char *second = save_text(&second_len);
+	if (second_len != first_len || memcmp(first, second, first_len) != 0)
+		fail("the saved knowledge base saves differently once read back");
+
+	free(first);
+	free(second);
+	knowledge_reset();
+	return 0;
+}
+
+#ifndef KBFUZZ_LIBFUZZER
+
+/*
+ * Get a random number (xorshift64*).
+ */
+static uint64_t random_next(uint64_t *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 2685821657736338717ULL;
+}
+
+/*
+ * Read a whole file into memory.
+ *
+ * Returns: the contents, which the caller must free(), or NULL if it could
+ * not be read; *size receives the number of bytes
+ */
+static uint8_t *read_file(FILE *f, size_t *size)
+{
+	uint8_t *data = (uint8_t *)malloc(MAX_FUZZ_INPUT);
+	if (data == NULL)
+		return NULL;
+	*size = fread(data, 1, MAX_FUZZ_INPUT, f);
+	return data;
+}
+
+/*
+ * Change an input at random, once.
+ *
+ * Input:
+ *   data   - the input, with room for MAX_FUZZ_INPUT bytes
+ *   size   - the number of bytes in it
+ *   other  - another input, to splice in
+ *   osize  - the number of bytes in the other input
+ *   state  - the state of the random numbers
+ *
+ * Returns: the number of bytes in the input afterwards
+ */
+static size_t mutate(uint8_t *data, size_t size, const uint8_t *other, size_t osize, uint64_t *state)
+{
+	size_t at = size > 0 ? random_next(state) % (size + 1) : 0;
+	size_t room = MAX_FUZZ_INPUT - size;
+
+	switch (random_next(state) % 7)
+	{
+	case 0: // flip a bit
+		if (at < size)
+			data[at] ^= 1 << (random_next(state) % 8);
+		break;
+	case 1: // set a byte to anything
+		if (at < size)
+			data[at] = random_next(state);
+		break;
+	case 2: // delete some bytes
+	{
+		size_t len = random_next(state) % 16 + 1;
+		if (at + len > size)
+			len = size - at;
+		memmove(data + at, data + at + len, size - at - len);
+		size -= len;
+		break;
+	}
+	case 3: // insert a piece of syntax
+	case 4:
+	{
+		int piece = random_next(state) % PIECE_COUNT;
+		size_t len = pieces[piece][0] == '\0' ? 1 : strlen(pieces[piece]);
+		if (len > room)
+			break;
+		memmove(data + at + len, data + at, size - at);
+		memcpy(data + at, pieces[piece], len);
+		size += len;
+		break;
+	}
+	case 5: // insert a long run of one character
+	{
+		size_t len = random_next(state) % (MAX_INPUT + MAX_RESPONSE) + 1;
+		if (len > room)
+			break;
+		memmove(data + at + len, data + at, size - at);
+		memset(data + at, random_next(state) % 2 ? 'x' : (int)(random_next(state) % 256), len);
+		size += len;
+		break;
+	}
+	case 6: // replace the rest with part of the other input
+	{
+		size_t from = osize > 0 ? random_next(state) % osize : 0;
+		size_t len = osize - from;
+		if (at + len > MAX_FUZZ_INPUT)
+			len = MAX_FUZZ_INPUT - at;
+		memcpy(data + at, other + from, len);
+		size = at + len;
+		break;
+	}
+	}
+	return size;
+}
+
+int main(int argc, char *argv[])
+{
+	long runs = 100000;
+	uint64_t seed = 1;
+	int opt;
+
+	if (__sanitizer_set_death_callback != NULL)
+		__sanitizer_set_death_callback(save_crash);
+
+	// Run the one input on the standard input.
+	if (argc == 2 && strcmp(argv[1], "-") == 0)
+	{
+		size_t size;
+		uint8_t *data = read_file(stdin, &size);
+		if (data == NULL)
+			return 1;
+		LLVMFuzzerTestOneInput(data, size);
+		free(data);
+		return 0;
+	}
+
+	while ((opt = getopt(argc, argv, "n:s:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			runs = atol(optarg);
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n runs] [-s seed] [knowledge file]...\n       %s - < input\n",
+					argv[0], argv[0]);
+			return 1;
+		}
+	}
+
+	uint8_t *corpus[MAX_CORPUS];
+	size_t sizes[MAX_CORPUS];
+	int corpus_count = 0;
+	for (int i = optind; i == optind || i < argc; i++)
+	{
+		const char *file = i < argc ? argv[i] : "sample.ini";
+		FILE *f = fopen(file, "rb");
+		if (f == NULL)
+		{
+			perror(file);
+			return 1;
+		}
+		if (corpus_count < MAX_CORPUS)
+		{
+			corpus[corpus_count] = read_file(f, &sizes[corpus_count]);
+			if (corpus[corpus_count] != NULL)
+				corpus_count++;
+		}
+		fclose(f);
+	}
+	if (corpus_count == 0)
+		return 1;
+
+	// The knowledge files themselves must pass.
+	for (int i = 0; i < corpus_count; i++)
+		LLVMFuzzerTestOneInput(corpus[i], sizes[i]);
+
+	uint8_t *data = (uint8_t *)malloc(MAX_FUZZ_INPUT);
+	if (data == NULL)
+		return 1;
+	uint64_t state = seed * 0x9E3779B97F4A7C15ULL + 1;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long run = 0; run < runs; run++)
+	{
+		int from = random_next(&state) % corpus_count;
+		int other = random_next(&state) % corpus_count;
+		size_t size = sizes[from];
+		memcpy(data, corpus[from], size);
+		int changes = random_next(&state) % 8 + 1;
+		for (int i = 0; i < changes; i++)
+			size = mutate(data, size, corpus[other], sizes[other], &state);
+		LLVMFuzzerTestOneInput(data, size);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+	printf("%ld runs in %.2f s (%.0f runs/s), no failures\n", runs, seconds, runs / seconds);
+
+	free(data);
+	for (int i = 0; i < corpus_count; i++)
+		free(corpus[i]);
+	return 0;
+}
+
+#endif
@@ -8,6 +8,66 @@
  * knowledge_read() reads the knowledge base from a file.
  * knowledge_reset() erases all of the knowledge.
  * knowledge_write() saves the knowledge base in a file.
+ * knowledge_write_workers() sets how many threads knowledge_write() uses.
+ * knowledge_export() writes the knowledge base as a stream of records.
+ * knowledge_import() reads a stream of records into the knowledge base.
+ * knowledge_snapshot() names the current version of the knowledge base.
+ * knowledge_rollback() goes back to a named version.
+ * knowledge_compact() moves the knowledge base into one block of memory.
+ *
+ * Responses may be templates, with slots for the entity and the names of the
+ * user and the chatbot (see template.c), which are filled in whenever the
+ * response is looked up; they are saved as they were written.
+ *
+ * Each intent keeps the IDs of the entities it has questions about in its
+ * order array, in the order they were added, which is the order
+ * knowledge_write() saves them in.
+ *
+ * Entities are looked up by their keys (see normalize.c), so "ICT 1002" and
+ * "ict1002s" are the same entity. The key of the entity given to each of these
+ * functions is worked out before the knowledge base is locked.
+ *
+ * Questions refer to their entities by ID (see intern.c), and the index is
+ * entity-major: for every entity ID it has a row holding the entity's question
+ * for each intent. A lookup finds the ID of the entity it is given once, and
+ * then one row answers every intent, which is what knowledge_about() uses to
+ * gather everything known about an entity. The rows are kept LEAF_ROWS to a
+ * leaf of a tree, with branches of BRANCH_WIDTH nodes above the leaves chosen
+ * by successive bits of the ID, so that a version of the index can share all
+ * but the changed parts of another.
+ *
+ * Nothing is copied when knowledge_snapshot() is called: the snapshot keeps
+ * the root of the index, and starts a new generation. Every node of the index,
+ * and every question, belongs to the generation it was made in, and one from
+ * an older generation is never changed. Instead, the first change to it in the
+ * current generation copies it, along with the nodes above it (a leaf and a
+ * branch or two), and the snapshot keeps the original. A snapshot therefore
+ * takes no memory until something is put, and then only as much as the nodes
+ * and questions that changed. The order arrays are only ever added to, so a
+ * snapshot only needs to remember how long they were.
+ *
+ * knowledge_rollback() puts the snapshot's root back, and frees every node and
+ * question made since (they are on a list of nodes, newest first) along with
+ * every later snapshot; versions form a single line, like savepoints.
+ * knowledge_reset() forgets every snapshot.
+ *
+ * Each question and node of the index is allocated by itself, so a knowledge
+ * base that has been changed and reset many times ends up scattered over a
+ * heap full of holes, which malloc() cannot give back to the system.
+ * knowledge_compact() copies everything the current version uses into one new
+ * block, in the order of the index, and frees the old pieces (see compact.c
+ * for when it is run). Nothing in the block is ever freed by itself or changed:
+ * it belongs to no generation, so a change copies the parts it touches out of
+ * it as if a snapshot had them, and the block goes as a whole when the next
+ * compaction replaces it or the knowledge base is reset. So that there is only
+ * one version to copy, it is not done while there are snapshots.
+ *
+ * If shard_start() has been called, the knowledge base lives in other
+ * processes and these functions pass their work on to shard.c.
+ *
+ * The knowledge base may be used from several threads at once. Lookups share
+ * kb_lock for reading; anything that changes the knowledge base holds it for
+ * writing.
  *
  * You may add helper functions as necessary.
  */
@@ -16,393 +76,1861 @@
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 #include "chat1002.h"
 
+/* the question words and the questions known for each of them (in the same
+   order as the question words in vocabgen.c) */
+INTENT all_intents[MAX_NO_OF_INTENT] = {
+	{"who", NULL, 0},
+	{"what", NULL, 0},
+	{"when", NULL, 0},
+	{"where", NULL, 0},
+	{"why", NULL, 0},
+	{"how", NULL, 0}};
+
+/* protects all_intents, the index, the snapshots, and the tables in intern.c
+   and compress.c */
+static pthread_rwlock_t kb_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* held by knowledge_compact(), so that one block (and one dictionary) is built at a time */
+static pthread_mutex_t compact_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* the least number of questions for which knowledge_write() formats the
+   intents' sections in parallel */
+#define PARALLEL_SAVE_MIN 16384
+
+/* held by knowledge_write() while it uses save_pool, and protects save_pool and save_workers */
+static pthread_mutex_t save_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* the pool knowledge_write() formats sections on, started by the first save
+   that needs it and kept for the ones after */
+static POOL *save_pool = NULL;
+
+/* the number of workers save_pool is to have; 0 for one per core */
+static int save_workers = 0;
+
+/* an intent's section of a saved knowledge base, as formatted by format_section() */
+typedef struct section
+{
+	int intent;     /* index of the intent in all_intents */
+	char *text;     /* the section, not null-terminated */
+	size_t length;  /* number of characters in text */
+	size_t size;    /* number of characters text has room for */
+	int status;     /* KB_OK, or KB_NOMEM if text could not hold the whole section */
+} SECTION;
+
+static void write_section(FILE *f, int intent);
+static void render_response(const QUESTION *question_ptr, char *response, int n);
+
+/* the generation of the nodes and questions in the block built by
+   knowledge_compact(), which is never the generation changes are made in */
+#define COMPACTED -1
+
+/* rounds an offset in the block built by knowledge_compact() up to a multiple
+   of the size of a pointer (for a node) or of an int (for a question) */
+#define COMPACT_ALIGN(offset, alignment) (((offset) + (alignment) - 1) & ~(size_t)((alignment) - 1))
+
+/* the shape of the index: each leaf holds the rows of LEAF_ROWS entities, and
+   each branch holds BRANCH_WIDTH nodes of the level below it */
+#define LEAF_BITS 4
+#define LEAF_ROWS (1 << LEAF_BITS)
+#define BRANCH_BITS 7
+#define BRANCH_WIDTH (1 << BRANCH_BITS)
+
+/* the part every node of the index starts with */
+typedef struct node
+{
+	struct node *older;  /* the node made before this one */
+	int generation;      /* the generation it was made in */
+	int height;          /* 0 for a leaf; otherwise the number of levels of branches from here down */
+} NODE;
+
+/* a leaf of the index */
+typedef struct leaf
+{
+	NODE node;
+	QUESTION *questions[LEAF_ROWS][MAX_NO_OF_INTENT];  /* by entity ID and then by intent */
+} LEAF;
+
+/* a branch of the index */
+typedef struct branch
+{
+	NODE node;
+	NODE *children[BRANCH_WIDTH];
+} BRANCH;
+
+/* a version of the knowledge base */
+typedef struct version
+{
+	NODE *root;                    /* the top of the index, or NULL if it is empty */
+	int height;                    /* the height of the root */
+	int counts[MAX_NO_OF_INTENT];  /* number of IDs in each intent's order */
+	int question_count;            /* number of questions */
+} VERSION;
+
+/* a version kept by knowledge_snapshot() */
+typedef struct snapshot
+{
+	char name[MAX_INPUT];
+	VERSION version;
+	int generation;  /* the generation the snapshot ended */
+	NODE *nodes;     /* the newest node when the snapshot was taken */
+} SNAPSHOT;
+
+static VERSION current;           /* the version being used */
+static int generation = 0;        /* the generation changes are made in */
+static NODE *nodes = NULL;        /* every node of every version, newest first */
+static SNAPSHOT *snapshots = NULL; /* oldest first */
+static int snapshot_count = 0;
+static int snapshot_size = 0;
+static char *compacted = NULL;    /* the block built by knowledge_compact(), or NULL */
+static long compacted_bytes = 0;  /* the size of compacted */
+static long loose_bytes = 0;      /* bytes of the nodes and questions allocated one at a time */
+static long garbage_bytes = 0;    /* bytes freed, or left unused in compacted, since it was built */
+static unsigned long changes = 0; /* the number of changes made to the knowledge base */
+
+/*
+ * Add to one of the counts of bytes. They are changed after kb_lock is
+ * unlocked by knowledge_rollback(), so they are changed atomically.
+ */
+static void count_bytes(long *counter, long bytes)
+{
+	__atomic_add_fetch(counter, bytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * Determine the number of bytes a question takes.
+ */
+static size_t question_size(const QUESTION *question_ptr)
+{
+	if (question_ptr->stored_len < question_ptr->response_len)
+		return sizeof(QUESTION) + question_ptr->stored_len;
+	return sizeof(QUESTION) + question_ptr->response_len + 1;
+}
+
+/*
+ * Give back the uses a question's response makes of the words in the
+ * dictionary (see compress.c), when the question is freed or replaced. The
+ * caller must hold the knowledge base for writing.
+ */
+static void release_question(const QUESTION *question_ptr)
+{
+	if (question_ptr->stored_len < question_ptr->response_len)
+		compress_release((const unsigned char *)question_ptr->response, question_ptr->stored_len);
+}
+
+/*
+ * Determine whether an index with a root of a given height has room for an
+ * entity.
+ */
+static int index_fits(int height, int entity)
+{
+	int bits = LEAF_BITS + BRANCH_BITS * height;
+	return bits >= 31 || (entity >> bits) == 0;
+}
+
+/*
+ * Find the row of questions for an entity in a version of the index.
+ *
+ * Input:
+ *   version - the version
+ *   entity  - the ID of the entity
+ *
+ * Returns: the row (the entity's question for each intent), or NULL if the
+ * index has no row for the entity
+ */
+static QUESTION **index_row(const VERSION *version, int entity)
+{
+	if (entity < 0 || version->root == NULL || !index_fits(version->height, entity))
+		return NULL;
+
+	const NODE *node = version->root;
+	for (int level = version->height; level > 0 && node != NULL; level--)
+		node = ((const BRANCH *)node)->children[(entity >> (LEAF_BITS + BRANCH_BITS * (level - 1))) & (BRANCH_WIDTH - 1)];
+	return node != NULL ? ((LEAF *)node)->questions[entity & (LEAF_ROWS - 1)] : NULL;
+}
+
+/*
+ * Find a question in the index.
+ *
+ * Input:
+ *   intent - the index of the intent in all_intents
+ *   entity - the ID of the entity
+ *
+ * Returns: the question, or NULL if there is none
+ */
+static QUESTION *index_find(int intent, int entity)
+{
+	QUESTION **row = index_row(&current, entity);
+	return row != NULL ? row[intent] : NULL;
+}
+
+/*
+ * Get a node of the index that may be changed in the current generation: the
+ * node at *link if it was made in this generation, or else a copy of it (or a
+ * new empty node, if there is none there), which takes its place at *link.
+ * The node it replaces is left as it is for the snapshots that share it.
+ *
+ * Input:
+ *   link   - where the node is linked from
+ *   height - the height of the node
+ *
+ * Returns: the node, or NULL if there was not enough memory
+ */
+static NODE *index_own(NODE **link, int height)
+{
+	NODE *node = *link;
+	if (node != NULL && node->generation == generation)
+		return node;
+
+	size_t size = height == 0 ? sizeof(LEAF) : sizeof(BRANCH);
+	NODE *copy = (NODE *)(node != NULL ? malloc(size) : calloc(1, size));
+	if (copy == NULL)
+		return NULL;
+	if (node != NULL)
+		memcpy(copy, node, size);
+	count_bytes(&loose_bytes, size);
+
+	// A node in the compacted block is no longer used, unless a snapshot
+	// taken since the compaction has it.
+	if (node != NULL && node->generation == COMPACTED && snapshot_count == 0)
+		count_bytes(&garbage_bytes, size);
+	copy->older = nodes;
+	copy->generation = generation;
+	copy->height = height;
+	nodes = copy;
+	*link = copy;
+	return copy;
+}
+
+/*
+ * Find where the current version of the index keeps a question, making room
+ * for it if need be. Every node on the way to it is made the current
+ * generation's own (see index_own()), so the question can be changed without
+ * changing any snapshot.
+ *
+ * Input:
+ *   intent - the index of the intent in all_intents
+ *   entity - the ID of the entity
+ *
+ * Returns: the place for the question, or NULL if there was not enough memory
+ */
+static QUESTION **index_slot(int intent, int entity)
+{
+	// Make the index tall enough for the entity, adding branches above the
+	// root.
+	if (current.root == NULL)
+		current.height = 0;
+	while (!index_fits(current.height, entity))
+	{
+		if (current.root != NULL)
+		{
+			NODE *root = NULL;
+			if (index_own(&root, current.height + 1) == NULL)
+				return NULL;
+			((BRANCH *)root)->children[0] = current.root;
+			current.root = root;
+		}
+		current.height++;
+	}
+
+	NODE **link = &current.root;
+	for (int level = current.height; level > 0; level--)
+	{
+		BRANCH *branch = (BRANCH *)index_own(link, level);
+		if (branch == NULL)
+			return NULL;
+		link = &branch->children[(entity >> (LEAF_BITS + BRANCH_BITS * (level - 1))) & (BRANCH_WIDTH - 1)];
+	}
+	LEAF *leaf = (LEAF *)index_own(link, 0);
+	return leaf != NULL ? &leaf->questions[entity & (LEAF_ROWS - 1)][intent] : NULL;
+}
+
+/*
+ * Free the nodes of the index from the newest down to (but not including) a
+ * given one, with the questions that were added to them. A question belongs
+ * to exactly one leaf of its own generation, the one it was added to; the
+ * other leaves it is in are copies made later.
+ *
+ * Input:
+ *   newest - the newest node to free
+ *   kept   - the newest node to keep, or NULL to free them all
+ *
+ * Returns: the number of bytes freed
+ */
+static long index_free(NODE *newest, NODE *kept)
+{
+	long bytes = 0;
+	while (newest != kept)
+	{
+		NODE *older = newest->older;
+		if (newest->height == 0)
+		{
+			bytes += sizeof(LEAF);
+			LEAF *leaf = (LEAF *)newest;
+			for (int r = 0; r < LEAF_ROWS; r++)
+			{
+				for (int i = 0; i < MAX_NO_OF_INTENT; i++)
+				{
+					QUESTION *question_ptr = leaf->questions[r][i];
+					if (question_ptr != NULL && question_ptr->generation == newest->generation)
+					{
+						bytes += question_size(question_ptr);
+						free(question_ptr);
+					}
+				}
+			}
+		}
+		else
+		{
+			bytes += sizeof(BRANCH);
+		}
+		free(newest);
+		newest = older;
+	}
+	return bytes;
+}
+
+/*
+ * Give back the uses of the dictionary made by the questions index_free()
+ * will free from the same nodes. This must be done while holding the
+ * knowledge base for writing, which index_free() need not be.
+ *
+ * Input:
+ *   newest - the newest node to be freed
+ *   kept   - the newest node to be kept, or NULL if they are all to be freed
+ */
+static void index_release(const NODE *newest, const NODE *kept)
+{
+	for (; newest != kept; newest = newest->older)
+	{
+		if (newest->height != 0)
+			continue;
+		const LEAF *leaf = (const LEAF *)newest;
+		for (int r = 0; r < LEAF_ROWS; r++)
+		{
+			for (int i = 0; i < MAX_NO_OF_INTENT; i++)
+			{
+				const QUESTION *question_ptr = leaf->questions[r][i];
+				if (question_ptr != NULL && question_ptr->generation == newest->generation)
+					release_question(question_ptr);
+			}
+		}
+	}
+}
+
+/*
+ * Copy a node of the index and everything below it into the block being built
+ * by knowledge_compact(), or just measure how much room they need. Each node is
+ * followed by the nodes below it, and a leaf by its questions. Compressed
+ * responses are compressed again with the dictionary being built to replace
+ * the current one (see compress_rebuild()), or kept as they are if that would
+ * not make them smaller; measuring builds the dictionary, and copying counts
+ * the uses of its words.
+ *
+ * Input:
+ *   node   - the node
+ *   block  - the block, or NULL to only measure
+ *   offset - the offset of the first free byte of the block; moved past what
+ *            is copied
+ *   status - set to KB_NOMEM if the new dictionary could not grow
+ *
+ * Returns: the copy of the node, or NULL if only measuring
+ */
+static NODE *compact_copy(const NODE *node, char *block, size_t *offset, int *status)
+{
+	size_t size = node->height == 0 ? sizeof(LEAF) : sizeof(BRANCH);
+	*offset = COMPACT_ALIGN(*offset, sizeof(NODE *));
+	NODE *copy = block != NULL ? (NODE *)(block + *offset) : NULL;
+	*offset += size;
+	if (copy != NULL)
+	{
+		memcpy(copy, node, size);
+		copy->older = NULL;
+		copy->generation = COMPACTED;
+	}
+
+	if (node->height == 0)
+	{
+		const LEAF *leaf = (const LEAF *)node;
+		for (int r = 0; r < LEAF_ROWS; r++)
+		{
+			for (int i = 0; i < MAX_NO_OF_INTENT; i++)
+			{
+				const QUESTION *question_ptr = leaf->questions[r][i];
+				if (question_ptr == NULL)
+					continue;
+				const unsigned char *stored = (const unsigned char *)question_ptr->response;
+				int response_len = question_ptr->response_len;
+				int compressed = question_ptr->stored_len < response_len;
+				int stored_len = compressed ? compress_rebuild(stored, question_ptr->stored_len, response_len, NULL)
+											: response_len;
+				if (stored_len == KB_NOMEM)
+					*status = KB_NOMEM;
+				if (stored_len < 0)
+					stored_len = response_len;
+				size_t question_bytes = sizeof(QUESTION) + (stored_len < response_len ? stored_len : response_len + 1);
+				*offset = COMPACT_ALIGN(*offset, sizeof(int));
+				if (copy != NULL)
+				{
+					QUESTION *question_copy = (QUESTION *)(block + *offset);
+					memcpy(question_copy, question_ptr, sizeof(QUESTION));
+					if (stored_len < response_len)
+						compress_rebuild(stored, question_ptr->stored_len, response_len,
+										 (unsigned char *)question_copy->response);
+					else
+						copy_response(question_ptr, question_copy->response, response_len + 1);
+					question_copy->stored_len = stored_len;
+					question_copy->generation = COMPACTED;
+					((LEAF *)copy)->questions[r][i] = question_copy;
+				}
+				*offset += question_bytes;
+			}
+		}
+	}
+	else
+	{
+		const BRANCH *branch = (const BRANCH *)node;
+		for (int i = 0; i < BRANCH_WIDTH; i++)
+		{
+			if (branch->children[i] == NULL)
+				continue;
+			NODE *child = compact_copy(branch->children[i], block, offset, status);
+			if (copy != NULL)
+				((BRANCH *)copy)->children[i] = child;
+		}
+	}
+	return copy;
+}
+
+/*
+ * Build a new table of entities holding only those the current version has
+ * questions about (see intern_rebuild()). The caller must hold the knowledge
+ * base for reading.
+ *
+ * Returns: KB_OK, or KB_NOMEM if there was not enough memory
+ */
+static int rebuild_entities()
+{
+	unsigned char *live = (unsigned char *)calloc(intern_count() + 1, 1);
+	if (live == NULL)
+		return KB_NOMEM;
+	for (int i = 0; i < MAX_NO_OF_INTENT - 1; i++)
+	{
+		for (int k = 0; k < current.counts[i]; k++)
+			live[all_intents[i].order[k]] = 1;
+	}
+	int status = intern_rebuild(live);
+	free(live);
+	return status;
+}
+
+/*
+ * Add an entity to the end of an intent's order.
+ *
+ * Returns: KB_OK, or KB_NOMEM if the order could not grow
+ */
+static int order_append(int intent, int entity)
+{
+	INTENT *intent_ptr = &all_intents[intent];
+	int count = current.counts[intent];
+	if (count == intent_ptr->order_size)
+	{
+		int new_size = intent_ptr->order_size == 0 ? 256 : intent_ptr->order_size * 2;
+		int *new_order = (int *)realloc(intent_ptr->order, new_size * sizeof(int));
+		if (new_order == NULL)
+			return KB_NOMEM;
+		intent_ptr->order = new_order;
+		intent_ptr->order_size = new_size;
+	}
+	intent_ptr->order[count] = entity;
+	current.counts[intent] = count + 1;
+	return KB_OK;
+}
+
+/*
+ * Find a snapshot by name (ignoring case).
+ *
+ * Returns: the index of the snapshot in snapshots, or -1 if there is none
+ */
+static int find_snapshot(const char *name)
+{
+	for (int i = snapshot_count - 1; i >= 0; i--)
+	{
+		if (compare_token(snapshots[i].name, name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * Find the question word an intent refers to.
+ *
+ * Input:
+ *   intent - the intent
+ *   len    - the number of characters in the intent
+ *
+ * Returns: the index of the intent in all_intents, or -1 if it is not a
+ * question word
+ */
+int knowledge_intent(const char *intent, int len)
+{
+	const VOCAB *word = vocab_find(intent, len, hash_token(intent, len));
+	return word != NULL ? word->intent : -1;
+}
+
+/*
+ * Get the response to a question.
+ *
+ * Input:
+ *   intent   - the question word
+ *   entity   - the entity
+ *   len      - the number of characters in the entity
+ *   response - a buffer to receive the response
+ *   n        - the maximum number of characters to write to the response buffer
+ *
+ * Returns:
+ *   KB_OK, if a response was found for the intent and entity (the response is copied to the response buffer)
+ *   KB_NOTFOUND, if no response could be found
+ *   KB_INVALID, if 'intent' is not a recognised question word
+ */
+int knowledge_get(const char *intent, const char *entity, int len, char *response, int n)
+{
+	if (shard_count() > 0)
+	{
+		return shard_get(intent, entity, len, response, n);
+	}
+
+	int intent_index = knowledge_intent(intent, strlen(intent));
+	if (intent_index < 0)
+	{
+		return KB_INVALID;
+	}
+
+	KEY key;
+	if (normalize_key(&key, entity, len) != KB_OK)
+	{
+		return KB_NOMEM;
+	}
+
+	int status = KB_NOTFOUND;
+	pthread_rwlock_rdlock(&kb_lock);
+	int entity_id = intern_lookup(&key);
+	QUESTION *question_ptr = index_find(intent_index, entity_id);
+	if (question_ptr != NULL)
+	{
+		render_response(question_ptr, response, n);
+		status = KB_OK;
+	}
+	pthread_rwlock_unlock(&kb_lock);
+	normalize_free(&key);
+
+	return status;
+}
+
+/*
+ * Look up the questions for a batch of probes at once.
+ *
+ * The lookups are done in stages across the whole batch: first the bucket of
+ * every entity in intern.c's table is prefetched, then the entities are looked
+ * up and their rows in the index prefetched, then the questions themselves,
+ * and only then are the responses copied out. The cache misses of the
+ * different probes therefore overlap instead of being taken one after
+ * another.
+ *
+ * Input:
+ *   probes - the probes; intent, entity, len, response and n must be set, and
+ *            status is set as knowledge_get() would return it (with the
+ *            response copied to the response buffer if it was found)
+ *   count  - the number of probes
+ */
+void knowledge_probe(PROBE probes[], int count)
+{
+	if (shard_count() > 0)
+	{
+		for (int i = 0; i < count; i++)
+			probes[i].status = shard_get(all_intents[probes[i].intent].intent, probes[i].entity,
+										 probes[i].len, probes[i].response, probes[i].n);
+		return;
+	}
+
+	// The keys are worked out MAX_BATCH at a time.
+	if (count > MAX_BATCH)
+	{
+		knowledge_probe(probes, MAX_BATCH);
+		knowledge_probe(probes + MAX_BATCH, count - MAX_BATCH);
+		return;
+	}
+
+	KEY keys[MAX_BATCH];
+	for (int i = 0; i < count; i++)
+	{
+		if (normalize_key(&keys[i], probes[i].entity, probes[i].len) != KB_OK)
+		{
+			// Make it a key that cannot be found.
+			keys[i].length = -1;
+			keys[i].hash = 0;
+		}
+	}
+
+	pthread_rwlock_rdlock(&kb_lock);
+
+	// Stage 1: prefetch the bucket of every entity.
+	for (int i = 0; i < count; i++)
+	{
+		intern_prefetch(keys[i].hash);
+	}
+
+	// Stage 2: find the ID of every entity and prefetch its row.
+	for (int i = 0; i < count; i++)
+	{
+		probes[i].entity_id = keys[i].length >= 0 ? intern_lookup(&keys[i]) : -1;
+		QUESTION **row = index_row(&current, probes[i].entity_id);
+		if (row != NULL)
+			PREFETCH(&row[probes[i].intent]);
+	}
+
+	// Stage 3: prefetch every question.
+	for (int i = 0; i < count; i++)
+	{
+		const QUESTION *question_ptr = index_find(probes[i].intent, probes[i].entity_id);
+		if (question_ptr != NULL)
+			PREFETCH(question_ptr);
+	}
+
+	// Stage 4: copy out the responses.
+	for (int i = 0; i < count; i++)
+	{
+		const QUESTION *question_ptr = index_find(probes[i].intent, probes[i].entity_id);
+		probes[i].status = question_ptr != NULL ? KB_OK : KB_NOTFOUND;
+		if (question_ptr != NULL)
+			render_response(question_ptr, probes[i].response, probes[i].n);
+	}
+	pthread_rwlock_unlock(&kb_lock);
+
+	for (int i = 0; i < count; i++)
+		normalize_free(&keys[i]);
+}
+
+/*
+ * Get everything known about an entity: its response for each intent.
+ *
+ * Input:
+ *   entity    - the entity
+ *   len       - the number of characters in the entity
+ *   responses - one buffer for each intent in all_intents, each set to that
+ *               intent's response, or to an empty string if it has none
+ *   n         - the size of each response buffer
+ *
+ * Returns: the number of intents with a response for the entity
+ */
+int knowledge_about(const char *entity, int len, char *responses[], int n)
+{
+	if (shard_count() > 0)
+	{
+		return shard_about(entity, len, responses, n);
+	}
+
+	KEY key;
+	if (normalize_key(&key, entity, len) != KB_OK)
+	{
+		key.length = -1;
+	}
+
+	int found = 0;
+	pthread_rwlock_rdlock(&kb_lock);
+	int entity_id = key.length >= 0 ? intern_lookup(&key) : -1;
+	for (int i = 0; i < MAX_NO_OF_INTENT; i++)
+	{
+		QUESTION *question_ptr = index_find(i, entity_id);
+		if (question_ptr != NULL)
+		{
+			render_response(question_ptr, responses[i], n);
+			found++;
+		}
+		else if (n > 0)
+		{
+			responses[i][0] = '\0';
+		}
+	}
+	pthread_rwlock_unlock(&kb_lock);
+	normalize_free(&key);
+
+	return found;
+}
+
+/*
+ * Note a question put under an entity that was already known by a different
+ * spelling, unless the spellings are the same but for case, spacing and
+ * punctuation. The caller must hold the knowledge base for writing.
+ *
+ * Input:
+ *   entity_id  - the ID of the entity the question was put under
+ *   entity     - the spelling it was put with
+ *   len        - the number of characters in the spelling
+ *   collisions - where the collision is noted
+ */
+static void note_collision(int entity_id, const char *entity, int len, COLLISIONS *collisions)
+{
+	int known_len;
+	const char *known = intern_string(entity_id, &known_len);
+	if ((known_len == len && memcmp(known, entity, len) == 0) || normalize_same(known, known_len, entity, len))
+		return;
+
+	if (collisions->count++ == 0)
+	{
+		snprintf(collisions->known, sizeof(collisions->known), "%.*s", known_len, known);
+		snprintf(collisions->read, sizeof(collisions->read), "%.*s", len, entity);
+	}
+}
+
+/*
+ * Put a question in this process's knowledge base.
+ *
+ * Input:
+ *   intent_index - the index of the intent in all_intents
+ *   entity       - the entity
+ *   len          - the number of characters in the entity
+ *   response     - the response for this question and entity
+ *   collisions   - where a question put under an entity already spelt
+ *                  differently is noted (may be NULL)
+ *
+ * Returns: as knowledge_put()
+ */
+static int put_question(int intent_index, const char *entity, int len, const char *response,
+						COLLISIONS *collisions)
+{
+	KEY key;
+	if (normalize_key(&key, entity, len) != KB_OK)
+	{
+		return KB_NOMEM;
+	}
+
+	pthread_rwlock_wrlock(&kb_lock);
+
+	// Create pointer to point to the new question with entity and response.
+	int entity_id = intern_entity(&key, entity, len);
+	normalize_free(&key);
+	if (entity_id >= 0 && collisions != NULL)
+		note_collision(entity_id, entity, len, collisions);
+	QUESTION *new_question_ptr = entity_id >= 0 ? create_question(entity_id, response) : NULL;
+	if (new_question_ptr == NULL)
+	{
+		pthread_rwlock_unlock(&kb_lock);
+		return KB_NOMEM;
+	}
+	new_question_ptr->intent = intent_index;
+
+	// Find the question's place in the index; if the intent has no question
+	// about the entity yet, the entity goes at the end of the intent's order.
+	QUESTION **slot = index_slot(intent_index, entity_id);
+	QUESTION *old_question_ptr = slot != NULL ? *slot : NULL;
+	if (slot == NULL || (old_question_ptr == NULL && order_append(intent_index, entity_id) != KB_OK))
+	{
+		release_question(new_question_ptr);
+		pthread_rwlock_unlock(&kb_lock);
+		free(new_question_ptr);
+		return KB_NOMEM;
+	}
+	*slot = new_question_ptr;
+	if (old_question_ptr == NULL)
+		current.question_count++;
+	count_bytes(&loose_bytes, question_size(new_question_ptr));
+	changes++;
+
+	// A question this replaces can go, unless it is from an older generation,
+	// when a snapshot still has it, or in the compacted block. One in the
+	// block is no longer used, and its words are given back, unless a snapshot
+	// taken since the compaction has it; a rollback to that snapshot puts it
+	// back as it was.
+	if (old_question_ptr != NULL && old_question_ptr->generation == generation)
+	{
+		release_question(old_question_ptr);
+		count_bytes(&loose_bytes, -(long)question_size(old_question_ptr));
+		count_bytes(&garbage_bytes, question_size(old_question_ptr));
+	}
+	else
+	{
+		if (old_question_ptr != NULL && old_question_ptr->generation == COMPACTED && snapshot_count == 0)
+		{
+			release_question(old_question_ptr);
+			count_bytes(&garbage_bytes, question_size(old_question_ptr));
+		}
+		old_question_ptr = NULL;
+	}
+
+	pthread_rwlock_unlock(&kb_lock);
+	free(old_question_ptr);
+	return KB_OK;
+}
+
+/*
+ * Insert a new response to a question. If a response already exists for the
+ * given intent and entity, it will be overwritten. Otherwise, it will be added
+ * to the knowledge base.
+ *
+ * Input:
+ *   intent    - the question word
+ *   entity    - the entity
+ *   len       - the number of characters in the entity
+ *   response  - the response for this question and entity
+ *
+ * Returns:
+ *   KB_FOUND, if successful
+ *   KB_NOMEM, if there was a memory allocation failure
+ *   KB_INVALID, if the intent is not a valid question word
+ */
+int knowledge_put(const char *intent, const char *entity, int len, const char *response)
+{
+	// intent_index keeps the index of the correct intent from all_intents.
+	int intent_index = knowledge_intent(intent, strlen(intent));
+
+	// If intent is not found, return invalid.
+	if (intent_index == -1)
+	{
+		return KB_INVALID;
+	}
+
+	if (shard_count() > 0)
+	{
+		return shard_put(intent, entity, len, response);
+	}
+
+	return put_question(intent_index, entity, len, response, NULL);
+}
+
+/*
+ * Insert a new response to a question read from a knowledge file, as
+ * knowledge_put() does, but in this process's knowledge base even when it is
+ * sharded (a shard uses this for its part of a load), noting a question put
+ * under an entity already spelt differently.
+ *
+ * Input:
+ *   as knowledge_put(), and
+ *   collisions - where the collisions are noted
+ *
+ * Returns: as knowledge_put()
+ */
+int knowledge_load_put(const char *intent, const char *entity, int len, const char *response,
+					   COLLISIONS *collisions)
+{
+	int intent_index = knowledge_intent(intent, strlen(intent));
+	if (intent_index == -1)
+	{
+		return KB_INVALID;
+	}
+
+	return put_question(intent_index, entity, len, response, collisions);
+}
+
+/*
+ * Read a knowledge base from a file. The file is left open.
+ *
+ * Two spellings of an entity that are different, other than in case, spacing
+ * and punctuation, can still have the same key (see normalize.c), when the
+ * later one's questions go under the earlier one; each such question is
+ * counted in collisions.
+ *
+ * Input:
+ *   f          - the file
+ *   collisions - receives the questions put under an entity already spelt
+ *                differently (may be NULL)
+ *
+ * Returns: the number of entity/response pairs successful read from the file
+ */
+int knowledge_read(FILE *f, COLLISIONS *collisions)
+{
+	int lines_read = 0;
+	int current_intent = -1;
+	COLLISIONS ignored;
+
+	if (collisions == NULL)
+	{
+		collisions = &ignored;
+	}
+	collisions->count = 0;
+
+	// The line buffer grows to fit the longest line in the file and is reused
+	// for every line, so lines of any length can be read without a new
+	// allocation per line.
+	char *buffer = NULL;
+	int size = 0;
+	int len;
+
+	// When sharded, entities are streamed to their shards, which store them
+	// while this carries on reading.
+	int sharded = shard_count() > 0;
+	if (sharded)
+	{
+		shard_begin_load();
+	}
+
+	// Read lines of file until the end.
+	while ((len = read_line(f, &buffer, &size)) >= 0)
+	{
+		// Trim the line without copying it.
+		char *line = buffer;
+		while (len > 0 && isspace((unsigned char)line[len - 1]))
+			line[--len] = '\0';
+		while (len > 0 && isspace((unsigned char)line[0]))
+		{
+			line++;
+			len--;
+		}
+
+		// If the start is '[' and end is ']', it is an intent, unless it
+		// contains '=' (no intent does): then it is an entity that starts with
+		// '[' and a response that ends with ']'.
+		char *equals = strchr(line, '=');
+		if (len >= 2 && line[0] == '[' && line[len - 1] == ']' && equals == NULL)
+		{
+			// Look up the intent between '[' and ']'; entities under an intent
+			// we do not know are skipped.
+			current_intent = knowledge_intent(line + 1, len - 2);
+			continue;
+		}
+
+		// If the line contain '=', it is a entity/response.
+		if (current_intent >= 0 && equals != NULL && equals != line)
+		{
+			// The entity runs up to the first '=' and the response is the rest
+			// of the line, which may itself contain '='.
+			int entity_len = equals - line;
+			while (entity_len > 0 && isspace((unsigned char)line[entity_len - 1]))
+				entity_len--;
+			if (sharded)
+			{
+				shard_load_put(all_intents[current_intent].intent, line, entity_len, ltrim(equals + 1));
+			}
+			else if (knowledge_load_put(all_intents[current_intent].intent, line, entity_len,
+										ltrim(equals + 1), collisions) == KB_OK)
+			{
+				// Line read increment 1.
+				lines_read++;
+			}
+		}
+	}
+
+	if (sharded)
+	{
+		lines_read = shard_end_load(collisions);
+	}
+
+	// Free pointers used.
+	free(buffer);
+
+	// Return the number of responses read.
+	return lines_read;
+}
+
+/*
+ * Reset the knowledge base, removing all know entitities from all intents,
+ * and every snapshot.
+ */
+void knowledge_reset()
+{
+	if (shard_count() > 0)
+	{
+		shard_reset();
+		return;
+	}
+
+	pthread_rwlock_wrlock(&kb_lock);
+
+	// Every version goes, so every node of the index (and with them every
+	// question) can go, as can the compacted block.
+	NODE *newest = nodes;
+	nodes = NULL;
+	char *old_compacted = compacted;
+	count_bytes(&garbage_bytes, compacted_bytes);
+	compacted = NULL;
+	compacted_bytes = 0;
+	changes++;
+	memset(&current, 0, sizeof(current));
+	generation = 0;
+	free(snapshots);
+	snapshots = NULL;
+	snapshot_count = 0;
+	snapshot_size = 0;
+	for (int i = 0; i < MAX_NO_OF_INTENT - 1; i++)
+	{
+		free(all_intents[i].order);
+		all_intents[i].order = NULL;
+		all_intents[i].order_size = 0;
+	}
+	intern_reset();
+	compress_reset();
+	pthread_rwlock_unlock(&kb_lock);
+
+	long bytes = index_free(newest, NULL);
+	count_bytes(&loose_bytes, -bytes);
+	count_bytes(&garbage_bytes, bytes);
+	free(old_compacted);
+}
+
+/*
+ * Count the questions in the knowledge base.
+ *
+ * Returns: the number of entity/response pairs known, across all intents
+ */
+int knowledge_count()
+{
+	if (shard_count() > 0)
+	{
+		return shard_questions();
+	}
+
+	pthread_rwlock_rdlock(&kb_lock);
+	int count = current.question_count;
+	pthread_rwlock_unlock(&kb_lock);
+	return count;
+}
+
+/*
+ * Name the current version of the knowledge base, so that knowledge_rollback()
+ * can go back to it. A snapshot with the same name (ignoring case) is replaced.
+ *
+ * Input:
+ *   name - the name of the snapshot
+ *
+ * Returns:
+ *   KB_OK, if successful
+ *   KB_NOMEM, if there was a memory allocation failure
+ *   KB_INVALID, if the name is empty or too long
+ */
+int knowledge_snapshot(const char *name)
+{
+	if (name[0] == '\0' || strlen(name) >= MAX_INPUT)
+	{
+		return KB_INVALID;
+	}
+
+	if (shard_count() > 0)
+	{
+		return shard_snapshot(name);
+	}
+
+	pthread_rwlock_wrlock(&kb_lock);
+	if (snapshot_count == snapshot_size)
+	{
+		int new_size = snapshot_size == 0 ? 8 : snapshot_size * 2;
+		SNAPSHOT *new_snapshots = (SNAPSHOT *)realloc(snapshots, new_size * sizeof(SNAPSHOT));
+		if (new_snapshots == NULL)
+		{
+			pthread_rwlock_unlock(&kb_lock);
+			return KB_NOMEM;
+		}
+		snapshots = new_snapshots;
+		snapshot_size = new_size;
+	}
+
+	// The nodes and questions the old snapshot kept are kept until the
+	// knowledge base is rolled back past it or reset.
+	int old = find_snapshot(name);
+	if (old >= 0)
+	{
+		memmove(&snapshots[old], &snapshots[old + 1], (snapshot_count - old - 1) * sizeof(SNAPSHOT));
+		snapshot_count--;
+	}
+
+	SNAPSHOT *snapshot = &snapshots[snapshot_count++];
+	strcpy(snapshot->name, name);
+	snapshot->version = current;
+	snapshot->generation = generation;
+	snapshot->nodes = nodes;
+
+	// From now on, whatever the snapshot has is copied before it is changed.
+	generation++;
+	changes++;
+	pthread_rwlock_unlock(&kb_lock);
+	return KB_OK;
+}
+
 /*
- * Get the response to a question.
+ * Go back to a version of the knowledge base named by knowledge_snapshot().
+ * Everything put since the snapshot was taken is forgotten, as are any
+ * snapshots taken since; the snapshot itself is kept, so it can be rolled back
+ * to again.
  *
  * Input:
- *   intent   - the question word
- *   entity   - the entity
- *   response - a buffer to receive the response
- *   n        - the maximum number of characters to write to the response buffer
+ *   name - the name of the snapshot
  *
  * Returns:
- *   KB_OK, if a response was found for the intent and entity (the response is copied to the response buffer)
- *   KB_NOTFOUND, if no response could be found
- *   KB_INVALID, if 'intent' is not a recognised question word
+ *   KB_OK, if successful
+ *   KB_NOTFOUND, if there is no snapshot with that name
  */
-int knowledge_get(const char *intent, const char *entity, char *response, int n)
+int knowledge_rollback(const char *name)
 {
-	// Create pointer to point to the current question. Must be not NULL.
-	QUESTION *current_question_ptr = create_question("", "");
-
-	// Search through all the intent in all_intents to get correct head_ptr
-	// for current_question_ptr.
-	for (int i = 0; i < MAX_NO_OF_INTENT - 1; i++)
+	if (shard_count() > 0)
 	{
-		// Check if intent match with intent in all_intent[i].
-		if (compare_token(intent, all_intents[i].intent) == 0)
-		{
-			// If head_ptr is NULL, it meant that no question is inside
-			// return KB_NOTFOUND.
-			if (all_intents[i].head_ptr == NULL)
-			{
-				return KB_NOTFOUND;
-			}
-			current_question_ptr = all_intents[i].head_ptr;
-			break;
-		}
+		return shard_rollback(name);
 	}
 
-	// Loop through link list of questions. Stop when response is found or
-	// the ->next is NULL, meaning end of link list.
-	while (1)
+	pthread_rwlock_wrlock(&kb_lock);
+	int i = find_snapshot(name);
+	if (i < 0)
 	{
-		// Response is found, return found and set response up.
-		if (compare_token(entity, current_question_ptr->entity) == 0)
-		{
-			strcpy(response, current_question_ptr->response);
-			return KB_OK;
-		}
-
-		// No more question left, return not found.
-		if (current_question_ptr->next == NULL)
-		{
-			return KB_NOTFOUND;
-		}
-		current_question_ptr = current_question_ptr->next;
+		pthread_rwlock_unlock(&kb_lock);
+		return KB_NOTFOUND;
 	}
 
-	// Free pointers used.
-	return KB_INVALID;
+	// Every node newer than the snapshot was made after it, and nothing the
+	// snapshot has was changed, so putting back its root is enough. The
+	// generation after the snapshot's starts again.
+	NODE *newest = nodes;
+	NODE *kept = snapshots[i].nodes;
+	index_release(newest, kept);
+	current = snapshots[i].version;
+	generation = snapshots[i].generation + 1;
+	nodes = kept;
+	snapshot_count = i + 1;
+	changes++;
+	pthread_rwlock_unlock(&kb_lock);
+
+	long bytes = index_free(newest, kept);
+	count_bytes(&loose_bytes, -bytes);
+	count_bytes(&garbage_bytes, bytes);
+	return KB_OK;
 }
 
 /*
- * Insert a new response to a question. If a response already exists for the
- * given intent and entity, it will be overwritten. Otherwise, it will be added
- * to the knowledge base.
+ * Move the questions and the index of the knowledge base into one new block of
+ * memory, and free the pieces they were in, giving as much of the heap back to
+ * the system as it can. The dictionary the responses are compressed with is
+ * built again from the responses alone, leaving out the words none of them
+ * uses any more, and so is the table of entities, leaving out the entities
+ * no question is about any more (see intern_rebuild()).
+ *
+ * The block is built while holding the knowledge base for reading, so lookups
+ * carry on meanwhile; it is then swapped in while holding it for writing,
+ * which takes no longer than swapping a few pointers. If the knowledge base
+ * was changed in between, the block is thrown away and nothing is done.
  *
  * Input:
- *   intent    - the question word
- *   entity    - the entity
- *   response  - the response for this question and entity
+ *   result - receives the sizes of the knowledge base before and after, and
+ *            the times taken (may be NULL)
  *
  * Returns:
- *   KB_FOUND, if successful
+ *   KB_OK, if successful
  *   KB_NOMEM, if there was a memory allocation failure
- *   KB_INVALID, if the intent is not a valid question word
+ *   KB_INVALID, if the knowledge base is sharded or has snapshots, or was
+ *   changed while the block was being built
  */
-int knowledge_put(const char *intent, const char *entity, const char *response)
+int knowledge_compact(COMPACTION *result)
 {
-	// Make sure that intent coming in is the same as intents in all_intents.
-	int valid_intent = 0;
-	for (int i = 0; i < MAX_NO_OF_INTENT - 1; i++)
+	COMPACTION stats;
+	struct timespec start, built, locked, end;
+
+	if (shard_count() > 0)
 	{
-		if (compare_token(intent, all_intents[i].intent) == 0)
-		{
-			valid_intent = 1;
-			break;
-		}
+		return KB_INVALID;
 	}
-	if (valid_intent == 0)
+
+	pthread_mutex_lock(&compact_lock);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_rwlock_rdlock(&kb_lock);
+	if (snapshot_count > 0)
 	{
+		pthread_rwlock_unlock(&kb_lock);
+		pthread_mutex_unlock(&compact_lock);
 		return KB_INVALID;
 	}
+	unsigned long seen = changes;
+	size_t size = 0;
+	int status = KB_OK;
+	if (current.root != NULL)
+		compact_copy(current.root, NULL, &size, &status);
+	if (status == KB_OK)
+		status = rebuild_entities();
+	char *block = size > 0 && status == KB_OK ? (char *)malloc(size) : NULL;
+	if (status != KB_OK || (size > 0 && block == NULL))
+	{
+		compress_rebuild_end(0);
+		intern_rebuild_end(0);
+		pthread_rwlock_unlock(&kb_lock);
+		pthread_mutex_unlock(&compact_lock);
+		return KB_NOMEM;
+	}
+	size_t used = 0;
+	NODE *root = block != NULL ? compact_copy(current.root, block, &used, &status) : NULL;
+	pthread_rwlock_unlock(&kb_lock);
+	clock_gettime(CLOCK_MONOTONIC, &built);
 
-	// Create pointer to point to the new question with entity and response.
-	QUESTION *new_question_ptr = create_question(entity, response);
+	pthread_rwlock_wrlock(&kb_lock);
+	clock_gettime(CLOCK_MONOTONIC, &locked);
+	if (changes != seen)
+	{
+		compress_rebuild_end(0);
+		intern_rebuild_end(0);
+		pthread_rwlock_unlock(&kb_lock);
+		pthread_mutex_unlock(&compact_lock);
+		free(block);
+		return KB_INVALID;
+	}
+	NODE *newest = nodes;
+	char *old_compacted = compacted;
+	stats.bytes_before = __atomic_load_n(&loose_bytes, __ATOMIC_RELAXED) + compacted_bytes +
+						 compress_dictionary_bytes() + intern_bytes();
+	current.root = root;
+	nodes = NULL;
+	compacted = block;
+	compacted_bytes = size;
+	compress_rebuild_end(1);
+	intern_rebuild_end(1);
+	stats.bytes_after = size + compress_dictionary_bytes() + intern_bytes();
+	__atomic_store_n(&garbage_bytes, 0, __ATOMIC_RELAXED);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	pthread_rwlock_unlock(&kb_lock);
+	pthread_mutex_unlock(&compact_lock);
 
-	// intent_index keeps the index of the correct intent from all_intents.
-	int intent_index = 999999;
+	// Nothing refers to the old pieces any more.
+	count_bytes(&loose_bytes, -index_free(newest, NULL));
+	free(old_compacted);
+#ifdef __GLIBC__
+	malloc_trim(0);
+#endif
 
-	// Loop through all_intent and find correct index of intent.
-	for (int i = 0; i < MAX_NO_OF_INTENT - 1; i++)
+	stats.build_ns = (built.tv_sec - start.tv_sec) * 1000000000L + (built.tv_nsec - start.tv_nsec);
+	stats.pause_ns = (end.tv_sec - locked.tv_sec) * 1000000000L + (end.tv_nsec - locked.tv_nsec);
+	if (result != NULL)
+		*result = stats;
+	return KB_OK;
+}
+
+/*
+ * Measure how much of the memory the knowledge base has used is garbage, i.e.
+ * has been freed (leaving holes in the heap) or is unused in the compacted
+ * block, since knowledge_compact() was last run, or is taken by words of the
+ * dictionary that no response uses.
+ *
+ * Input:
+ *   live - receives the number of bytes the questions, the index, the
+ *          entities and the dictionary take (may be NULL)
+ *
+ * Returns: the number of bytes of garbage
+ */
+long knowledge_garbage(long *live)
+{
+	pthread_rwlock_rdlock(&kb_lock);
+	if (live != NULL)
+		*live = __atomic_load_n(&loose_bytes, __ATOMIC_RELAXED) + compacted_bytes + compress_dictionary_bytes() +
+				intern_bytes();
+	long garbage = __atomic_load_n(&garbage_bytes, __ATOMIC_RELAXED) + compress_dead_bytes();
+	pthread_rwlock_unlock(&kb_lock);
+	return garbage;
+}
+
+/*
+ * Make room for more characters at the end of a section.
+ *
+ * Returns: KB_OK, or KB_NOMEM if the section could not grow
+ */
+static int section_reserve(SECTION *section, size_t more)
+{
+	if (section->length + more <= section->size)
+		return KB_OK;
+
+	size_t new_size = section->size == 0 ? 4096 : section->size;
+	while (section->length + more > new_size)
+		new_size *= 2;
+	char *new_text = (char *)realloc(section->text, new_size);
+	if (new_text == NULL)
+		return KB_NOMEM;
+	section->text = new_text;
+	section->size = new_size;
+	return KB_OK;
+}
+
+/*
+ * Format an intent's section of the knowledge base into section->text,
+ * exactly as knowledge_write() saves it. The caller must hold the knowledge
+ * base for reading; this may be run as a pool task on its behalf.
+ *
+ * Input:
+ *   arg - the SECTION; its intent must be set, and its status is set to KB_OK,
+ *         or to KB_NOMEM if the text could not hold the whole section
+ */
+static void format_section(void *arg)
+{
+	SECTION *section = (SECTION *)arg;
+	const char *name = all_intents[section->intent].intent;
+	size_t name_len = strlen(name);
+
+	section->status = section_reserve(section, name_len + 4);
+	if (section->status != KB_OK)
+		return;
+	section->text[section->length++] = '\n';
+	section->text[section->length++] = '[';
+	memcpy(section->text + section->length, name, name_len);
+	section->length += name_len;
+	section->text[section->length++] = ']';
+	section->text[section->length++] = '\n';
+
+	// Each question is a line in entity=response format.
+	const int *order = all_intents[section->intent].order;
+	for (int k = 0; k < current.counts[section->intent]; k++)
 	{
-		if (compare_token(all_intents[i].intent, intent) == 0)
-		{
-			intent_index = i;
-			break;
-		}
+		const QUESTION *question_ptr = index_find(section->intent, order[k]);
+		int entity_len;
+		const char *entity = intern_string(question_ptr->entity, &entity_len);
+		section->status = section_reserve(section, entity_len + question_ptr->response_len + 3);
+		if (section->status != KB_OK)
+			return;
+
+		memcpy(section->text + section->length, entity, entity_len);
+		section->length += entity_len;
+		section->text[section->length++] = '=';
+		copy_response(question_ptr, section->text + section->length, question_ptr->response_len + 1);
+		section->length += question_ptr->response_len;
+		section->text[section->length++] = '\n';
 	}
+}
 
-	// If intent is not found, return invalid.
-	if (intent_index == 999999)
+/*
+ * Set the number of threads knowledge_write() formats a large knowledge base
+ * with, stopping the ones it has already started.
+ *
+ * Input:
+ *   workers - the number of threads; 1 formats every section on the thread
+ *             saving, and 0 or less means one per core (the default), up to
+ *             one per intent
+ */
+void knowledge_write_workers(int workers)
+{
+	pthread_mutex_lock(&save_lock);
+	if (save_pool != NULL)
+		pool_destroy(save_pool);
+	save_pool = NULL;
+	save_workers = workers > 0 ? workers : 0;
+	pthread_mutex_unlock(&save_lock);
+}
+
+/*
+ * Write the knowledge base to a file.
+ *
+ * Each intent's section is formatted into a buffer of its own and the buffers
+ * are written in order. For a large knowledge base on a machine with several
+ * cores, the sections are formatted at the same time on a thread pool, while
+ * this thread holds the knowledge base for reading on the workers' behalf.
+ *
+ * Input:
+ *   f - the file
+ */
+void knowledge_write(FILE *f)
+{
+	if (shard_count() > 0)
 	{
-		// Free pointers used.
-		free(new_question_ptr);
-		return KB_INVALID;
+		shard_write(f);
+		return;
 	}
 
-	// Create pointer to point to the current question. Must be not NULL.
-	QUESTION *current_question_ptr = all_intents[intent_index].head_ptr;
+	SECTION sections[MAX_NO_OF_INTENT];
+	int count = 0;
 
-	// Loop through link list of question of correct intent.
-	while (1)
+	pthread_rwlock_rdlock(&kb_lock);
+
+	// Only intents with questions have a section.
+	for (int i = 0; i < MAX_NO_OF_INTENT - 1; i++)
 	{
-		// If current_question_ptr is NULL, it mean it is the last question
-		// hence add new_question as head and tail.
-		if (current_question_ptr == NULL)
+		if (current.counts[i] > 0)
 		{
-			all_intents[intent_index].head_ptr = new_question_ptr;
-			all_intents[intent_index].tail_ptr = new_question_ptr;
-			break;
+			memset(&sections[count], 0, sizeof(SECTION));
+			sections[count].intent = i;
+			count++;
 		}
+	}
 
-		// If entity of current_question is the same as new entity, rewrite.
-		else if (compare_token(current_question_ptr->entity, entity) == 0)
+	// The pool is started once and kept, so a save does not start and stop
+	// threads; saves made at the same time take turns with it.
+	POOL *pool = NULL;
+	if (current.question_count >= PARALLEL_SAVE_MIN && count > 1)
+	{
+		pthread_mutex_lock(&save_lock);
+		int workers = save_workers > 0 ? save_workers : pool_cores();
+		if (workers > MAX_NO_OF_INTENT - 1)
+			workers = MAX_NO_OF_INTENT - 1;
+		if (save_pool == NULL && workers > 1)
+			save_pool = pool_create(workers, 0);
+		pool = save_pool;
+		if (pool == NULL)
+			pthread_mutex_unlock(&save_lock);
+	}
+	if (pool != NULL)
+	{
+		for (int i = 0; i < count; i++)
 		{
-			strcpy(current_question_ptr->response, "");
-			strcpy(current_question_ptr->response, response);
-			current_question_ptr = NULL;
-			break;
+			if (pool_submit(pool, format_section, &sections[i]) != 0)
+				format_section(&sections[i]);
 		}
+		pool_wait(pool);
+		pthread_mutex_unlock(&save_lock);
+	}
 
-		else if (current_question_ptr->next != NULL)
-		{
-			current_question_ptr = current_question_ptr->next;
-		}
+	for (int i = 0; i < count; i++)
+	{
+		if (pool == NULL)
+			format_section(&sections[i]);
+
+		// If there was not enough memory for the whole section, write it a
+		// line at a time instead.
+		if (sections[i].status == KB_OK)
+			fwrite(sections[i].text, 1, sections[i].length, f);
 		else
-		{
-			(*current_question_ptr).next = new_question_ptr;
-			all_intents[intent_index].tail_ptr = new_question_ptr;
-			break;
-		}
+			write_section(f, sections[i].intent);
+		free(sections[i].text);
 	}
 
-	return KB_OK;
+	pthread_rwlock_unlock(&kb_lock);
 }
 
 /*
- * Read a knowledge base from a file.
+ * Write an intent's section of the knowledge base to a file a line at a time,
+ * for when there is not enough memory to format it all first. The caller must
+ * hold the knowledge base for reading.
  *
  * Input:
- *   f - the file
- *
- * Returns: the number of entity/response pairs successful read from the file
+ *   f      - the file
+ *   intent - the index of the intent in all_intents
  */
-int knowledge_read(FILE *f)
+static void write_section(FILE *f, int intent)
 {
-	char entity[MAX_ENTITY], response[MAX_RESPONSE];
-	int lines_read = 0;
+	char *buffer = NULL;
+	int size = 0;
 
-	// Create pointer to point to the buffer. Must be not NULL.
-	char *buffer = (char *)malloc(MAX_RESPONSE + MAX_ENTITY + 1);
-	if (buffer == NULL)
+	fprintf(f, "\n[%s]\n", all_intents[intent].intent);
+	for (int k = 0; k < current.counts[intent]; k++)
 	{
-		return KB_NOMEM;
+		const QUESTION *question_ptr = index_find(intent, all_intents[intent].order[k]);
+
+		// Make room to decompress the response.
+		if (question_ptr->response_len + 1 > size)
+		{
+			char *new_buffer = (char *)realloc(buffer, question_ptr->response_len + 1);
+			if (new_buffer == NULL)
+				break;
+			buffer = new_buffer;
+			size = question_ptr->response_len + 1;
+		}
+		copy_response(question_ptr, buffer, size);
+
+		int entity_len;
+		const char *entity = intern_string(question_ptr->entity, &entity_len);
+		fwrite(entity, 1, entity_len, f);
+		fputc('=', f);
+		fwrite(buffer, 1, question_ptr->response_len, f);
+		fputc('\n', f);
 	}
+	free(buffer);
+}
 
-	// Create pointer to point to the current intent. Must be not NULL.
-	char *current_intent = (char *)malloc(MAX_INTENT);
-	if (buffer == NULL)
+/*
+ * Write the knowledge base to a file as a stream of records, one per line:
+ *
+ *   intent<tab>entity<tab>response
+ *
+ * with any backslash, tab, carriage return or newline in the entity or
+ * response written as \\, \t, \r or \n. Questions are written one at a time
+ * straight from the knowledge base, so however big it is, this needs only
+ * enough memory for the longest response. The file is flushed every
+ * STREAM_CHUNK records, so a reader at the other end of a pipe gets them as
+ * they come.
+ *
+ * The knowledge base is held for reading throughout, so changes to it wait
+ * until the export is finished.
+ *
+ * Input:
+ *   f        - the file
+ *   progress - if not NULL, called with the number of records written so far
+ *              every STREAM_CHUNK records
+ *
+ * Returns: the number of records written, or KB_NOMEM if there was not enough
+ * memory to finish
+ */
+long knowledge_export(FILE *f, void (*progress)(long records))
+{
+	if (shard_count() > 0)
 	{
-		return KB_NOMEM;
+		return shard_export(f, progress);
 	}
-	strcpy(current_intent, "");
 
-	// Read lines of file until the end.
-	while (!feof(f))
-	{
-		// Clear buffer and populate it with line of file that is trimmed.
-		strcpy(buffer, "");
-		fgets(buffer, MAX_RESPONSE + MAX_ENTITY + 1, f);
-		trim(buffer);
+	char *buffer = NULL;
+	int size = 0;
+	long records = 0;
 
-		// If the start is '[' and end is ']', it is an intent.
-		if (buffer[0] == '[' && buffer[strlen(buffer) - 1] == ']')
+	pthread_rwlock_rdlock(&kb_lock);
+	for (int i = 0; i < MAX_NO_OF_INTENT - 1 && records >= 0; i++)
+	{
+		for (int k = 0; k < current.counts[i]; k++)
 		{
-			// Create pointer to point to the temp_intent. Must be not NULL.
-			char *temp_intent = (char *)malloc(strlen(buffer) - 2);
-			if (buffer == NULL)
-			{
-				return KB_NOMEM;
-			}
+			const QUESTION *question_ptr = index_find(i, all_intents[i].order[k]);
 
-			// Clean intent of '[' and ']'.
-			for (int i = 1; i < strlen(buffer) - 1; i++)
+			// Make room to decompress the response.
+			if (question_ptr->response_len + 1 > size)
 			{
-				temp_intent[i - 1] = buffer[i];
+				char *new_buffer = (char *)realloc(buffer, question_ptr->response_len + 1);
+				if (new_buffer == NULL)
+				{
+					records = KB_NOMEM;
+					break;
+				}
+				buffer = new_buffer;
+				size = question_ptr->response_len + 1;
 			}
+			copy_response(question_ptr, buffer, size);
 
-			// Put intent into current_intent.
-			strcpy(current_intent, temp_intent);
-		}
+			int entity_len;
+			const char *entity = intern_string(question_ptr->entity, &entity_len);
+			fprintf(f, "%s\t", all_intents[i].intent);
+			write_field(f, entity, entity_len);
+			fputc('\t', f);
+			write_field(f, buffer, question_ptr->response_len);
+			fputc('\n', f);
 
-		if (strcmp(current_intent, "") != 0)
-		{
-			// If buffer contain '=', it is a entity/response.
-			if (strstr(buffer, "="))
+			if (++records % STREAM_CHUNK == 0)
 			{
-				// Populate entity and response and put into knowledge.
-				strcpy(entity, strtok(buffer, "="));
-				strcpy(response, strtok(NULL, "="));
-				knowledge_put(current_intent, entity, response);
-
-				// Line read increment 1.
-				lines_read++;
+				fflush(f);
+				if (progress != NULL)
+					progress(records);
 			}
 		}
 	}
+	pthread_rwlock_unlock(&kb_lock);
 
-	// Free pointers used.
 	free(buffer);
-
-	// Close file.
-	fclose(f);
-
-	// Return the number of responses read.
-	return lines_read;
+	fflush(f);
+	return records;
 }
 
 /*
- * Reset the knowledge base, removing all know entitities from all intents.
+ * Read a stream of records, as written by knowledge_export(), into the
+ * knowledge base. Records are stored as they are read, so this needs only
+ * enough memory for the longest line. Lines that are not records, and records
+ * for intents that are not known, are skipped. The file is left open.
+ *
+ * Input:
+ *   f        - the file
+ *   progress - if not NULL, called with the number of records read so far
+ *              every STREAM_CHUNK records
+ *
+ * Returns: the number of records stored
  */
-void knowledge_reset()
+long knowledge_import(FILE *f, void (*progress)(long records))
 {
-	// Create pointer to point to the current question. Must be not NULL.
-	QUESTION *current_question_ptr;
-	if (current_question_ptr == NULL)
-	{
-		return;
-	}
+	char *buffer = NULL;
+	int size = 0;
+	int len;
+	long records = 0;
+	long stored = 0;
 
-	// Create pointer to point to the next question. Must be not NULL.
-	QUESTION *next_question_ptr;
-	if (next_question_ptr == NULL)
+	// When sharded, records are streamed to their shards, as in
+	// knowledge_read().
+	int sharded = shard_count() > 0;
+	if (sharded)
 	{
-		return;
+		shard_begin_load();
 	}
 
-	for (int i = 0; i < MAX_NO_OF_INTENT - 1; i++)
+	while ((len = read_line(f, &buffer, &size)) >= 0)
 	{
-		// Set head_ptr of intent as current question.
-		current_question_ptr = all_intents[i].head_ptr;
-		all_intents[i].head_ptr = NULL;
+		// A record never ends in a carriage return of its own (it would be
+		// written as \r), so one there came from the line ending.
+		if (len > 0 && buffer[len - 1] == '\r')
+			buffer[--len] = '\0';
 
-		// While current_question_ptr is not null, loop through to the next
-		// question.
-		while (current_question_ptr != NULL)
+		char *fields[3];
+		int lengths[3];
+		if (split_record(buffer, fields, lengths, 3) != 3 || lengths[1] == 0)
+			continue;
+		int intent = knowledge_intent(fields[0], lengths[0]);
+		if (intent < 0)
+			continue;
+
+		if (sharded)
+		{
+			shard_load_put(all_intents[intent].intent, fields[1], lengths[1], fields[2]);
+		}
+		else if (knowledge_put(all_intents[intent].intent, fields[1], lengths[1], fields[2]) == KB_OK)
 		{
-			// Set the next question.
-			next_question_ptr = current_question_ptr->next;
-			current_question_ptr->next = NULL;
-			// Free the current question.
-			free(current_question_ptr);
-			// Set the current question as the next question.
-			current_question_ptr = next_question_ptr;
+			stored++;
 		}
+
+		if (++records % STREAM_CHUNK == 0 && progress != NULL)
+			progress(records);
 	}
 
-	// Free pointers used.
-	free(current_question_ptr);
-	free(next_question_ptr);
+	if (sharded)
+	{
+		stored = shard_end_load(NULL);
+	}
+
+	free(buffer);
+	return stored;
 }
 
 /*
- * Write the knowledge base to a file.
+ * Write a field of a record, escaping the characters that would end it.
  *
  * Input:
- *   f - the file
+ *   f   - the file
+ *   s   - the field
+ *   len - the number of characters in the field
  */
-void knowledge_write(FILE *f)
+void write_field(FILE *f, const char *s, int len)
 {
-	for (int i = 0; i < MAX_NO_OF_INTENT - 1; i++)
+	int start = 0;
+
+	for (int i = 0; i < len; i++)
 	{
-		// If head_ptr and tail_ptr is not NULL, there is questions in intent.
-		// Loop through then.
-		if (all_intents[i].head_ptr != NULL && all_intents[i].tail_ptr != NULL)
+		char escape;
+		switch (s[i])
 		{
-			// Write to file [intent_name] as header for all questions to come.
-			fprintf(f, "\n[%s]\n", all_intents[i].intent);
+		case '\\':
+			escape = '\\';
+			break;
+		case '\t':
+			escape = 't';
+			break;
+		case '\r':
+			escape = 'r';
+			break;
+		case '\n':
+			escape = 'n';
+			break;
+		default:
+			continue;
+		}
+		fwrite(s + start, 1, i - start, f);
+		fputc('\\', f);
+		fputc(escape, f);
+		start = i + 1;
+	}
+	fwrite(s + start, 1, len - start, f);
+}
 
-			// Set current_question_ptr as head_ptr of intent.
-			QUESTION *current_question_ptr = all_intents[i].head_ptr;
+/*
+ * Split a record into its fields at the tabs, and undo the escapes in each,
+ * in place. Each field is null-terminated.
+ *
+ * Input:
+ *   line    - the record
+ *   fields  - an array of at least max pointers to receive the fields
+ *   lengths - an array of at least max ints to receive the length of each
+ *   max     - the number of fields expected
+ *
+ * Returns: the number of fields, or max + 1 if there are more than expected
+ */
+int split_record(char *line, char *fields[], int lengths[], int max)
+{
+	int count = 0;
+	char *in = line;
 
-			//While the next question exist in the link list, write to file in:
-			// entity=response format.
-			while (1)
+	while (count < max)
+	{
+		char *out = in;
+		fields[count] = out;
+		while (*in != '\0' && *in != '\t')
+		{
+			if (*in == '\\' && in[1] != '\0')
 			{
-				fprintf(f, "%s=", current_question_ptr->entity);
-				fprintf(f, "%s\n", current_question_ptr->response);
-
-				if (current_question_ptr->next == NULL)
-				{
-					break;
-				}
-				current_question_ptr = current_question_ptr->next;
+				in++;
+				*out++ = *in == 't' ? '\t' : *in == 'r' ? '\r' : *in == 'n' ? '\n' : *in;
+				in++;
+			}
+			else
+			{
+				*out++ = *in++;
 			}
 		}
+		char end = *in;
+		*out = '\0';
+		lengths[count] = out - fields[count];
+		count++;
+		if (end == '\0')
+			return count;
+		in++;
 	}
+
+	return max + 1;
 }
 
 /*
  * Create a question pointer and return it.
  *
+ * The response is stored in the same allocation as the question, so each
+ * question takes only as much memory as its response needs. The response is
+ * compressed (see compress.c) unless that would not make it smaller, and the
+ * question belongs to the current generation, so this must only be called
+ * while holding the knowledge base for writing.
+ *
  * Input:
- *   entity - entity of the question
+ *   entity - ID of the entity of the question (see intern.c)
  *   response - response of the question
  */
-QUESTION *create_question(const char *entity, const char *response)
+QUESTION *create_question(int entity, const char *response)
 {
-	// Create pointer to point to the question. Must be not NULL.
-	QUESTION *question_ptr = (QUESTION *)malloc(sizeof(QUESTION));
+	int response_len = strlen(response);
+
+	// Create pointer to point to the question, with room for the response as
+	// it is. Must be not NULL.
+	QUESTION *question_ptr = (QUESTION *)malloc(sizeof(QUESTION) + response_len + 1);
 	if (question_ptr == NULL)
 		return NULL;
 
+	// Compress the response into place, and give back the room it saved.
+	unsigned char *stored = (unsigned char *)question_ptr->response;
+	int stored_len = compress_response(response, response_len, stored);
+	if (stored_len >= 0)
+	{
+		QUESTION *smaller_ptr = (QUESTION *)realloc(question_ptr, sizeof(QUESTION) + stored_len);
+		if (smaller_ptr != NULL)
+			question_ptr = smaller_ptr;
+	}
+	else
+	{
+		memcpy(stored, response, response_len + 1);
+		stored_len = response_len;
+	}
+
 	// Set up the question.
-	question_ptr->next = NULL;
-	strcpy(question_ptr->entity, entity);
-	strcpy(question_ptr->response, response);
+	question_ptr->intent = -1;
+	question_ptr->generation = generation;
+	question_ptr->templated = template_has_slots(response, response_len);
+	question_ptr->entity = entity;
+	question_ptr->response_len = response_len;
+	question_ptr->stored_len = stored_len;
 
 	return question_ptr;
 }
 
 /*
- * Create a smalltalk pointer and return it.
+ * Copy the response of a question into a buffer, decompressing it if need be
+ * and truncating it if the buffer is too small.
  *
  * Input:
- *   topic - topic of the smalltalk
- *   response - response of the smalltalk
+ *   question_ptr - the question
+ *   response - a buffer to receive the response
+ *   n - the size of the response buffer
  */
-SMALLTALK *create_smalltalk(const char *topic, const char *response)
+void copy_response(const QUESTION *question_ptr, char *response, int n)
 {
-	// Create pointer to point to the smalltalk. Must be not NULL.
-	SMALLTALK *smalltalk_ptr = (SMALLTALK *)malloc(sizeof(SMALLTALK));
-	if (smalltalk_ptr == NULL)
-		return NULL;
+	if (n <= 0)
+		return;
+
+	if (question_ptr->stored_len < question_ptr->response_len)
+	{
+		decompress_response((const unsigned char *)question_ptr->response,
+							question_ptr->stored_len, response, n);
+		return;
+	}
+
+	int len = question_ptr->response_len < n - 1 ? question_ptr->response_len : n - 1;
+	memcpy(response, question_ptr->response, len);
+	response[len] = '\0';
+}
 
-	// Set up the smalltalk.
-	strcpy(smalltalk_ptr->topic, topic);
-	strcpy(smalltalk_ptr->response, response);
+/*
+ * Copy the response to a question into a buffer as copy_response() does,
+ * filling in its slots if it is a template. The caller must hold the knowledge
+ * base for reading.
+ *
+ * Input:
+ *   question_ptr - the question
+ *   response - a buffer to receive the response
+ *   n - the size of the response buffer
+ */
+static void render_response(const QUESTION *question_ptr, char *response, int n)
+{
+	if (!question_ptr->templated)
+	{
+		copy_response(question_ptr, response, n);
+		return;
+	}
+
+	// Templates are rare, so rather than keep every one compiled, one is
+	// compiled from its text when it is needed. The text is only put on the
+	// heap when it is too long for the stack buffer; if that fails, what fits
+	// in the stack buffer is rendered.
+	char stack_text[MAX_RESPONSE];
+	char *text = stack_text;
+	int text_size = sizeof(stack_text);
+	if (question_ptr->response_len >= text_size)
+	{
+		char *heap_text = (char *)malloc(question_ptr->response_len + 1);
+		if (heap_text != NULL)
+		{
+			text = heap_text;
+			text_size = question_ptr->response_len + 1;
+		}
+	}
+	TEMPLATE template;
+	SLOTS slots;
+	copy_response(question_ptr, text, text_size);
+	template_compile(text, strlen(text), &template);
 
-	return smalltalk_ptr;
+	memset(&slots, 0, sizeof(slots));
+	slots.value[SLOT_ENTITY] = intern_string(question_ptr->entity, &slots.length[SLOT_ENTITY]);
+	slots.value[SLOT_USER] = chatbot_username();
+	slots.length[SLOT_USER] = strlen(slots.value[SLOT_USER]);
+	slots.value[SLOT_BOT] = chatbot_botname();
+	slots.length[SLOT_BOT] = strlen(slots.value[SLOT_BOT]);
+	template_render(&template, &slots, response, n);
+	if (text != stack_text)
+		free(text);
 }
 
 /*
- * Init the 5W1H intents into all_intents.
+ * Read a line from a file into a buffer, growing the buffer if the line does
+ * not fit. The newline is removed.
+ *
+ * The buffer is meant to be reused for every line of a file: it only grows
+ * (by doubling) when a line longer than any before it is read.
+ *
+ * Input:
+ *   f - the file
+ *   buffer - pointer to the buffer, which may start as NULL
+ *   size - pointer to the size of the buffer
  *
+ * Returns:
+ *   the number of characters in the line, if a line was read
+ *   -1, at the end of the file
+ *   KB_NOMEM, if the buffer could not be grown
  */
-void init_knowledge()
+int read_line(FILE *f, char **buffer, int *size)
 {
-	strcpy(all_intents[0].intent, "who");
-	all_intents[0].head_ptr = NULL;
-	all_intents[0].tail_ptr = NULL;
-	strcpy(all_intents[1].intent, "what");
-	all_intents[1].head_ptr = NULL;
-	all_intents[1].tail_ptr = NULL;
-	strcpy(all_intents[2].intent, "when");
-	all_intents[2].head_ptr = NULL;
-	all_intents[2].tail_ptr = NULL;
-	strcpy(all_intents[3].intent, "where");
-	all_intents[3].head_ptr = NULL;
-	all_intents[3].tail_ptr = NULL;
-	strcpy(all_intents[4].intent, "why");
-	all_intents[4].head_ptr = NULL;
-	all_intents[4].tail_ptr = NULL;
-	strcpy(all_intents[5].intent, "how");
-	all_intents[5].head_ptr = NULL;
-	all_intents[5].tail_ptr = NULL;
+	int len = 0;
+
+	while (1)
+	{
+		// Make room for at least one more character and the null.
+		if (*size - len < 2)
+		{
+			int new_size = *size < 128 ? 128 : *size * 2;
+			char *new_buffer = (char *)realloc(*buffer, new_size);
+			if (new_buffer == NULL)
+				return KB_NOMEM;
+			*buffer = new_buffer;
+			*size = new_size;
+		}
+
+		if (fgets(*buffer + len, *size - len, f) == NULL)
+			break;
+
+		len += strlen(*buffer + len);
+		if (len > 0 && (*buffer)[len - 1] == '\n')
+		{
+			(*buffer)[--len] = '\0';
+			return len;
+		}
+	}
+
+	// The last line of a file may not end in a newline.
+	(*buffer)[len] = '\0';
+	return len > 0 ? len : -1;
 }
 
 char *ltrim(char *s)
@@ -415,9 +1943,9 @@ char *ltrim(char *s)
 char *rtrim(char *s)
 {
 	char *back = s + strlen(s);
-	while (isspace(*--back))
-		;
-	*(back + 1) = '\0';
+	while (back > s && isspace(*(back - 1)))
+		back--;
+	*back = '\0';
 	return s;
 }
 
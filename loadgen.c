@@ -0,0 +1,578 @@
+/*
+ * ICT1002 (C Language) Group Project.
+ *
+ * This file implements a load generator that replays recorded conversations
+ * against the chatbot and reports how fast it answered and how much memory it
+ * used while doing so.
+ *
+ * Usage: chatbot_loadgen [options] <session file>...
+ *
+ *   -c <n>       number of conversations to run at once (default 1)
+ *   -r <n>       target requests per second, across all conversations
+ *                (default: as fast as possible)
+ *   -d <secs>    keep replaying for this many seconds (default: replay every
+ *                session once per conversation)
+ *   -i <secs>    print progress this often (default 1)
+ *   -s <path>    talk to chatbot_server on this socket instead of calling
+ *                chatbot_main() in this process
+ *   -p <pid>     with -s, report the memory of this process (the server)
+ *   -k <n>       without -s, shard the knowledge base across n processes
+ *   -g <secs>    without -s or -k, run the compactor (see compact.c), looking
+ *                at the knowledge base this often, and report what it did
+ *   -a <n>       without -s, put requests through the scheduler (see sched.c)
+ *                with n admin workers
+ *   -l <n>       without -s, let each conversation make no more than n
+ *                requests per second, through the scheduler
+ *
+ * A session file holds what a user typed, one line per input, exactly as it
+ * would be typed into the chatbot (LOAD, questions, smalltalk, SAVE, RESET...).
+ * A blank line ends one session and starts the next. When the chatbot asks
+ * for an answer it does not know, the next line of the session is the answer.
+ *
+ * When a rate is given, each request is timed from when it should have been
+ * sent, so a slow response also counts against the requests queued behind it.
+ * Latencies go into a fixed-size histogram (accurate to within about 2%), so
+ * the load generator's own memory stays flat however long it runs. The
+ * latencies of questions are also reported by themselves, since those are
+ * what heavy requests such as LOAD and SAVE should not hold up.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "chat1002.h"
+
+/* a recorded conversation */
+typedef struct session
+{
+	char **lines;
+	int count;
+} SESSION;
+
+/* latencies are counted in buckets of 64 steps per power of two of nanoseconds */
+#define HISTOGRAM_STEPS 64
+#define HISTOGRAM_BUCKETS (36 * HISTOGRAM_STEPS)
+
+/* one simulated user */
+typedef struct client
+{
+	int id;
+	pthread_t thread;
+	long histogram[HISTOGRAM_BUCKETS];  /* number of requests by latency */
+	long questions[HISTOGRAM_BUCKETS];  /* number of questions by latency */
+	long requests;             /* read by the progress reporter as it goes */
+	int done;                  /* set when the client has nothing left to replay */
+} CLIENT;
+
+static SESSION *sessions = NULL;
+static int session_count = 0;
+static int concurrency = 1;
+static double rate = 0;
+static double duration = 0;
+static double interval = 1;
+static const char *socket_path = NULL;
+static int monitor_pid = 0;
+static int shards = 0;
+static double compact_every = 0;
+static int admin_workers = 0;
+static double limit = 0;
+static double start_time;
+static int finished = 0;  /* set when the time is up */
+
+/* the session the current thread is replaying and how far it has got, so
+ * that prompt_user() can take its answer from the next line */
+static __thread SESSION *current_session = NULL;
+static __thread int current_line = 0;
+
+/*
+ * Find out whether the main thread has said that the time is up.
+ */
+static int time_is_up()
+{
+	return __atomic_load_n(&finished, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Get the time in seconds.
+ */
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Get the resident memory of a process, in kilobytes.
+ *
+ * Input:
+ *   pid - the process, or 0 for this one
+ */
+static long rss_kb(int pid)
+{
+	char path[64];
+	long pages = 0, resident = 0;
+
+	if (pid == 0)
+		snprintf(path, sizeof(path), "/proc/self/statm");
+	else
+		snprintf(path, sizeof(path), "/proc/%d/statm", pid);
+
+	FILE *f = fopen(path, "r");
+	if (f == NULL)
+		return 0;
+	if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+		resident = 0;
+	fclose(f);
+
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/*
+ * Answer the chatbot's question with the next line of the session being
+ * replayed.
+ *
+ * Returns: as read_line()
+ */
+int prompt_user(char **buf, int *size, const char *format, ...)
+{
+	if (current_session == NULL || current_line + 1 >= current_session->count)
+		return -1;
+
+	const char *answer = current_session->lines[++current_line];
+	int len = strlen(answer);
+	if (*size < len + 1)
+	{
+		char *new_buf = (char *)realloc(*buf, len + 1);
+		if (new_buf == NULL)
+			return KB_NOMEM;
+		*buf = new_buf;
+		*size = len + 1;
+	}
+	memcpy(*buf, answer, len + 1);
+	return len;
+}
+
+/*
+ * Read the sessions from a file and add them to the list.
+ *
+ * Returns: 0, or -1 if the file could not be read or there was not enough
+ * memory for it (errno says which)
+ */
+static int read_sessions(const char *filename)
+{
+	FILE *f = fopen(filename, "r");
+	if (f == NULL)
+		return -1;
+
+	char *line = NULL;
+	int size = 0;
+	int len;
+	SESSION *session = NULL;
+	int status = 0;
+
+	while (status == 0 && (len = read_line(f, &line, &size)) >= 0)
+	{
+		if (len > 0 && line[len - 1] == '\r')
+			line[--len] = '\0';
+
+		// A blank line ends the session.
+		if (len == 0)
+		{
+			session = NULL;
+			continue;
+		}
+
+		if (session == NULL)
+		{
+			SESSION *new_sessions = (SESSION *)realloc(sessions, (session_count + 1) * sizeof(SESSION));
+			if (new_sessions == NULL)
+			{
+				status = -1;
+				break;
+			}
+			sessions = new_sessions;
+			session = &sessions[session_count++];
+			session->lines = NULL;
+			session->count = 0;
+		}
+		char **new_lines = (char **)realloc(session->lines, (session->count + 1) * sizeof(char *));
+		char *copy = new_lines != NULL ? strdup(line) : NULL;
+		if (new_lines != NULL)
+			session->lines = new_lines;
+		if (copy == NULL)
+		{
+			status = -1;
+			break;
+		}
+		session->lines[session->count++] = copy;
+	}
+	if (len == KB_NOMEM)
+		status = -1;
+
+	free(line);
+	fclose(f);
+	return status;
+}
+
+/*
+ * Find the histogram bucket for a latency.
+ */
+static int bucket_of(unsigned long ns)
+{
+	if (ns < HISTOGRAM_STEPS)
+		return ns;
+
+	int e = 63 - __builtin_clzl(ns);
+	int bucket = (e - 5) * HISTOGRAM_STEPS + ((ns >> (e - 6)) & (HISTOGRAM_STEPS - 1));
+	return bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1;
+}
+
+/*
+ * Get the smallest latency that falls in a histogram bucket.
+ */
+static unsigned long bucket_value(int bucket)
+{
+	if (bucket < HISTOGRAM_STEPS)
+		return bucket;
+
+	int e = bucket / HISTOGRAM_STEPS + 5;
+	return (unsigned long)(HISTOGRAM_STEPS + bucket % HISTOGRAM_STEPS) << (e - 6);
+}
+
+/*
+ * Record the latency of one request.
+ *
+ * Input:
+ *   client  - the client that made it
+ *   seconds - its latency
+ *   kind    - what kind of request it was, as sched_classify()
+ */
+static void record(CLIENT *client, double seconds, int kind)
+{
+	int bucket = bucket_of((unsigned long)(seconds * 1e9));
+	client->histogram[bucket]++;
+	if (kind == REQUEST_QUESTION)
+		client->questions[bucket]++;
+	__atomic_store_n(&client->requests, client->requests + 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Wait until the time a request is due, if there is a target rate.
+ *
+ * Returns: the time the request was due (or now, without a rate)
+ */
+static double wait_turn(long sent)
+{
+	if (rate <= 0)
+		return now();
+
+	double due = start_time + sent / (rate / concurrency);
+	double wait = due - now();
+	if (wait > 0)
+	{
+		struct timespec ts;
+		ts.tv_sec = (time_t)wait;
+		ts.tv_nsec = (long)((wait - ts.tv_sec) * 1e9);
+		nanosleep(&ts, NULL);
+	}
+	return due;
+}
+
+/*
+ * Replay sessions by calling chatbot_main() directly.
+ */
+static void *run_in_process(void *arg)
+{
+	CLIENT *client = (CLIENT *)arg;
+	TOKEN *inv = NULL;
+	int max_inc = 0;
+	char *output = NULL;  /* grown by chatbot_reply(), as the server's is */
+	int output_size = 0;
+	long sent = 0;
+	int failed = 0;
+
+	for (int s = client->id; !failed && !time_is_up(); s++)
+	{
+		if (duration <= 0 && s >= client->id + session_count)
+			break;
+
+		// Every replay is a conversation of its own.
+		current_session = &sessions[s % session_count];
+		session_open((unsigned long)s * concurrency + client->id);
+		for (current_line = 0; current_line < current_session->count && !time_is_up(); current_line++)
+		{
+			const char *line = current_session->lines[current_line];
+			int len = strlen(line);
+			if (len / 2 + 1 > max_inc)
+			{
+				TOKEN *new_inv = (TOKEN *)realloc(inv, (len / 2 + 1) * sizeof(TOKEN));
+				if (new_inv == NULL)
+				{
+					failed = 1;
+					break;
+				}
+				inv = new_inv;
+				max_inc = len / 2 + 1;
+			}
+
+			double due = wait_turn(sent++);
+			int inc = tokenize(line, inv, max_inc);
+			if (inc > 0 && chatbot_reply(line, inc, inv, &output, &output_size, sched_main) == KB_NOMEM)
+			{
+				failed = 1;
+				break;
+			}
+			record(client, now() - due, sched_classify(line, inc, inv));
+		}
+		session_close();
+	}
+	if (failed)
+		fprintf(stderr, "chatbot_loadgen: client %d ran out of memory and stopped\n", client->id);
+
+	free(inv);
+	free(output);
+	__atomic_store_n(&client->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/*
+ * Replay sessions over a connection to chatbot_server, one connection per
+ * session.
+ */
+static void *run_over_socket(void *arg)
+{
+	CLIENT *client = (CLIENT *)arg;
+	char *reply = NULL;
+	int size = 0;
+	long sent = 0;
+	TOKEN inv[8];
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+
+	for (int s = client->id; !time_is_up(); s++)
+	{
+		if (duration <= 0 && s >= client->id + session_count)
+			break;
+
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+		{
+			perror(socket_path);
+			if (fd >= 0)
+				close(fd);
+			break;
+		}
+		FILE *in = fdopen(fd, "r");
+		FILE *out = fdopen(dup(fd), "w");
+
+		// Every line gets exactly one line back, whether it is a response or
+		// a prompt for the answer on the next line.
+		SESSION *session = &sessions[s % session_count];
+		for (int i = 0; i < session->count && !time_is_up(); i++)
+		{
+			double due = wait_turn(sent++);
+			fprintf(out, "%s\n", session->lines[i]);
+			fflush(out);
+			if (read_line(in, &reply, &size) < 0)
+				break;
+			const char *line = session->lines[i];
+			record(client, now() - due, sched_classify(line, tokenize(line, inv, 8), inv));
+		}
+
+		fclose(in);
+		fclose(out);
+	}
+
+	free(reply);
+	__atomic_store_n(&client->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/*
+ * Get a percentile of the latencies in a histogram, in microseconds.
+ */
+static double percentile(const long *histogram, long count, double p)
+{
+	long seen = 0;
+	long target = (long)(p * count);
+	for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		seen += histogram[i];
+		if (seen > target || (seen == count && seen > 0))
+			return bucket_value(i) / 1000.0;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "c:r:d:i:s:p:k:g:a:l:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'c':
+			concurrency = atoi(optarg);
+			break;
+		case 'r':
+			rate = atof(optarg);
+			break;
+		case 'd':
+			duration = atof(optarg);
+			break;
+		case 'i':
+			interval = atof(optarg);
+			break;
+		case 's':
+			socket_path = optarg;
+			break;
+		case 'p':
+			monitor_pid = atoi(optarg);
+			break;
+		case 'k':
+			shards = atoi(optarg);
+			break;
+		case 'g':
+			compact_every = atof(optarg);
+			break;
+		case 'a':
+			admin_workers = atoi(optarg);
+			break;
+		case 'l':
+			limit = atof(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-c clients] [-r rate] [-d seconds] [-i seconds] [-s socket [-p pid] | -k shards | -g seconds] [-a admin workers] [-l rate] <session file>...\n", argv[0]);
+			return 1;
+		}
+	}
+	if (concurrency < 1 || interval <= 0)
+	{
+		fprintf(stderr, "%s: -c must be at least 1 and -i more than 0\n", argv[0]);
+		return 1;
+	}
+
+	for (int i = optind; i < argc; i++)
+	{
+		if (read_sessions(argv[i]) != 0)
+		{
+			perror(argv[i]);
+			return 1;
+		}
+	}
+	if (session_count == 0)
+	{
+		fprintf(stderr, "%s: no sessions to replay\n", argv[0]);
+		return 1;
+	}
+
+	if (shards > 0 && socket_path == NULL && shard_start(shards) != 0)
+	{
+		fprintf(stderr, "%s: could not start %d shards\n", argv[0], shards);
+		return 1;
+	}
+	if (compact_every > 0 && (socket_path != NULL || compact_start(compact_every, NULL) != 0))
+	{
+		fprintf(stderr, "%s: -g needs the knowledge base in this process, unsharded\n", argv[0]);
+		return 1;
+	}
+	if ((admin_workers > 0 || limit > 0) &&
+		(socket_path != NULL || sched_start(admin_workers > 0 ? admin_workers : 1, limit) != 0))
+	{
+		fprintf(stderr, "%s: -a and -l need the chatbot in this process\n", argv[0]);
+		return 1;
+	}
+
+	int pid = socket_path != NULL ? monitor_pid : 0;
+	long rss_start = rss_kb(pid);
+	CLIENT *clients = (CLIENT *)calloc(concurrency, sizeof(CLIENT));
+	start_time = now();
+	for (int i = 0; i < concurrency; i++)
+	{
+		clients[i].id = i;
+		pthread_create(&clients[i].thread, NULL,
+					   socket_path != NULL ? run_over_socket : run_in_process, &clients[i]);
+	}
+
+	// Report progress until the time is up or every client has finished.
+	printf("%8s %10s %10s %10s\n", "time(s)", "requests", "req/s", "rss(kB)");
+	long last_requests = 0;
+	double last_time = start_time;
+	int running = concurrency;
+	while (running > 0)
+	{
+		usleep((useconds_t)(interval * 1e6 / 10));
+		double t = now();
+		if (duration > 0 && t - start_time >= duration)
+			__atomic_store_n(&finished, 1, __ATOMIC_RELEASE);
+
+		running = 0;
+		for (int i = 0; i < concurrency; i++)
+			running += !__atomic_load_n(&clients[i].done, __ATOMIC_ACQUIRE);
+		if (t - last_time >= interval || running == 0)
+		{
+			long requests = 0;
+			for (int i = 0; i < concurrency; i++)
+				requests += __atomic_load_n(&clients[i].requests, __ATOMIC_RELAXED);
+			printf("%8.1f %10ld %10.0f %10ld\n", t - start_time, requests,
+				   (requests - last_requests) / (t - last_time), rss_kb(pid));
+			fflush(stdout);
+			last_requests = requests;
+			last_time = t;
+		}
+	}
+	for (int i = 0; i < concurrency; i++)
+		pthread_join(clients[i].thread, NULL);
+	compact_stop();
+	sched_stop();
+	double elapsed = now() - start_time;
+	long rss_end = rss_kb(pid);
+
+	// Add up every client's latencies to get the percentiles.
+	static long all[HISTOGRAM_BUCKETS];
+	static long questions[HISTOGRAM_BUCKETS];
+	long total = 0;
+	long question_total = 0;
+	for (int i = 0; i < concurrency; i++)
+	{
+		for (int b = 0; b < HISTOGRAM_BUCKETS; b++)
+		{
+			all[b] += clients[i].histogram[b];
+			questions[b] += clients[i].questions[b];
+			question_total += clients[i].questions[b];
+		}
+		total += clients[i].requests;
+	}
+
+	printf("\nrequests:   %ld in %.2f s (%.0f req/s)\n", total, elapsed, total / elapsed);
+	printf("latency:    p50 %.1f us, p99 %.1f us, p999 %.1f us, max %.1f us\n",
+		   percentile(all, total, 0.5), percentile(all, total, 0.99),
+		   percentile(all, total, 0.999), percentile(all, total, 1.0));
+	printf("questions:  p50 %.1f us, p99 %.1f us, p999 %.1f us, max %.1f us (%ld)\n",
+		   percentile(questions, question_total, 0.5), percentile(questions, question_total, 0.99),
+		   percentile(questions, question_total, 0.999), percentile(questions, question_total, 1.0),
+		   question_total);
+	printf("memory:     %ld kB at start, %ld kB at end (%+ld kB)\n",
+		   rss_start, rss_end, rss_end - rss_start);
+	if (compact_every > 0)
+	{
+		COMPACT_STATS stats;
+		compact_stats(&stats);
+		printf("compaction: %ld runs (%ld skipped), %ld kB reclaimed, pause avg %.1f us, max %.1f us\n",
+			   stats.runs, stats.skipped, stats.bytes_reclaimed / 1024,
+			   stats.runs > 0 ? stats.pause_ns / 1e3 / stats.runs : 0.0, stats.max_pause_ns / 1e3);
+	}
+
+	free(clients);
+	return 0;
+}
@@ -1,7 +1,21 @@
 /*
  * ICT1002 (C Language) Group Project.
  *
- * This file implements the main loop, including dividing input into words.
+ * This file implements the main loop. Input is divided into words by
+ * tokenize(), in tokenizer.c.
+ *
+ * Usage: chatbot [-k <shards>] [-s <synonyms file>] [-c <command>]...
+ *
+ *   -k <shards>   shard the knowledge base across this many processes
+ *   -s <file>     look entities up using the synonyms in the file (see
+ *                 normalize.c)
+ *   -c <command>  run the command as if it had been typed, instead of chatting;
+ *                 may be given more than once, and the commands are run in
+ *                 order. The chatbot's answers go to the standard error, so
+ *                 that e.g. "export to -" can be piped into another program:
+ *
+ *                   chatbot -c "load from kb.ini" -c "export to -" |
+ *                       chatbot -c "import from -" -c "save to kb.ini"
  *
  * You should not need to modify this file. You may invoke its functions if you like, however.
  */
@@ -14,8 +28,29 @@
 #include "chat1002.h"
 
 
-/* word delimiters */
-const char *delimiters = " ?\t\n";
+/*
+ * Run a command given with -c.
+ *
+ * Returns: what chatbot_main() returned, or -1 if there was not enough memory
+ */
+static int run_command(const char *command) {
+
+	char *output = NULL;
+	int size = 0;
+	int max_inc = strlen(command) / 2 + 1;
+	TOKEN *inv = (TOKEN *)malloc(max_inc * sizeof(TOKEN));
+	if (inv == NULL)
+		return -1;
+
+	int inc = tokenize(command, inv, max_inc);
+	int done = chatbot_reply(command, inc, inv, &output, &size, chatbot_main);
+	if (done >= 0)
+		fprintf(stderr, "%s: %s\n", chatbot_botname(), output);
+
+	free(output);
+	free(inv);
+	return done < 0 ? -1 : done;
+}
 
 
 /*
@@ -23,17 +58,62 @@ const char *delimiters = " ?\t\n";
  */
 int main(int argc, char *argv[]) {
 
-	char input[MAX_INPUT];      /* buffer for holding the user input */
+	char *input = NULL;         /* buffer for holding the user input; grows to fit the longest line */
+	int size = 0;               /* the size of the input buffer */
 	int inc;                    /* the number of words in the user input */
-	char *inv[MAX_INPUT];       /* pointers to the beginning of each word of input */
-	char output[MAX_RESPONSE];  /* the chatbot's output */
-	int len;                    /* length of a word */
+	TOKEN *inv = NULL;          /* the position of each word in the user input */
+	int max_inc = 0;            /* the number of words inv has room for */
+	char *output = NULL;        /* the chatbot's output; grows to fit the longest response */
+	int output_size = 0;        /* the size of the output buffer */
+	int len;                    /* length of the line */
 	int done = 0;               /* set to 1 to end the main loop */
+	int commands = 0;           /* the number of commands given with -c */
+	const char *shards = NULL;  /* the number of shards given with -k */
+	const char *synonyms = NULL; /* the synonyms file given with -s */
+
+	/* read the options */
+	for (int i = 1; i < argc; i += 2) {
+		if (i + 1 == argc || (strcmp(argv[i], "-k") != 0 && strcmp(argv[i], "-s") != 0 && strcmp(argv[i], "-c") != 0)) {
+			fprintf(stderr, "Usage: %s [-k <shards>] [-s <synonyms file>] [-c <command>]...\n", argv[0]);
+			return 1;
+		}
+		if (strcmp(argv[i], "-c") == 0)
+			commands++;
+		else if (strcmp(argv[i], "-k") == 0)
+			shards = argv[i + 1];
+		else
+			synonyms = argv[i + 1];
+	}
 
-	/* initialise the chatbot */
-	inv[0] = "reset";
-	inv[1] = NULL;
-	/* chatbot_do_reset(1, inv, output, MAX_RESPONSE); */
+	/* read the synonyms, before the shards are started so that they have them too */
+	if (synonyms != NULL) {
+		FILE *f = fopen(synonyms, "r");
+		int count = f != NULL ? normalize_load(f) : KB_NOTFOUND;
+		if (f != NULL)
+			fclose(f);
+		if (count < 0) {
+			fprintf(stderr, "%s: could not read synonyms from %s\n", argv[0], synonyms);
+			return 1;
+		}
+	}
+
+	/* shard the knowledge base across processes if asked to */
+	if (shards != NULL && shard_start(atoi(shards)) != 0) {
+		fprintf(stderr, "%s: could not start %s shards\n", argv[0], shards);
+		return 1;
+	}
+
+	/* remember the conversation so that pronouns can be followed up */
+	session_open(0);
+
+	/* run the commands given with -c, if any, instead of chatting */
+	if (commands > 0) {
+		for (int i = 1; i < argc && !done; i += 2) {
+			if (strcmp(argv[i], "-c") == 0)
+				done = run_command(argv[i + 1]);
+		}
+		return done < 0 ? 1 : 0;
+	}
 
 	/* print a welcome message */
 	printf("%s: Hello, I'm %s.\n", chatbot_botname(), chatbot_botname());
@@ -42,65 +122,42 @@ int main(int argc, char *argv[]) {
 	do {
 
 		do {
-			/* read the line */
+			/* read the line; stop at the end of input */
 			printf("%s: ", chatbot_username());
-			fgets(input, MAX_INPUT, stdin);
-			/* split it into words */
-			inc = 0;
-			inv[inc] = strtok(input, delimiters);
-			while (inv[inc] != NULL) {
-
-				/* remove trailing punctuation */
-				len = strlen(inv[inc]);
-				while (len > 0 && ispunct(inv[inc][len - 1])) {
-					inv[inc][len - 1] = '\0';
-					len--;
-				}
-
-				/* go to the next word */
-				inc++;
-				inv[inc] = strtok(NULL, delimiters);
+			len = read_line(stdin, &input, &size);
+			if (len < 0) {
+				printf("\n");
+				free(input);
+				free(inv);
+				free(output);
+				return 0;
 			}
+
+			/* make sure there is room for every word (each takes at least two characters) */
+			if (len / 2 + 1 > max_inc) {
+				max_inc = len / 2 + 1;
+				inv = (TOKEN *)realloc(inv, max_inc * sizeof(TOKEN));
+				if (inv == NULL)
+					return 1;
+			}
+
+			/* split it into words */
+			inc = tokenize(input, inv, max_inc);
 		} while (inc < 1);
 
 		/* invoke the chatbot */
-		done = chatbot_main(inc, inv, output, MAX_RESPONSE);
+		done = chatbot_reply(input, inc, inv, &output, &output_size, chatbot_main);
+		if (done < 0)
+			return 1;
 		printf("%s: %s\n", chatbot_botname(), output);
 
 	} while (!done);
 
-	return 0;
-}
-
-
-/*
- * Utility function for comparing string case-insensitively.
- *
- * Input:
- *   token1 - the first token
- *   token2 - the second token
- *
- * Returns:
- *   as strcmp()
- */
-int compare_token(const char *token1, const char *token2) {
-
-	int i = 0;
-	while (token1[i] != '\0' && token2[i] != '\0') {
-		if (toupper(token1[i]) < toupper(token2[i]))
-			return -1;
-		else if (toupper(token1[i]) > toupper(token2[i]))
-			return 1;
-		i++;
-	}
-
-	if (token1[i] == '\0' && token2[i] == '\0')
-		return 0;
-	else if (token1[i] == '\0')
-		return -1;
-	else
-		return 1;
+	free(input);
+	free(inv);
+	free(output);
 
+	return 0;
 }
 
 
@@ -108,12 +165,15 @@ int compare_token(const char *token1, const char *token2) {
  * Prompt the user.
  *
  * Input:
- *   buf    - a buffer into which to store the answer
- *   n      - the maximum number of characters to write to the buffer
+ *   buf    - pointer to a buffer into which to store the answer, which may
+ *            start as NULL and grows to fit it, as for read_line()
+ *   size   - pointer to the size of the buffer
  *   format - format string, as printf
  *   ...    - as printf
+ *
+ * Returns: as read_line()
  */
-void prompt_user(char *buf, int n, const char *format, ...) {
+int prompt_user(char **buf, int *size, const char *format, ...) {
 
 	/* print the prompt */
 	va_list args;
@@ -125,8 +185,5 @@ void prompt_user(char *buf, int n, const char *format, ...) {
 	printf("\n%s: ", chatbot_username());
 
 	/* get the response from the user */
-	fgets(buf, n, stdin);
-	char *nl = strchr(buf, '\n');
-	if (nl != NULL)
-		*nl = '\0';
+	return read_line(stdin, buf, size);
 }
@@ -0,0 +1,300 @@
+/*
+ * ICT1002 (C Language) Group Project.
+ *
+ * This file implements a program that runs every command the chatbot knows,
+ * counting every allocation it makes, and fails if a command allocates more
+ * than its budget or memory is left behind once the knowledge base is reset.
+ *
+ * Usage:
+ *   gcc -rdynamic -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free -o memprof \
+ *       memprof.c tokenizer.c chatbot.c knowledge.c pool.c shard.c compress.c \
+ *       intern.c vocab.c session.c template.c normalize.c
+ *   ./memprof [knowledge file] [rounds]
+ *
+ * The linker sends every call to malloc(), calloc(), realloc() and free() in
+ * the chatbot through the __wrap_ functions here, which keep a header in front
+ * of each block recording its size and the call site that allocated it. (Only
+ * the chatbot's own calls are counted; allocations made inside the C library,
+ * e.g. by fopen(), are not.)
+ *
+ * The script below is run the given number of times (default 3), each round
+ * starting from an empty knowledge base and ending with RESET. Each step has a
+ * budget of allocations; lookups must not allocate at all, nor may anything
+ * else with a budget of none hold on to more memory than it had. Every round must
+ * end with the same number of bytes live as the first one did (the first round
+ * may allocate things that last, such as the conversation's session).
+ *
+ * Afterwards, the call sites are listed with the number of allocations each
+ * made, the bytes allocated and the bytes still live. Each site is shown as an
+ * offset into the program that can be given to addr2line, and the nearest
+ * exported symbol if there is one.
+ *
+ * Exit status: 0 if every step kept to its budget and nothing leaked;
+ * otherwise 1.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chat1002.h"
+
+/* a step without a budget */
+#define UNLIMITED -1
+
+/* the most call sites that can be told apart */
+#define MAX_SITES 512
+
+/* the name of the file the script saves to and loads from */
+#define SAVED_FILE "memprof_saved.ini"
+
+/* a line of the script */
+typedef struct step
+{
+	const char *line;
+	int budget;  /* the most allocations the line may make, or UNLIMITED */
+} STEP;
+
+/* a place in the chatbot that allocates memory */
+typedef struct site
+{
+	void *address;
+	long calls;
+	long bytes;
+	long live;
+} SITE;
+
+/* the header in front of every block */
+typedef struct header
+{
+	size_t size;
+	int site;
+	int pad;  /* keeps the block that follows 16-byte aligned */
+} HEADER;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *p, size_t size);
+void __real_free(void *p);
+
+static const STEP script[] = {
+	{"load from %s", UNLIMITED},
+	{"what is SIT?", 0},
+	{"where is it", 0},
+	{"who is Frank Guan", 0},
+	{"who is he", 0},
+	{"tell me about the ICT Cluster", 0},
+	{"hello, how is the weather", 0},
+	{"who is Nobody In Particular", 8},
+	{"who is Nobody In Particular", 0},
+	{"where is ICT2101", 8},
+	{"snapshot taught", 1},
+	{"who is Somebody Else", 8},
+	{"rollback to taught", 0},
+	{"save to " SAVED_FILE, 8},
+	{"reset", 0},
+	{"load from " SAVED_FILE, UNLIMITED},
+	{"what is ICT1002", 0},
+	{"reset", 0},
+	{"reset", 0}};
+
+#define STEP_COUNT (int)(sizeof(script) / sizeof(script[0]))
+
+static SITE sites[MAX_SITES];
+static int site_count = 0;
+static long total_calls = 0;
+static long total_live = 0;
+
+/*
+ * Find the counters for a call site, adding them if it is new.
+ */
+static int site_of(void *address)
+{
+	for (int i = 0; i < site_count; i++)
+	{
+		if (sites[i].address == address)
+			return i;
+	}
+	if (site_count == MAX_SITES)
+		return MAX_SITES - 1;
+	sites[site_count].address = address;
+	return site_count++;
+}
+
+/*
+ * Count an allocation and fill in the header of its block.
+ *
+ * Returns: the memory the caller gets, just after the header
+ */
+static void *track(HEADER *header, size_t size, void *address)
+{
+	if (header == NULL)
+		return NULL;
+
+	header->size = size;
+	header->site = site_of(address);
+	sites[header->site].calls++;
+	sites[header->site].bytes += size;
+	sites[header->site].live += size;
+	total_calls++;
+	total_live += size;
+	return header + 1;
+}
+
+/*
+ * Stop counting a block that is being freed or moved.
+ */
+static void untrack(HEADER *header)
+{
+	sites[header->site].live -= header->size;
+	total_live -= header->size;
+}
+
+void *__wrap_malloc(size_t size)
+{
+	return track((HEADER *)__real_malloc(sizeof(HEADER) + size), size, __builtin_return_address(0));
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+	if (size != 0 && count > ((size_t)-1 - sizeof(HEADER)) / size)
+		return NULL;
+	return track((HEADER *)__real_calloc(1, sizeof(HEADER) + count * size), count * size,
+				 __builtin_return_address(0));
+}
+
+void *__wrap_realloc(void *p, size_t size)
+{
+	if (p == NULL)
+		return track((HEADER *)__real_malloc(sizeof(HEADER) + size), size, __builtin_return_address(0));
+
+	HEADER *header = (HEADER *)p - 1;
+	HEADER old = *header;
+	HEADER *new_header = (HEADER *)__real_realloc(header, sizeof(HEADER) + size);
+	if (new_header == NULL)
+		return NULL;
+
+	// The block is counted again as a new allocation at this site.
+	sites[old.site].live -= old.size;
+	total_live -= old.size;
+	return track(new_header, size, __builtin_return_address(0));
+}
+
+void __wrap_free(void *p)
+{
+	if (p == NULL)
+		return;
+	HEADER *header = (HEADER *)p - 1;
+	untrack(header);
+	__real_free(header);
+}
+
+/*
+ * Answer the chatbot's questions.
+ */
+int prompt_user(char **buf, int *size, const char *format, ...)
+{
+	const char *answer = "Somebody taught me this.";
+	int len = strlen(answer);
+	if (*size < len + 1)
+	{
+		char *new_buf = (char *)realloc(*buf, len + 1);
+		if (new_buf == NULL)
+			return KB_NOMEM;
+		*buf = new_buf;
+		*size = len + 1;
+	}
+	memcpy(*buf, answer, len + 1);
+	return len;
+}
+
+/*
+ * Print the call sites, busiest first.
+ */
+static void print_sites()
+{
+	int order[MAX_SITES];
+	for (int i = 0; i < site_count; i++)
+		order[i] = i;
+	for (int i = 1; i < site_count; i++)
+	{
+		for (int j = i; j > 0 && sites[order[j]].calls > sites[order[j - 1]].calls; j--)
+		{
+			int t = order[j];
+			order[j] = order[j - 1];
+			order[j - 1] = t;
+		}
+	}
+
+	printf("\n%10s %10s %12s %10s  %s\n", "site", "calls", "bytes", "live", "symbol");
+	for (int i = 0; i < site_count; i++)
+	{
+		const SITE *site = &sites[order[i]];
+		Dl_info info;
+		long offset = (long)site->address;
+		const char *symbol = "?";
+		if (dladdr(site->address, &info) != 0)
+		{
+			offset = (char *)site->address - (char *)info.dli_fbase;
+			if (info.dli_sname != NULL)
+				symbol = info.dli_sname;
+		}
+		printf("%#10lx %10ld %12ld %10ld  %s\n", offset, site->calls, site->bytes, site->live, symbol);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	const char *kb_file = argc > 1 ? argv[1] : "sample.ini";
+	int rounds = argc > 2 ? atoi(argv[2]) : 3;
+	char line[256];
+	char output[MAX_RESPONSE];
+	TOKEN inv[128];
+	int failed = 0;
+	long first_round_live = 0;
+
+	session_open(0);
+
+	for (int round = 1; round <= rounds; round++)
+	{
+		printf("round %d\n", round);
+		for (int i = 0; i < STEP_COUNT; i++)
+		{
+			snprintf(line, sizeof(line), script[i].line, kb_file);
+
+			long calls = total_calls;
+			long live = total_live;
+			int inc = tokenize(line, inv, 128);
+			chatbot_main(line, inc, inv, output, MAX_RESPONSE);
+			calls = total_calls - calls;
+			live = total_live - live;
+
+			// A step with a budget of nothing must not hold on to anything
+			// either.
+			int over = (script[i].budget != UNLIMITED && calls > script[i].budget) ||
+					   (script[i].budget == 0 && live > 0);
+			printf("  %-40s %6ld allocations %+9ld bytes live%s\n", line, calls, live,
+				   over ? "  OVER BUDGET" : "");
+			failed |= over;
+		}
+
+		if (round == 1)
+		{
+			first_round_live = total_live;
+		}
+		else if (total_live != first_round_live)
+		{
+			printf("  %ld bytes live after round %d, but %ld after round 1  LEAK\n",
+				   total_live, round, first_round_live);
+			failed = 1;
+		}
+	}
+
+	session_close();
+	remove(SAVED_FILE);
+	print_sites();
+
+	printf("\n%s\n", failed ? "FAILED" : "OK");
+	return failed;
+}
@@ -0,0 +1,489 @@
+/*
+ * ICT1002 (C Language) Group Project.
+ *
+ * This file implements normalizing entities, so that different ways of writing
+ * the same entity ("ICT 1002", "ict1002", "ICT1002s") are looked up under the
+ * same key, while different entities ("C", "C++", "C#") are not.
+ *
+ * normalize_key() works out the key of an entity.
+ * normalize_free() lets go of a key.
+ * normalize_same() tells whether two spellings differ in more than case,
+ * spacing and punctuation.
+ * normalize_load() reads a table of synonyms.
+ * normalize_reset() forgets the synonyms.
+ *
+ * The key of an entity is made by:
+ *
+ *   1. splitting it into words: runs of letters and digits, with everything
+ *      else (spaces, punctuation) between them dropped, except that:
+ *        - '+' and '#' after the start of a word are part of it ("C++",
+ *          "C#");
+ *        - '.' and '-' between two characters of a word are part of it
+ *          ("node.js", "e-mail", "1.5"), but not at its end ("C." is "C");
+ *        - an apostrophe inside a word is simply left out ("SIT's" is
+ *          "SITs");
+ *   2. lower-casing each word, and stemming it by taking off a plural ending
+ *      ("-ies" becomes "-y", "-sses" becomes "-ss", and a final "-s" is taken
+ *      off unless the word ends in "-ss", "-us" or "-is"); a word with any of
+ *      '+', '#', '.' or '-' in it is not stemmed;
+ *   3. replacing each word that is a synonym by its canonical form;
+ *   4. joining the words together with nothing between them, and replacing
+ *      the result with its canonical form if the whole of it is a synonym.
+ *
+ * An entity with no letters or digits at all is its own key, lower-cased.
+ *
+ * The synonyms are read from a file by normalize_load(), normally once when
+ * the chatbot starts. Each line of the file is a canonical form followed by
+ * its synonyms, separated by '=' and commas:
+ *
+ *   university = uni, varsity
+ *   SIT = Singapore Institute of Technology, Singapore Tech
+ *
+ * Blank lines and lines starting with '#' are ignored. Each form is itself
+ * normalized (without synonyms) before it goes in the table, which is an
+ * open-addressed hash table that is only read once it is loaded.
+ *
+ * Entities are normalized on every lookup, so each character is classified
+ * and lower-cased with a single look-up in word_chars rather than calls to
+ * isalnum() and tolower(), and a word is only looked for in the synonyms if
+ * there are any.
+ *
+ * The knowledge base stores questions under their keys, so the table of
+ * synonyms must not change while there is anything in the knowledge base, nor
+ * while other threads may be looking things up.
+ */
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chat1002.h"
+
+/* the longest word that is stemmed and looked up in the synonyms; longer
+   words are only lower-cased */
+#define MAX_WORD 64
+
+/* what normalize() does besides splitting and lower-casing */
+#define NORMALIZE_STEM 1      /* take plural endings off words */
+#define NORMALIZE_SYNONYMS 2  /* replace synonyms by their canonical forms */
+
+/* a synonym and the canonical form it stands for */
+typedef struct synonym
+{
+	unsigned long hash;  /* hash_token() of the synonym; 0 if the slot is empty */
+	int offset;          /* offset of the synonym in synonym_text */
+	int length;
+	int canonical;       /* offset of the canonical form in synonym_text */
+	int canonical_length;
+} SYNONYM;
+
+static char *synonym_text = NULL;  /* every synonym and canonical form, one after another */
+static int text_length = 0;
+static int text_size = 0;
+static SYNONYM *synonyms = NULL;   /* hash table of synonyms */
+static int synonym_count = 0;
+static int slot_count = 0;         /* always a power of two */
+
+/* each character lower-cased if it is part of a word (a letter, a digit, or
+   any byte of a multi-byte character), or 0 if it is not; filled in the first
+   time an entity is normalized */
+static unsigned char word_chars[256];
+static pthread_once_t word_chars_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Fill in word_chars.
+ */
+static void fill_word_chars()
+{
+	for (int c = 1; c < 256; c++)
+		word_chars[c] = isalnum(c) || c >= 0x80 ? tolower(c) : 0;
+}
+
+/*
+ * Find the canonical form of a synonym.
+ *
+ * Input:
+ *   s   - the synonym, normalized
+ *   len - the number of characters in it
+ *   canonical_len - receives the number of characters in the canonical form
+ *
+ * Returns: the canonical form, or NULL if s is not a synonym
+ */
+static const char *find_synonym(const char *s, int len, int *canonical_len)
+{
+	unsigned long hash = hash_token(s, len) | 1;
+	for (int i = hash & (slot_count - 1); synonyms[i].hash != 0; i = (i + 1) & (slot_count - 1))
+	{
+		if (synonyms[i].hash == hash && synonyms[i].length == len &&
+			memcmp(synonym_text + synonyms[i].offset, s, len) == 0)
+		{
+			*canonical_len = synonyms[i].canonical_length;
+			return synonym_text + synonyms[i].canonical;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Take the plural ending off a lower-case word, in place.
+ *
+ * Returns: the number of characters left in the word
+ */
+static int stem(char *word, int len)
+{
+	if (len > 4 && strncmp(word + len - 3, "ies", 3) == 0)
+	{
+		word[len - 3] = 'y';
+		return len - 2;
+	}
+	if (len > 4 && strncmp(word + len - 4, "sses", 4) == 0)
+		return len - 2;
+	if (len > 3 && word[len - 1] == 's' && word[len - 2] != 's' && word[len - 2] != 'u' && word[len - 2] != 'i')
+		return len - 1;
+	return len;
+}
+
+/*
+ * Normalize an entity into a buffer. Only the characters that fit are
+ * written, but the whole length of the key is worked out regardless, so a
+ * caller whose buffer was too small can try again with one that is big
+ * enough.
+ *
+ * Input:
+ *   entity   - the entity (need not be null-terminated)
+ *   len      - the number of characters in the entity
+ *   flags    - NORMALIZE_STEM and NORMALIZE_SYNONYMS, or'ed together
+ *   key      - a buffer to receive the key (not null-terminated)
+ *   n        - the size of the buffer
+ *
+ * Returns: the number of characters in the key
+ */
+static int normalize(const char *entity, int len, int flags, char *key, int n)
+{
+	int use_synonyms = flags & NORMALIZE_SYNONYMS;
+	const unsigned char *e = (const unsigned char *)entity;
+	char word[MAX_WORD];
+	int key_len = 0;
+	int i = 0;
+
+	pthread_once(&word_chars_once, fill_word_chars);
+	while (i < len)
+	{
+		// Skip to the start of the next word.
+		while (i < len && word_chars[e[i]] == 0)
+			i++;
+		if (i == len)
+			break;
+
+		// Lower-case the word, keeping the marks that are part of it and
+		// leaving out apostrophes inside it. Words too long for the word
+		// buffer are copied straight to the key as they are lower-cased.
+		int word_len = 0;
+		int long_word = 0;
+		int marked = 0;
+		for (; i < len; i++)
+		{
+			char c = word_chars[e[i]];
+			if (c == 0)
+			{
+				int inside = i + 1 < len && word_chars[e[i + 1]] != 0;
+				if (e[i] == '\'' && inside)
+					continue;
+				if (e[i] != '+' && e[i] != '#' && !((e[i] == '.' || e[i] == '-') && inside))
+					break;
+				c = e[i];
+				marked = 1;
+			}
+			if (!long_word && word_len == MAX_WORD)
+			{
+				// The word turned out to be long; move what there is of it to
+				// the key.
+				for (int j = 0; j < word_len; j++, key_len++)
+				{
+					if (key_len < n)
+						key[key_len] = word[j];
+				}
+				long_word = 1;
+			}
+			if (long_word)
+			{
+				if (key_len < n)
+					key[key_len] = c;
+				key_len++;
+			}
+			else
+			{
+				word[word_len++] = c;
+			}
+		}
+		if (long_word)
+			continue;
+
+		if ((flags & NORMALIZE_STEM) && !marked)
+			word_len = stem(word, word_len);
+		const char *s = word;
+		int s_len = word_len;
+		if (use_synonyms && synonym_count > 0)
+		{
+			int canonical_len;
+			const char *canonical = find_synonym(word, word_len, &canonical_len);
+			if (canonical != NULL)
+			{
+				s = canonical;
+				s_len = canonical_len;
+			}
+		}
+		for (int j = 0; j < s_len; j++, key_len++)
+		{
+			if (key_len < n)
+				key[key_len] = s[j];
+		}
+	}
+
+	// An entity that is all punctuation is its own key.
+	if (key_len == 0)
+	{
+		for (; key_len < len; key_len++)
+		{
+			if (key_len < n)
+				key[key_len] = tolower((unsigned char)entity[key_len]);
+		}
+	}
+
+	// The whole key may be a synonym (e.g. a phrase), if it was all worked
+	// out.
+	if (use_synonyms && synonym_count > 0 && key_len <= n)
+	{
+		int canonical_len;
+		const char *canonical = find_synonym(key, key_len, &canonical_len);
+		if (canonical != NULL)
+		{
+			if (canonical_len <= n)
+				memcpy(key, canonical, canonical_len);
+			key_len = canonical_len;
+		}
+	}
+
+	return key_len;
+}
+
+/*
+ * Work out the key of an entity.
+ *
+ * The key is normally kept in the KEY itself; only a key too long for that
+ * is allocated, in which case normalize_free() must be called when it is no
+ * longer needed.
+ *
+ * Input:
+ *   key    - receives the key
+ *   entity - the entity (need not be null-terminated)
+ *   len    - the number of characters in the entity
+ *
+ * Returns: KB_OK, or KB_NOMEM if there was not enough memory
+ */
+int normalize_key(KEY *key, const char *entity, int len)
+{
+	int size = MAX_KEY;
+	key->text = key->space;
+	while ((key->length = normalize(entity, len, NORMALIZE_STEM | NORMALIZE_SYNONYMS, key->text, size)) > size)
+	{
+		// Try again with room for the whole key.
+		size = key->length;
+		normalize_free(key);
+		key->text = (char *)malloc(size);
+		if (key->text == NULL)
+		{
+			key->text = key->space;
+			return KB_NOMEM;
+		}
+	}
+	key->hash = hash_token(key->text, key->length);
+	return KB_OK;
+}
+
+/*
+ * Let go of a key made by normalize_key().
+ */
+void normalize_free(KEY *key)
+{
+	if (key->text != key->space)
+		free(key->text);
+	key->text = key->space;
+}
+
+/*
+ * Determine whether two spellings of an entity are the same but for case,
+ * spacing and punctuation, i.e. have the same key without stemming or
+ * synonyms. Spellings that are not the same but still have the same key
+ * differ only in a plural ending or by a synonym ("Universities" and
+ * "University", "uni" and "university").
+ *
+ * Input:
+ *   a, a_len - one spelling and the number of characters in it
+ *   b, b_len - the other spelling and the number of characters in it
+ *
+ * Returns: 1 if they are the same (or they could not be compared for want of
+ * memory), 0 if they are not
+ */
+int normalize_same(const char *a, int a_len, const char *b, int b_len)
+{
+	char a_space[MAX_KEY], b_space[MAX_KEY];
+	int a_key_len = normalize(a, a_len, 0, a_space, MAX_KEY);
+	int b_key_len = normalize(b, b_len, 0, b_space, MAX_KEY);
+	if (a_key_len != b_key_len)
+		return 0;
+	if (a_key_len <= MAX_KEY)
+		return memcmp(a_space, b_space, a_key_len) == 0;
+
+	// The keys are too long for the buffers; work them out again in full.
+	char *keys = (char *)malloc(2 * (size_t)a_key_len);
+	if (keys == NULL)
+		return 1;
+	normalize(a, a_len, 0, keys, a_key_len);
+	normalize(b, b_len, 0, keys + a_key_len, a_key_len);
+	int same = memcmp(keys, keys + a_key_len, a_key_len) == 0;
+	free(keys);
+	return same;
+}
+
+/*
+ * Add a form of a synonym to the end of synonym_text, normalized (without
+ * synonyms).
+ *
+ * Returns: the number of characters added, or KB_NOMEM if there was not
+ * enough memory
+ */
+static int add_text(const char *s, int len)
+{
+	int key_len = normalize(s, len, NORMALIZE_STEM, NULL, 0);
+	if (text_length + key_len > text_size)
+	{
+		int new_size = text_size == 0 ? 1024 : text_size;
+		while (text_length + key_len > new_size)
+			new_size *= 2;
+		char *new_text = (char *)realloc(synonym_text, new_size);
+		if (new_text == NULL)
+			return KB_NOMEM;
+		synonym_text = new_text;
+		text_size = new_size;
+	}
+	normalize(s, len, NORMALIZE_STEM, synonym_text + text_length, key_len);
+	text_length += key_len;
+	return key_len;
+}
+
+/*
+ * Add a synonym to the hash table, growing it if need be. A synonym that is
+ * already there keeps its first canonical form.
+ *
+ * Returns: KB_OK, or KB_NOMEM if there was not enough memory
+ */
+static int add_synonym(int offset, int length, int canonical, int canonical_length)
+{
+	if (synonym_count + 1 > slot_count / 2)
+	{
+		int new_count = slot_count == 0 ? 64 : slot_count * 2;
+		SYNONYM *new_synonyms = (SYNONYM *)calloc(new_count, sizeof(SYNONYM));
+		if (new_synonyms == NULL)
+			return KB_NOMEM;
+		for (int i = 0; i < slot_count; i++)
+		{
+			if (synonyms[i].hash == 0)
+				continue;
+			int s = synonyms[i].hash & (new_count - 1);
+			while (new_synonyms[s].hash != 0)
+				s = (s + 1) & (new_count - 1);
+			new_synonyms[s] = synonyms[i];
+		}
+		free(synonyms);
+		synonyms = new_synonyms;
+		slot_count = new_count;
+	}
+
+	unsigned long hash = hash_token(synonym_text + offset, length) | 1;
+	int s = hash & (slot_count - 1);
+	for (; synonyms[s].hash != 0; s = (s + 1) & (slot_count - 1))
+	{
+		if (synonyms[s].hash == hash && synonyms[s].length == length &&
+			memcmp(synonym_text + synonyms[s].offset, synonym_text + offset, length) == 0)
+			return KB_OK;
+	}
+	synonyms[s].hash = hash;
+	synonyms[s].offset = offset;
+	synonyms[s].length = length;
+	synonyms[s].canonical = canonical;
+	synonyms[s].canonical_length = canonical_length;
+	synonym_count++;
+	return KB_OK;
+}
+
+/*
+ * Read a table of synonyms from a file, adding them to any already read. The
+ * file is left open.
+ *
+ * Input:
+ *   f - the file
+ *
+ * Returns: the number of synonyms read, or KB_NOMEM if there was not enough
+ * memory
+ */
+int normalize_load(FILE *f)
+{
+	char *buffer = NULL;
+	int size = 0;
+	int len;
+	int count = 0;
+
+	while ((len = read_line(f, &buffer, &size)) >= 0)
+	{
+		char *line = trim(buffer);
+		char *equals = strchr(line, '=');
+		if (line[0] == '#' || equals == NULL)
+			continue;
+
+		int canonical = text_length;
+		int canonical_length = add_text(line, equals - line);
+		if (canonical_length < 0)
+		{
+			count = KB_NOMEM;
+			break;
+		}
+		if (canonical_length == 0)
+			continue;
+
+		// Each synonym runs up to the next comma.
+		for (char *s = equals + 1; *s != '\0';)
+		{
+			char *comma = strchr(s, ',');
+			int s_len = comma != NULL ? comma - s : (int)strlen(s);
+			int offset = text_length;
+			int length = add_text(s, s_len);
+			if (length < 0 || (length > 0 && add_synonym(offset, length, canonical, canonical_length) != KB_OK))
+			{
+				count = KB_NOMEM;
+				break;
+			}
+			if (length > 0)
+				count++;
+			s += comma != NULL ? s_len + 1 : s_len;
+		}
+		if (count < 0)
+			break;
+	}
+
+	free(buffer);
+	return count;
+}
+
+/*
+ * Forget every synonym. Only do this when the knowledge base is empty.
+ */
+void normalize_reset()
+{
+	free(synonym_text);
+	free(synonyms);
+	synonym_text = NULL;
+	synonyms = NULL;
+	text_length = text_size = 0;
+	synonym_count = slot_count = 0;
+}
@@ -0,0 +1,364 @@
+/*
+ * ICT1002 (C Language) Group Project.
+ *
+ * This file implements a work-stealing thread pool for running chatbot
+ * requests and knowledge base tasks in parallel.
+ *
+ * pool_create() starts the worker threads.
+ * pool_submit() adds a task to the pool.
+ * pool_wait() waits for every task submitted so far to finish.
+ * pool_destroy() stops the worker threads.
+ *
+ * Every worker has its own deque of tasks. A worker takes tasks from the back
+ * of its own deque (so the task it submitted most recently, whose data is
+ * most likely still in its cache, runs first) and, when it runs out, steals
+ * from the front of the other workers' deques. Tasks submitted from outside
+ * the pool are dealt out to the workers in turn; tasks submitted by a task go
+ * to the deque of the worker running it.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+#include "chat1002.h"
+
+/* a task waiting to run */
+typedef struct task
+{
+	void (*fn)(void *arg);
+	void *arg;
+} TASK;
+
+/* the tasks waiting for one worker, in a ring buffer that grows as needed */
+typedef struct deque
+{
+	pthread_mutex_t lock;
+	TASK *tasks;
+	int size;   /* number of slots in tasks; always a power of two */
+	int front;  /* index of the first task */
+	int count;  /* number of tasks */
+} DEQUE;
+
+/* a worker thread */
+typedef struct worker
+{
+	POOL *pool;
+	int id;
+	pthread_t thread;
+	DEQUE deque;
+} WORKER;
+
+struct pool
+{
+	WORKER *workers;
+	int worker_count;
+	int next_worker;         /* the worker that gets the next task submitted from outside */
+	pthread_mutex_t lock;    /* protects everything below */
+	pthread_cond_t work;     /* signalled when a task is submitted */
+	pthread_cond_t idle;     /* signalled when the last pending task finishes */
+	int pending;             /* number of tasks submitted but not yet finished */
+	int queued;              /* number of tasks waiting in deques */
+	int stopping;            /* set by pool_destroy() */
+};
+
+/* the worker the current thread is, if it is one */
+static __thread WORKER *current_worker = NULL;
+
+/*
+ * Add a task to the back of a deque.
+ *
+ * Returns: 0, or KB_NOMEM if the deque could not grow
+ */
+static int deque_push(DEQUE *deque, TASK task)
+{
+	pthread_mutex_lock(&deque->lock);
+	if (deque->count == deque->size)
+	{
+		// Grow the ring, unrolling it so the front is at index 0.
+		int new_size = deque->size == 0 ? 64 : deque->size * 2;
+		TASK *new_tasks = (TASK *)malloc(new_size * sizeof(TASK));
+		if (new_tasks == NULL)
+		{
+			pthread_mutex_unlock(&deque->lock);
+			return KB_NOMEM;
+		}
+		for (int i = 0; i < deque->count; i++)
+			new_tasks[i] = deque->tasks[(deque->front + i) & (deque->size - 1)];
+		free(deque->tasks);
+		deque->tasks = new_tasks;
+		deque->size = new_size;
+		deque->front = 0;
+	}
+	deque->tasks[(deque->front + deque->count) & (deque->size - 1)] = task;
+	deque->count++;
+	pthread_mutex_unlock(&deque->lock);
+	return 0;
+}
+
+/*
+ * Take a task from a deque: from the back if the worker owns it, or from the
+ * front if it is stealing.
+ *
+ * Returns: 1, if a task was taken; 0, if the deque was empty
+ */
+static int deque_take(DEQUE *deque, int steal, TASK *task)
+{
+	int taken = 0;
+	pthread_mutex_lock(&deque->lock);
+	if (deque->count > 0)
+	{
+		if (steal)
+		{
+			*task = deque->tasks[deque->front];
+			deque->front = (deque->front + 1) & (deque->size - 1);
+		}
+		else
+		{
+			*task = deque->tasks[(deque->front + deque->count - 1) & (deque->size - 1)];
+		}
+		deque->count--;
+		taken = 1;
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return taken;
+}
+
+/*
+ * Find the next task for a worker, stealing one if its own deque is empty.
+ *
+ * Returns: 1, if a task was found; 0, otherwise
+ */
+static int worker_find_task(WORKER *worker, TASK *task)
+{
+	POOL *pool = worker->pool;
+
+	if (deque_take(&worker->deque, 0, task))
+		return 1;
+
+	// Start with the next worker along so that thieves spread out.
+	for (int i = 1; i < pool->worker_count; i++)
+	{
+		WORKER *victim = &pool->workers[(worker->id + i) % pool->worker_count];
+		if (deque_take(&victim->deque, 1, task))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * The main loop of a worker thread.
+ */
+static void *worker_main(void *arg)
+{
+	WORKER *worker = (WORKER *)arg;
+	POOL *pool = worker->pool;
+	TASK task;
+
+	current_worker = worker;
+	while (1)
+	{
+		// Wait until there is something to do, then claim one of the queued
+		// tasks. Every claim is matched by a task in some deque, so the
+		// search below always ends up finding one.
+		pthread_mutex_lock(&pool->lock);
+		while (pool->queued == 0 && !pool->stopping)
+			pthread_cond_wait(&pool->work, &pool->lock);
+		if (pool->queued == 0 && pool->stopping)
+		{
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		pool->queued--;
+		pthread_mutex_unlock(&pool->lock);
+
+		while (!worker_find_task(worker, &task))
+			;
+
+		task.fn(task.arg);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->pending == 0)
+			pthread_cond_broadcast(&pool->idle);
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	return NULL;
+}
+
+/*
+ * Create a thread pool.
+ *
+ * Input:
+ *   workers - the number of worker threads; 0 or less means one per core
+ *   pin     - if non-zero, worker i is pinned to the i-th of the cores the
+ *             process may run on, going round them again if there are more
+ *             workers than cores (on Linux)
+ *
+ * Returns: the pool, or NULL if it could not be created
+ */
+POOL *pool_create(int workers, int pin)
+{
+	if (workers <= 0)
+		workers = pool_cores();
+
+	POOL *pool = (POOL *)calloc(1, sizeof(POOL));
+	if (pool == NULL)
+		return NULL;
+	pool->workers = (WORKER *)calloc(workers, sizeof(WORKER));
+	if (pool->workers == NULL)
+	{
+		free(pool);
+		return NULL;
+	}
+	pool->worker_count = workers;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->idle, NULL);
+
+	for (int i = 0; i < workers; i++)
+	{
+		pool->workers[i].pool = pool;
+		pool->workers[i].id = i;
+		pthread_mutex_init(&pool->workers[i].deque.lock, NULL);
+	}
+
+#ifdef __linux__
+	cpu_set_t allowed;
+	int allowed_count = 0;
+	if (pin && sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+		allowed_count = CPU_COUNT(&allowed);
+#endif
+
+	for (int i = 0; i < workers; i++)
+	{
+		if (pthread_create(&pool->workers[i].thread, NULL, worker_main, &pool->workers[i]) != 0)
+		{
+			// Stop the workers already started, as if there had only been them.
+			for (int j = i; j < workers; j++)
+				pthread_mutex_destroy(&pool->workers[j].deque.lock);
+			pool->worker_count = i;
+			pool_destroy(pool);
+			return NULL;
+		}
+#ifdef __linux__
+		if (allowed_count > 0)
+		{
+			// Find the (i mod allowed_count)-th CPU in the mask.
+			int nth = i % allowed_count;
+			int cpu = 0;
+			while (!CPU_ISSET(cpu, &allowed) || nth-- > 0)
+				cpu++;
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(cpu, &set);
+			pthread_setaffinity_np(pool->workers[i].thread, sizeof(set), &set);
+		}
+#endif
+	}
+
+	return pool;
+}
+
+/*
+ * Submit a task to a pool. It will be run by one of the workers.
+ *
+ * Input:
+ *   pool - the pool
+ *   fn   - the function to run
+ *   arg  - the argument to pass to fn
+ *
+ * Returns: 0, or KB_NOMEM if there was no room for the task
+ */
+int pool_submit(POOL *pool, void (*fn)(void *arg), void *arg)
+{
+	TASK task = {fn, arg};
+	WORKER *worker = current_worker;
+
+	// Tasks submitted by a task stay with that worker; others are dealt out.
+	pthread_mutex_lock(&pool->lock);
+	if (worker == NULL || worker->pool != pool)
+	{
+		worker = &pool->workers[pool->next_worker];
+		pool->next_worker = (pool->next_worker + 1) % pool->worker_count;
+	}
+	pool->pending++;
+	pthread_mutex_unlock(&pool->lock);
+
+	if (deque_push(&worker->deque, task) != 0)
+	{
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->pending == 0)
+			pthread_cond_broadcast(&pool->idle);
+		pthread_mutex_unlock(&pool->lock);
+		return KB_NOMEM;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->queued++;
+	pthread_cond_signal(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	return 0;
+}
+
+/*
+ * Wait for every task submitted to a pool so far to finish. This must not be
+ * called from a task.
+ *
+ * Input:
+ *   pool - the pool
+ */
+void pool_wait(POOL *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	while (pool->pending > 0)
+		pthread_cond_wait(&pool->idle, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Stop a pool once every task submitted to it has finished, and free it.
+ *
+ * Input:
+ *   pool - the pool
+ */
+void pool_destroy(POOL *pool)
+{
+	pool_wait(pool);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 0; i < pool->worker_count; i++)
+	{
+		pthread_join(pool->workers[i].thread, NULL);
+		pthread_mutex_destroy(&pool->workers[i].deque.lock);
+		free(pool->workers[i].deque.tasks);
+	}
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work);
+	pthread_cond_destroy(&pool->idle);
+	free(pool->workers);
+	free(pool);
+}
+
+/*
+ * Get the number of cores the process may run on.
+ *
+ * Returns: the number of cores (at least 1)
+ */
+int pool_cores()
+{
+#ifdef __linux__
+	cpu_set_t set;
+	if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0)
+		return CPU_COUNT(&set);
+#endif
+	return 1;
+}
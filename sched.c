@@ -0,0 +1,239 @@
+/*
+ * ICT1002 (C Language) Group Project.
+ *
+ * This file implements the scheduler, which stands in front of chatbot_main()
+ * when many conversations share one chatbot (see server.c and loadgen.c), so
+ * that heavy requests from some of them do not hold up the questions of the
+ * rest.
+ *
+ * sched_start() sets the limits and starts the admin workers.
+ * sched_classify() tells what kind of request a line of input is.
+ * sched_main() gets a response to user input, as chatbot_main() does, within
+ * the limits.
+ * sched_stop() stops the admin workers.
+ *
+ * Requests are told apart by their first word. LOAD, SAVE, RESET, EXPORT and
+ * IMPORT work over the whole knowledge base, as does EXIT (which resets it);
+ * they are REQUEST_ADMIN. Questions are REQUEST_QUESTION, and everything
+ * else (TELL, SNAPSHOT, ROLLBACK, smalltalk) is REQUEST_OTHER.
+ *
+ * Admin requests are not carried out by the conversation's own thread but put
+ * in a queue, first come first served, for a fixed number of admin workers:
+ * no more admin requests than that run at once, however many conversations
+ * send them. The workers run at a lower priority than the conversations (on
+ * Linux, where each thread has its own nice value), so while one is loading
+ * or saving, questions get the processor first. The conversation waits for
+ * its admin request to finish, since its response depends on it.
+ *
+ * With a rate, every request also takes tokens from its session's bucket (see
+ * session_take()): one for a question or anything else, and SCHED_ADMIN_COST
+ * for an admin request. A conversation that runs out waits for its bucket to
+ * fill up again, which holds up nobody else.
+ *
+ * Until sched_start() is called, sched_main() is the same as chatbot_main().
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+#include "chat1002.h"
+
+/* the nice value of the admin workers */
+#define SCHED_ADMIN_NICE 10
+
+/* the number of tokens an admin request takes */
+#define SCHED_ADMIN_COST 10
+
+/* the number of seconds' worth of tokens a session's bucket holds */
+#define SCHED_BURST_SECONDS 2
+
+/* an admin request waiting for, or being carried out by, a worker */
+typedef struct job
+{
+	REQUEST request;
+	int finished;      /* set by the worker when the request is done */
+	struct job *next;  /* the next job in the queue */
+} JOB;
+
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;  /* protects everything below */
+static pthread_cond_t sched_work = PTHREAD_COND_INITIALIZER;    /* signalled when a job is queued */
+static pthread_cond_t sched_done = PTHREAD_COND_INITIALIZER;    /* signalled when a job is finished */
+static JOB *queue_head = NULL;
+static JOB *queue_tail = NULL;
+static pthread_t *workers = NULL;
+static int worker_count = 0;
+static int stopping = 0;
+static double sched_rate = 0;
+static double sched_burst = 0;
+
+/*
+ * An admin worker.
+ */
+static void *admin_worker(void *arg)
+{
+#ifdef __linux__
+	setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), SCHED_ADMIN_NICE);
+#endif
+
+	pthread_mutex_lock(&sched_lock);
+	while (1)
+	{
+		while (queue_head == NULL && !stopping)
+			pthread_cond_wait(&sched_work, &sched_lock);
+		if (queue_head == NULL)
+			break;
+
+		JOB *job = queue_head;
+		queue_head = job->next;
+		if (queue_head == NULL)
+			queue_tail = NULL;
+		pthread_mutex_unlock(&sched_lock);
+
+		chatbot_task(&job->request);
+
+		pthread_mutex_lock(&sched_lock);
+		job->finished = 1;
+		pthread_cond_broadcast(&sched_done);
+	}
+	pthread_mutex_unlock(&sched_lock);
+	return NULL;
+}
+
+/*
+ * Set the limits and start the admin workers.
+ *
+ * Input:
+ *   admin_workers - the most admin requests that may run at once
+ *   rate          - the requests a second each session may make, or 0 for
+ *                   no limit
+ *
+ * Returns: 0 if successful; otherwise -1
+ */
+int sched_start(int admin_workers, double rate)
+{
+	if (worker_count > 0 || admin_workers < 1)
+		return -1;
+
+	workers = (pthread_t *)malloc(admin_workers * sizeof(pthread_t));
+	if (workers == NULL)
+		return -1;
+
+	sched_rate = rate > 0 ? rate : 0;
+	sched_burst = rate * SCHED_BURST_SECONDS > 1 ? rate * SCHED_BURST_SECONDS : 1;
+	stopping = 0;
+	for (worker_count = 0; worker_count < admin_workers; worker_count++)
+	{
+		if (pthread_create(&workers[worker_count], NULL, admin_worker, NULL) != 0)
+		{
+			sched_stop();
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Tell what kind of request a line of input is.
+ *
+ * Input:
+ *   line - the line of input
+ *   inc  - the number of words in the line
+ *   inv  - the position of each word in the line, as found by tokenize()
+ *
+ * Returns: REQUEST_QUESTION, REQUEST_ADMIN or REQUEST_OTHER
+ */
+int sched_classify(const char *line, int inc, const TOKEN inv[])
+{
+	if (inc < 1)
+		return REQUEST_OTHER;
+
+	const VOCAB *word = vocab_find(line + inv[0].offset, inv[0].length, inv[0].hash);
+	switch (word != NULL ? word->verb : VERB_NONE)
+	{
+	case VERB_QUESTION:
+		return REQUEST_QUESTION;
+	case VERB_EXIT:
+	case VERB_LOAD:
+	case VERB_SAVE:
+	case VERB_RESET:
+	case VERB_EXPORT:
+	case VERB_IMPORT:
+		return REQUEST_ADMIN;
+	default:
+		return REQUEST_OTHER;
+	}
+}
+
+/*
+ * Get a response to user input, within the limits given to sched_start().
+ *
+ * See the comment at the top of chatbot.c for a description of the
+ * parameters.
+ *
+ * Returns: as chatbot_main()
+ */
+int sched_main(const char *line, int inc, const TOKEN inv[], char *response, int n)
+{
+	int kind = sched_classify(line, inc, inv);
+
+	// Wait for the session's bucket to have enough tokens.
+	double cost = kind == REQUEST_ADMIN ? SCHED_ADMIN_COST : 1;
+	double wait;
+	while ((wait = session_take(cost, sched_rate, sched_burst)) > 0)
+	{
+		struct timespec ts;
+		ts.tv_sec = (time_t)wait;
+		ts.tv_nsec = (long)((wait - ts.tv_sec) * 1e9);
+		nanosleep(&ts, NULL);
+	}
+
+	if (kind != REQUEST_ADMIN || worker_count == 0)
+		return chatbot_main(line, inc, inv, response, n);
+
+	// Queue the request for an admin worker and wait for it.
+	JOB job;
+	job.request.line = line;
+	job.request.inc = inc;
+	job.request.inv = inv;
+	job.request.response = response;
+	job.request.n = n;
+	job.request.done = 0;
+	job.finished = 0;
+	job.next = NULL;
+
+	pthread_mutex_lock(&sched_lock);
+	if (queue_tail != NULL)
+		queue_tail->next = &job;
+	else
+		queue_head = &job;
+	queue_tail = &job;
+	pthread_cond_signal(&sched_work);
+	while (!job.finished)
+		pthread_cond_wait(&sched_done, &sched_lock);
+	pthread_mutex_unlock(&sched_lock);
+
+	return job.request.done;
+}
+
+/*
+ * Stop the admin workers, once they have carried out every request queued.
+ */
+void sched_stop()
+{
+	pthread_mutex_lock(&sched_lock);
+	stopping = 1;
+	pthread_cond_broadcast(&sched_work);
+	pthread_mutex_unlock(&sched_lock);
+
+	for (int i = 0; i < worker_count; i++)
+		pthread_join(workers[i], NULL);
+	free(workers);
+	workers = NULL;
+	worker_count = 0;
+}
@@ -0,0 +1,233 @@
+/*
+ * ICT1002 (C Language) Group Project.
+ *
+ * This file implements a server that lets other programs chat with the
+ * chatbot over a Unix domain socket.
+ *
+ * Usage: chatbot_server [-k <shards> | -g <seconds>] [-s <synonyms file>]
+ *                       [-a <admin workers>] [-l <requests per second>] <socket path>
+ *
+ * With -k, the knowledge base is sharded across that many processes (see
+ * shard.c). With -s, entities are looked up using the synonyms in the file
+ * (see normalize.c). With -g, the knowledge base is compacted in the
+ * background (see compact.c), looking at it every so many seconds; each
+ * compaction is reported on standard error.
+ *
+ * Requests go through the scheduler (see sched.c): LOAD, SAVE, RESET and the
+ * like are carried out by a queue of low-priority admin workers, one unless
+ * -a says otherwise, and with -l each conversation may make no more than that
+ * many requests a second.
+ *
+ * Every connection is a conversation of its own, handled by its own thread
+ * and with its own session (see session.c), and all conversations share one
+ * knowledge base. The client sends a line of
+ * input at a time and the server answers each one with one line: the
+ * chatbot's response. When the chatbot does not know the answer to a
+ * question, the line it sends back is its prompt instead, and the next line
+ * the client sends is taken as the answer.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "chat1002.h"
+
+/* the number of connections accepted so far, which numbers their sessions */
+static unsigned long connections = 0;
+
+/* the connection the current thread is talking to */
+static __thread FILE *client_in = NULL;
+static __thread FILE *client_out = NULL;
+
+/*
+ * Ask the client a question. The prompt is sent as one line and the next line
+ * the client sends is the answer.
+ *
+ * Input:
+ *   buf    - pointer to a buffer into which to store the answer, which may
+ *            start as NULL and grows to fit it, as for read_line()
+ *   size   - pointer to the size of the buffer
+ *   format - format string, as printf
+ *   ...    - as printf
+ *
+ * Returns: as read_line()
+ */
+int prompt_user(char **buf, int *size, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	vfprintf(client_out, format, args);
+	va_end(args);
+	fputc('\n', client_out);
+	fflush(client_out);
+
+	return read_line(client_in, buf, size);
+}
+
+/*
+ * Talk to one client until it says goodbye or disconnects.
+ */
+static void *serve_client(void *arg)
+{
+	int fd = (int)(long)arg;
+	char *line = NULL;
+	int size = 0;
+	int len;
+	TOKEN *inv = NULL;
+	int max_inc = 0;
+	char *output = NULL;
+	int output_size = 0;
+
+	client_in = fdopen(fd, "r");
+	client_out = fdopen(dup(fd), "w");
+	if (client_in == NULL || client_out == NULL)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	session_open(__atomic_add_fetch(&connections, 1, __ATOMIC_RELAXED));
+	while ((len = read_line(client_in, &line, &size)) >= 0)
+	{
+		// Make sure there is room for every word.
+		if (len / 2 + 1 > max_inc)
+		{
+			max_inc = len / 2 + 1;
+			TOKEN *new_inv = (TOKEN *)realloc(inv, max_inc * sizeof(TOKEN));
+			if (new_inv == NULL)
+				break;
+			inv = new_inv;
+		}
+
+		int inc = tokenize(line, inv, max_inc);
+		int done = chatbot_reply(line, inc, inv, &output, &output_size, sched_main);
+		if (done < 0)
+			break;
+		fprintf(client_out, "%s\n", output);
+		fflush(client_out);
+		if (done)
+			break;
+	}
+
+	session_close();
+	free(line);
+	free(inv);
+	free(output);
+	fclose(client_in);
+	fclose(client_out);
+	return NULL;
+}
+
+/*
+ * Accept connections until the process is killed.
+ */
+int main(int argc, char *argv[])
+{
+	const char *program = argv[0];
+	const char *shards = NULL;
+	const char *synonyms = NULL;
+	const char *compact_every = NULL;
+	int admin_workers = 1;
+	double limit = 0;
+	while (argc >= 4 && argv[1][0] == '-' && argv[1][1] != '\0' && argv[1][2] == '\0' &&
+		   strchr("ksgal", argv[1][1]) != NULL)
+	{
+		switch (argv[1][1])
+		{
+		case 'k':
+			shards = argv[2];
+			break;
+		case 's':
+			synonyms = argv[2];
+			break;
+		case 'g':
+			compact_every = argv[2];
+			break;
+		case 'a':
+			admin_workers = atoi(argv[2]);
+			break;
+		case 'l':
+			limit = atof(argv[2]);
+			break;
+		}
+		argv += 2;
+		argc -= 2;
+	}
+	if (argc != 2 || (shards != NULL && compact_every != NULL) || admin_workers < 1)
+	{
+		fprintf(stderr, "Usage: %s [-k shards | -g seconds] [-s synonyms] [-a admin workers] [-l rate] <socket path>\n",
+				program);
+		return 1;
+	}
+
+	// The synonyms are read first, so that the shards have them too.
+	if (synonyms != NULL)
+	{
+		FILE *f = fopen(synonyms, "r");
+		int count = f != NULL ? normalize_load(f) : KB_NOTFOUND;
+		if (f != NULL)
+			fclose(f);
+		if (count < 0)
+		{
+			fprintf(stderr, "%s: could not read synonyms from %s\n", program, synonyms);
+			return 1;
+		}
+	}
+	if (shards != NULL && shard_start(atoi(shards)) != 0)
+	{
+		fprintf(stderr, "%s: could not start %s shards\n", program, shards);
+		return 1;
+	}
+	if (compact_every != NULL && compact_start(atof(compact_every), stderr) != 0)
+	{
+		fprintf(stderr, "%s: could not start the compactor\n", program);
+		return 1;
+	}
+	if (sched_start(admin_workers, limit) != 0)
+	{
+		fprintf(stderr, "%s: could not start the scheduler\n", program);
+		return 1;
+	}
+
+	// A client that goes away mid-reply must not kill the server.
+	signal(SIGPIPE, SIG_IGN);
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", argv[1]);
+
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(argv[1]);
+	if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+		listen(listen_fd, 128) != 0)
+	{
+		perror(argv[1]);
+		return 1;
+	}
+	printf("%s: listening on %s\n", chatbot_botname(), argv[1]);
+	fflush(stdout);
+
+	while (1)
+	{
+		int fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0)
+			continue;
+
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, serve_client, (void *)(long)fd) != 0)
+		{
+			close(fd);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+
+	return 0;
+}
@@ -0,0 +1,364 @@
+/*
+ * ICT1002 (C Language) Group Project.
+ *
+ * This file implements the chatbot's memory of each conversation, so that a
+ * follow-up such as "where is it?" after "what is SIT?" can be answered.
+ *
+ * session_open() finds or starts the session for a key (e.g. a connection)
+ * and makes it the current session of the calling thread.
+ * session_close() lets go of the current session.
+ * session_remember() notes an entity the current session asked about.
+ * session_recall() finds the entity a pronoun in the current session stands
+ * for.
+ * session_take() takes tokens from the current session's bucket, for the rate
+ * limits in sched.c.
+ *
+ * A session remembers the most recent entities it asked about, and the intent
+ * of each, in a buffer of SESSION_BYTES bytes; when a new entity does not fit,
+ * the oldest ones are forgotten. Every session is the same size, and they are
+ * handed out from slabs of SESSION_SLAB at a time, so the sessions cost at
+ * most SESSION_MAX times the size of one. Sessions that have been idle for
+ * SESSION_IDLE seconds are forgotten, and if there are SESSION_MAX sessions
+ * already, the least recently used one is forgotten to make room.
+ *
+ * The sessions are shared by every thread and are protected by session_lock.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "chat1002.h"
+
+/* the most bytes of recent entities a session remembers */
+#define SESSION_BYTES 192
+
+/* sessions idle for this many seconds are forgotten */
+#define SESSION_IDLE 600
+
+/* the most sessions remembered at once; must be a power of two */
+#define SESSION_MAX 65536
+
+/* the number of sessions allocated at a time */
+#define SESSION_SLAB 256
+
+/*
+ * A conversation. Its memory is a list of entries, oldest first, each being
+ * the intent, the length of the entity, then the entity itself.
+ */
+typedef struct session
+{
+	unsigned long key;
+	time_t last_used;
+	int users;                  /* number of threads that have it open */
+	int used;                   /* number of bytes of memory in use */
+	double tokens;              /* tokens in its bucket (see session_take()) */
+	double refilled;            /* when tokens was last worked out, in seconds */
+	struct session *hash_next;  /* next session in the same bucket */
+	struct session *lru_prev;   /* the session used just more recently */
+	struct session *lru_next;   /* the session used just less recently (or the next free one) */
+	unsigned char memory[SESSION_BYTES];
+} SESSION;
+
+static pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
+static SESSION *session_buckets[SESSION_MAX];  /* hash table of sessions by key */
+static SESSION *lru_head = NULL;               /* most recently used */
+static SESSION *lru_tail = NULL;               /* least recently used */
+static SESSION *free_sessions = NULL;          /* sessions not in use, chained through lru_next */
+static int session_total = 0;                  /* number of sessions allocated */
+
+/* the session the current thread is talking in */
+static __thread SESSION *current_session = NULL;
+
+/*
+ * Find the bucket a key belongs in.
+ */
+static SESSION **session_bucket(unsigned long key)
+{
+	return &session_buckets[(key * 2654435761UL) & (SESSION_MAX - 1)];
+}
+
+/*
+ * Take a session out of the most-recently-used list.
+ */
+static void lru_unlink(SESSION *session)
+{
+	if (session->lru_prev != NULL)
+		session->lru_prev->lru_next = session->lru_next;
+	else
+		lru_head = session->lru_next;
+	if (session->lru_next != NULL)
+		session->lru_next->lru_prev = session->lru_prev;
+	else
+		lru_tail = session->lru_prev;
+}
+
+/*
+ * Put a session at the front of the most-recently-used list.
+ */
+static void lru_push(SESSION *session)
+{
+	session->lru_prev = NULL;
+	session->lru_next = lru_head;
+	if (lru_head != NULL)
+		lru_head->lru_prev = session;
+	else
+		lru_tail = session;
+	lru_head = session;
+}
+
+/*
+ * Forget a session and put it on the free list.
+ */
+static void session_evict(SESSION *session)
+{
+	SESSION **link_ptr = session_bucket(session->key);
+	while (*link_ptr != session)
+		link_ptr = &(*link_ptr)->hash_next;
+	*link_ptr = session->hash_next;
+
+	lru_unlink(session);
+	session->lru_next = free_sessions;
+	free_sessions = session;
+}
+
+/*
+ * Get an unused session, forgetting the least recently used one or allocating
+ * another slab if there is none free.
+ *
+ * Returns: the session, or NULL if there was no memory for one
+ */
+static SESSION *session_alloc()
+{
+	if (free_sessions == NULL && session_total >= SESSION_MAX)
+	{
+		// Make room by forgetting the least recently used session no thread
+		// has open.
+		SESSION *victim = lru_tail;
+		while (victim != NULL && victim->users > 0)
+			victim = victim->lru_prev;
+		if (victim == NULL)
+			return NULL;
+		session_evict(victim);
+	}
+
+	if (free_sessions == NULL)
+	{
+		SESSION *slab = (SESSION *)malloc(SESSION_SLAB * sizeof(SESSION));
+		if (slab == NULL)
+			return NULL;
+		for (int i = 0; i < SESSION_SLAB; i++)
+		{
+			slab[i].lru_next = free_sessions;
+			free_sessions = &slab[i];
+		}
+		session_total += SESSION_SLAB;
+	}
+
+	SESSION *session = free_sessions;
+	free_sessions = session->lru_next;
+	return session;
+}
+
+/*
+ * Find the session for a key, starting a new one if there is none, and make
+ * it the calling thread's current session.
+ *
+ * Input:
+ *   key - identifies the conversation, e.g. a connection number
+ *
+ * Returns: KB_OK, or KB_NOMEM if there was no room for the session (in which
+ * case the conversation goes on without one)
+ */
+int session_open(unsigned long key)
+{
+	time_t now = time(NULL);
+
+	pthread_mutex_lock(&session_lock);
+
+	// Forget sessions that have been idle too long.
+	while (lru_tail != NULL && lru_tail->users == 0 && now - lru_tail->last_used > SESSION_IDLE)
+		session_evict(lru_tail);
+
+	SESSION **bucket = session_bucket(key);
+	SESSION *session = *bucket;
+	while (session != NULL && session->key != key)
+		session = session->hash_next;
+
+	if (session != NULL)
+	{
+		lru_unlink(session);
+	}
+	else
+	{
+		session = session_alloc();
+		if (session != NULL)
+		{
+			session->key = key;
+			session->users = 0;
+			session->used = 0;
+			session->tokens = 0;
+			session->refilled = 0;
+			session->hash_next = *bucket;
+			*bucket = session;
+		}
+	}
+
+	if (session != NULL)
+	{
+		session->users++;
+		session->last_used = now;
+		lru_push(session);
+	}
+	pthread_mutex_unlock(&session_lock);
+
+	current_session = session;
+	return session != NULL ? KB_OK : KB_NOMEM;
+}
+
+/*
+ * Let go of the calling thread's current session. It is remembered until it
+ * has been idle for SESSION_IDLE seconds or its room is needed.
+ */
+void session_close()
+{
+	SESSION *session = current_session;
+	if (session == NULL)
+		return;
+
+	pthread_mutex_lock(&session_lock);
+	session->users--;
+	session->last_used = time(NULL);
+	pthread_mutex_unlock(&session_lock);
+
+	current_session = NULL;
+}
+
+/*
+ * Remember that the current session asked about an entity. If it was already
+ * remembered, it becomes the newest entry, with the new intent.
+ *
+ * Input:
+ *   intent - the index of the intent in all_intents
+ *   entity - the entity (need not be null-terminated)
+ *   len    - the number of characters in the entity
+ */
+void session_remember(int intent, const char *entity, int len)
+{
+	SESSION *session = current_session;
+	if (session == NULL || len < 1 || len >= SESSION_ENTITY || len + 2 > SESSION_BYTES)
+		return;
+
+	pthread_mutex_lock(&session_lock);
+
+	// Forget the entity if it is already remembered.
+	for (int i = 0; i < session->used; i += 2 + session->memory[i + 1])
+	{
+		if (session->memory[i + 1] == len && memcmp(session->memory + i + 2, entity, len) == 0)
+		{
+			memmove(session->memory + i, session->memory + i + 2 + len, session->used - i - 2 - len);
+			session->used -= 2 + len;
+			break;
+		}
+	}
+
+	// Forget the oldest entries until the new one fits.
+	int drop = 0;
+	while (session->used - drop + len + 2 > SESSION_BYTES)
+		drop += 2 + session->memory[drop + 1];
+	memmove(session->memory, session->memory + drop, session->used - drop);
+	session->used -= drop;
+
+	session->memory[session->used] = intent;
+	session->memory[session->used + 1] = len;
+	memcpy(session->memory + session->used + 2, entity, len);
+	session->used += len + 2;
+
+	pthread_mutex_unlock(&session_lock);
+}
+
+/*
+ * Find the entity a pronoun stands for in the current session: the entity
+ * asked about most recently, preferring one asked about with "who" if the
+ * pronoun is a person ("he", "she"...) and one that was not if it is a thing
+ * ("it", "that"...).
+ *
+ * Input:
+ *   pronoun - PRONOUN_PERSON or PRONOUN_THING
+ *   entity  - a buffer of at least SESSION_ENTITY characters to receive the
+ *             entity
+ *
+ * Returns: the number of characters in the entity, or 0 if there is none
+ */
+int session_recall(int pronoun, char *entity)
+{
+	SESSION *session = current_session;
+	if (session == NULL)
+		return 0;
+
+	int who = knowledge_intent("who", 3);
+	int best = -1;
+	int fallback = -1;
+
+	pthread_mutex_lock(&session_lock);
+	for (int i = 0; i < session->used; i += 2 + session->memory[i + 1])
+	{
+		fallback = i;
+		if ((session->memory[i] == who) == (pronoun == PRONOUN_PERSON))
+			best = i;
+	}
+	if (best < 0)
+		best = fallback;
+
+	int len = 0;
+	if (best >= 0)
+	{
+		len = session->memory[best + 1];
+		memcpy(entity, session->memory + best + 2, len);
+		entity[len] = '\0';
+	}
+	pthread_mutex_unlock(&session_lock);
+
+	return len;
+}
+
+/*
+ * Take tokens from the current session's bucket. The bucket holds up to burst
+ * tokens and fills up again at rate tokens a second; a new session's bucket
+ * starts full. A request costing more than the bucket holds may go once the
+ * bucket is full, leaving it in debt.
+ *
+ * Input:
+ *   cost  - the number of tokens to take
+ *   rate  - the number of tokens added to the bucket each second
+ *   burst - the most tokens the bucket holds
+ *
+ * Returns: 0 if the tokens were taken (or there is no current session);
+ * otherwise the number of seconds until there will be enough of them
+ */
+double session_take(double cost, double rate, double burst)
+{
+	SESSION *session = current_session;
+	if (session == NULL || rate <= 0)
+		return 0;
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	double now = ts.tv_sec + ts.tv_nsec * 1e-9;
+	double wait = 0;
+
+	pthread_mutex_lock(&session_lock);
+	double tokens = session->tokens + (now - session->refilled) * rate;
+	if (tokens > burst)
+		tokens = burst;
+	double needed = cost < burst ? cost : burst;
+	if (tokens >= needed)
+		tokens -= cost;
+	else
+		wait = (needed - tokens) / rate;
+	session->tokens = tokens;
+	session->refilled = now;
+	pthread_mutex_unlock(&session_lock);
+
+	return wait;
+}
@@ -0,0 +1,731 @@
+/*
+ * ICT1002 (C Language) Group Project.
+ *
+ * This file implements sharding the knowledge base across several processes.
+ *
+ * shard_start() forks the shard processes. From then on, this process is only
+ * a router: knowledge_get(), knowledge_put(), knowledge_about(),
+ * knowledge_read(), knowledge_write(), knowledge_export(), knowledge_import(),
+ * knowledge_reset(), knowledge_count(), knowledge_snapshot() and
+ * knowledge_rollback() (in knowledge.c) hand their work to the functions here,
+ * which forward it to the shards over Unix sockets. Each shard is an ordinary knowledge base holding its share of
+ * the entities.
+ *
+ * Entities are placed with consistent hashing: every shard owns many points on
+ * a ring of 32-bit hashes, and an entity belongs to the shard owning the first
+ * point at or after the entity's hash. All the intents of an entity live on
+ * the same shard.
+ *
+ * Requests to the shards are lines of tab-separated fields, escaped as in the
+ * records of knowledge_export() so that any entity or response can be sent:
+ *
+ *   G n intent entity         get; answered by "0<tab>response" or the status,
+ *                             with the response cut to fit a buffer of n
+ *                             characters, as knowledge_get() would cut it
+ *   P intent entity response  put; answered by the status
+ *   A n entity                about; answered by the number of intents with a
+ *                             response, then a field for each intent holding
+ *                             its response (or nothing), each cut to fit n
+ *   B                         start a bulk load; each following line is
+ *                             "intent<tab>entity<tab>response" and gets no
+ *                             answer, until
+ *   E                         end a bulk load; answered by the number stored,
+ *                             the number of collisions, and the two spellings
+ *                             of the first (see knowledge_read())
+ *   W                         write; answered by knowledge_write() output and
+ *                             a line holding "."
+ *   X                         export; answered by knowledge_export() output and
+ *                             a line holding "."
+ *   R                         reset; answered by "0"
+ *   C                         count; answered by the number of questions
+ *   S name                    snapshot; answered by the status
+ *   U name                    roll back (undo) to a snapshot; answered by the
+ *                             status
+ *
+ * Loads, saves, resets, counts, snapshots and rollbacks are sent to every
+ * shard before any answer is read, so the shards do their part at the same
+ * time. Every shard takes every snapshot, so each can roll back its own share
+ * of the entities. Exports go to one
+ * shard at a time, so that each shard's records can be passed straight on
+ * without being held anywhere.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "chat1002.h"
+
+/* the number of points each shard owns on the ring */
+#define SHARD_POINTS 64
+
+/* the router's connection to a shard */
+typedef struct shard
+{
+	pid_t pid;
+	FILE *in;
+	FILE *out;
+	pthread_mutex_t lock;  /* held for the whole of a request and its answer */
+	char *reply;           /* buffer for answers, reused */
+	int reply_size;
+} SHARD;
+
+/* a point on the ring */
+typedef struct point
+{
+	unsigned long hash;
+	int shard;
+} POINT;
+
+static SHARD *shards = NULL;
+static int shard_total = 0;
+static POINT *ring = NULL;
+static int ring_size = 0;
+
+/*
+ * Spread the bits of a hash, so that entities with similar hashes land far
+ * apart on the ring.
+ */
+static unsigned long mix(unsigned long h)
+{
+	h &= 0xffffffffUL;
+	h ^= h >> 16;
+	h = (h * 0x85ebca6bUL) & 0xffffffffUL;
+	h ^= h >> 13;
+	h = (h * 0xc2b2ae35UL) & 0xffffffffUL;
+	h ^= h >> 16;
+	return h;
+}
+
+/*
+ * Compare ring points, for qsort().
+ */
+static int compare_points(const void *a, const void *b)
+{
+	unsigned long x = ((const POINT *)a)->hash;
+	unsigned long y = ((const POINT *)b)->hash;
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Find the shard an entity belongs to, by its key (see normalize.c), so that
+ * every way of writing an entity goes to the same shard.
+ */
+static int shard_of(const char *entity, int len)
+{
+	KEY key;
+	unsigned long h = mix(normalize_key(&key, entity, len) == KB_OK ? key.hash : hash_token(entity, len));
+	normalize_free(&key);
+
+	// Binary search for the first point at or after h, wrapping around.
+	int lo = 0, hi = ring_size;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (ring[mid].hash < h)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return ring[lo == ring_size ? 0 : lo].shard;
+}
+
+/*
+ * Make sure a buffer has room for a number of characters.
+ *
+ * Returns: 0, or KB_NOMEM if the buffer could not be grown
+ */
+static int make_room(char **buffer, int *size, long needed)
+{
+	if (*size >= needed)
+		return 0;
+	if (needed > 0x7fffffff)
+		return KB_NOMEM;
+	char *new_buffer = (char *)realloc(*buffer, needed);
+	if (new_buffer == NULL)
+		return KB_NOMEM;
+	*buffer = new_buffer;
+	*size = needed;
+	return 0;
+}
+
+/*
+ * Determine whether a snapshot name can be sent to a shard as it is.
+ */
+static int sendable(const char *s, int len)
+{
+	for (int i = 0; i < len; i++)
+	{
+		if (s[i] == '\t' || s[i] == '\n')
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Serve the router's requests until it goes away. This is the whole life of a
+ * shard process.
+ */
+static void shard_serve(FILE *in, FILE *out)
+{
+	char *line = NULL;
+	int size = 0;
+	char *response = NULL;  /* buffer for responses, grown to the size the router asks for */
+	int response_size = 0;
+	int bulk = 0;
+	int bulk_count = 0;
+	COLLISIONS bulk_collisions;
+
+	while (read_line(in, &line, &size) >= 0)
+	{
+		char *fields[4];
+		int lengths[4];
+		int count = split_record(line, fields, lengths, 4);
+		int n = count > 1 ? atoi(fields[1]) : 0;
+
+		if (bulk)
+		{
+			if (count == 1 && strcmp(fields[0], "E") == 0)
+			{
+				fprintf(out, "%d\t%d\t", bulk_count, bulk_collisions.count);
+				write_field(out, bulk_collisions.known, strlen(bulk_collisions.known));
+				fputc('\t', out);
+				write_field(out, bulk_collisions.read, strlen(bulk_collisions.read));
+				fputc('\n', out);
+				fflush(out);
+				bulk = 0;
+			}
+			else if (count == 3 &&
+					 knowledge_load_put(fields[0], fields[1], lengths[1], fields[2], &bulk_collisions) == KB_OK)
+			{
+				bulk_count++;
+			}
+			continue;
+		}
+
+		if (strcmp(fields[0], "G") == 0 && count == 4 && n > 0)
+		{
+			int status = make_room(&response, &response_size, n);
+			if (status == 0)
+				status = knowledge_get(fields[2], fields[3], lengths[3], response, n);
+			fprintf(out, "%d", status);
+			if (status == KB_OK)
+			{
+				fputc('\t', out);
+				write_field(out, response, strlen(response));
+			}
+			fputc('\n', out);
+		}
+		else if (strcmp(fields[0], "P") == 0 && count == 4)
+		{
+			fprintf(out, "%d\n", knowledge_put(fields[1], fields[2], lengths[2], fields[3]));
+		}
+		else if (strcmp(fields[0], "A") == 0 && count == 3 && n > 0)
+		{
+			char *responses[MAX_NO_OF_INTENT];
+			if (make_room(&response, &response_size, (long)MAX_NO_OF_INTENT * n) != 0)
+			{
+				fprintf(out, "0\n");
+				fflush(out);
+				continue;
+			}
+			for (int i = 0; i < MAX_NO_OF_INTENT; i++)
+				responses[i] = response + (long)i * n;
+			fprintf(out, "%d", knowledge_about(fields[2], lengths[2], responses, n));
+			for (int i = 0; i < MAX_NO_OF_INTENT; i++)
+			{
+				fputc('\t', out);
+				write_field(out, responses[i], strlen(responses[i]));
+			}
+			fputc('\n', out);
+		}
+		else if (strcmp(fields[0], "B") == 0)
+		{
+			bulk = 1;
+			bulk_count = 0;
+			memset(&bulk_collisions, 0, sizeof(bulk_collisions));
+			continue;
+		}
+		else if (strcmp(fields[0], "W") == 0)
+		{
+			knowledge_write(out);
+			fprintf(out, ".\n");
+		}
+		else if (strcmp(fields[0], "X") == 0)
+		{
+			knowledge_export(out, NULL);
+			fprintf(out, ".\n");
+		}
+		else if (strcmp(fields[0], "R") == 0)
+		{
+			knowledge_reset();
+			fprintf(out, "0\n");
+		}
+		else if (strcmp(fields[0], "C") == 0)
+		{
+			fprintf(out, "%d\n", knowledge_count());
+		}
+		else if (strcmp(fields[0], "S") == 0 && fields[1] != NULL)
+		{
+			fprintf(out, "%d\n", knowledge_snapshot(fields[1]));
+		}
+		else if (strcmp(fields[0], "U") == 0 && fields[1] != NULL)
+		{
+			fprintf(out, "%d\n", knowledge_rollback(fields[1]));
+		}
+		else
+		{
+			fprintf(out, "%d\n", KB_INVALID);
+		}
+		fflush(out);
+	}
+
+	free(line);
+	free(response);
+}
+
+/*
+ * Start the shard processes. This must be called before any threads are
+ * started and before anything is put in the knowledge base.
+ *
+ * Input:
+ *   count - the number of shards
+ *
+ * Returns: 0, or -1 if the shards could not be started
+ */
+int shard_start(int count)
+{
+	if (count < 1)
+		return -1;
+
+	shards = (SHARD *)calloc(count, sizeof(SHARD));
+	ring = (POINT *)malloc(count * SHARD_POINTS * sizeof(POINT));
+	if (shards == NULL || ring == NULL)
+		return -1;
+
+	// Nothing buffered may be written twice by the children.
+	fflush(stdout);
+	fflush(stderr);
+
+	for (int i = 0; i < count; i++)
+	{
+		int fds[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+			return -1;
+
+		pid_t pid = fork();
+		if (pid < 0)
+			return -1;
+		if (pid == 0)
+		{
+			// The shard does not need the router's end of any connection.
+			close(fds[0]);
+			for (int j = 0; j < i; j++)
+			{
+				fclose(shards[j].in);
+				fclose(shards[j].out);
+			}
+			shard_serve(fdopen(fds[1], "r"), fdopen(dup(fds[1]), "w"));
+			_exit(0);
+		}
+
+		close(fds[1]);
+		shards[i].pid = pid;
+		shards[i].in = fdopen(fds[0], "r");
+		shards[i].out = fdopen(dup(fds[0]), "w");
+		pthread_mutex_init(&shards[i].lock, NULL);
+	}
+
+	// Lay out the ring.
+	for (int i = 0; i < count; i++)
+	{
+		for (int p = 0; p < SHARD_POINTS; p++)
+		{
+			char name[32];
+			int len = snprintf(name, sizeof(name), "shard %d point %d", i, p);
+			ring[i * SHARD_POINTS + p].hash = mix(hash_token(name, len));
+			ring[i * SHARD_POINTS + p].shard = i;
+		}
+	}
+	ring_size = count * SHARD_POINTS;
+	qsort(ring, ring_size, sizeof(POINT), compare_points);
+
+	shard_total = count;
+	return 0;
+}
+
+/*
+ * Determine whether the knowledge base is sharded.
+ *
+ * Returns: the number of shards, or 0 if the knowledge base is in this process
+ */
+int shard_count()
+{
+	return shard_total;
+}
+
+/*
+ * Get the response to a question from the shard that owns the entity.
+ *
+ * Input and return value: as knowledge_get()
+ */
+int shard_get(const char *intent, const char *entity, int len, char *response, int n)
+{
+	SHARD *shard = &shards[shard_of(entity, len)];
+	int status = KB_INVALID;
+
+	pthread_mutex_lock(&shard->lock);
+	fprintf(shard->out, "G\t%d\t%s\t", n, intent);
+	write_field(shard->out, entity, len);
+	fputc('\n', shard->out);
+	fflush(shard->out);
+	if (read_line(shard->in, &shard->reply, &shard->reply_size) >= 0)
+	{
+		char *fields[2];
+		int lengths[2];
+		int count = split_record(shard->reply, fields, lengths, 2);
+		status = atoi(fields[0]);
+		if (status == KB_OK && count == 2)
+			snprintf(response, n, "%s", fields[1]);
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	return status;
+}
+
+/*
+ * Put the response to a question on the shard that owns the entity.
+ *
+ * Input and return value: as knowledge_put()
+ */
+int shard_put(const char *intent, const char *entity, int len, const char *response)
+{
+	SHARD *shard = &shards[shard_of(entity, len)];
+	int status = KB_INVALID;
+
+	pthread_mutex_lock(&shard->lock);
+	fprintf(shard->out, "P\t%s\t", intent);
+	write_field(shard->out, entity, len);
+	fputc('\t', shard->out);
+	write_field(shard->out, response, strlen(response));
+	fputc('\n', shard->out);
+	fflush(shard->out);
+	if (read_line(shard->in, &shard->reply, &shard->reply_size) >= 0)
+		status = atoi(shard->reply);
+	pthread_mutex_unlock(&shard->lock);
+
+	return status;
+}
+
+/*
+ * Get everything known about an entity from the shard that owns it.
+ *
+ * Input and return value: as knowledge_about()
+ */
+int shard_about(const char *entity, int len, char *responses[], int n)
+{
+	int found = 0;
+	for (int i = 0; i < MAX_NO_OF_INTENT && n > 0; i++)
+		responses[i][0] = '\0';
+	if (n < 1)
+		return 0;
+
+	SHARD *shard = &shards[shard_of(entity, len)];
+
+	pthread_mutex_lock(&shard->lock);
+	fprintf(shard->out, "A\t%d\t", n);
+	write_field(shard->out, entity, len);
+	fputc('\n', shard->out);
+	fflush(shard->out);
+	if (read_line(shard->in, &shard->reply, &shard->reply_size) >= 0)
+	{
+		char *fields[MAX_NO_OF_INTENT + 1];
+		int lengths[MAX_NO_OF_INTENT + 1];
+		int count = split_record(shard->reply, fields, lengths, MAX_NO_OF_INTENT + 1);
+		found = atoi(fields[0]);
+		for (int i = 0; i + 1 < count && i < MAX_NO_OF_INTENT; i++)
+			snprintf(responses[i], n, "%s", fields[i + 1]);
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	return found;
+}
+
+/*
+ * Send the same request to every shard and add up their numeric answers. Every
+ * shard is sent the request before any answer is read.
+ *
+ * Input:
+ *   request - the request
+ *   lowest  - if not NULL, receives the lowest answer (for a request answered
+ *             by a status, KB_OK if every shard answered KB_OK)
+ *
+ * Returns: the total of the answers
+ */
+static int shard_broadcast(const char *request, int *lowest)
+{
+	int total = 0;
+
+	if (lowest != NULL)
+		*lowest = KB_INVALID;
+
+	for (int i = 0; i < shard_total; i++)
+	{
+		pthread_mutex_lock(&shards[i].lock);
+		fprintf(shards[i].out, "%s\n", request);
+		fflush(shards[i].out);
+	}
+	for (int i = 0; i < shard_total; i++)
+	{
+		if (read_line(shards[i].in, &shards[i].reply, &shards[i].reply_size) >= 0)
+		{
+			int answer = atoi(shards[i].reply);
+			total += answer;
+			if (lowest != NULL && (i == 0 || answer < *lowest))
+				*lowest = answer;
+		}
+		pthread_mutex_unlock(&shards[i].lock);
+	}
+
+	return total;
+}
+
+/*
+ * Start loading entities into the shards. Until shard_end_load() is called,
+ * only shard_load_put() may be used.
+ */
+void shard_begin_load()
+{
+	for (int i = 0; i < shard_total; i++)
+	{
+		pthread_mutex_lock(&shards[i].lock);
+		fprintf(shards[i].out, "B\n");
+	}
+}
+
+/*
+ * Send an entity to its shard as part of a load. The shards store entities
+ * while the loader carries on reading; there is no answer to wait for.
+ *
+ * Input: as knowledge_put()
+ */
+void shard_load_put(const char *intent, const char *entity, int len, const char *response)
+{
+	SHARD *shard = &shards[shard_of(entity, len)];
+	fprintf(shard->out, "%s\t", intent);
+	write_field(shard->out, entity, len);
+	fputc('\t', shard->out);
+	write_field(shard->out, response, strlen(response));
+	fputc('\n', shard->out);
+}
+
+/*
+ * Finish loading entities into the shards.
+ *
+ * Input:
+ *   collisions - receives the collisions the shards found, as
+ *                knowledge_read() counts them (may be NULL)
+ *
+ * Returns: the number of entities the shards stored
+ */
+int shard_end_load(COLLISIONS *collisions)
+{
+	int total = 0;
+	if (collisions != NULL)
+		collisions->count = 0;
+
+	for (int i = 0; i < shard_total; i++)
+	{
+		fprintf(shards[i].out, "E\n");
+		fflush(shards[i].out);
+	}
+	for (int i = 0; i < shard_total; i++)
+	{
+		char *fields[4];
+		int lengths[4];
+		if (read_line(shards[i].in, &shards[i].reply, &shards[i].reply_size) >= 0 &&
+			split_record(shards[i].reply, fields, lengths, 4) == 4)
+		{
+			total += atoi(fields[0]);
+			int count = atoi(fields[1]);
+			if (collisions != NULL && count > 0)
+			{
+				if (collisions->count == 0)
+				{
+					snprintf(collisions->known, sizeof(collisions->known), "%s", fields[2]);
+					snprintf(collisions->read, sizeof(collisions->read), "%s", fields[3]);
+				}
+				collisions->count += count;
+			}
+		}
+		pthread_mutex_unlock(&shards[i].lock);
+	}
+
+	return total;
+}
+
+/*
+ * Write the knowledge in every shard to a file, as knowledge_write() does.
+ * The shards format their parts at the same time; their entities are then
+ * put together under one header per intent.
+ *
+ * Input:
+ *   f - the file
+ */
+void shard_write(FILE *f)
+{
+	char *sections[MAX_NO_OF_INTENT - 1] = {NULL};
+	size_t lengths[MAX_NO_OF_INTENT - 1] = {0};
+	size_t sizes[MAX_NO_OF_INTENT - 1] = {0};
+
+	for (int i = 0; i < shard_total; i++)
+	{
+		pthread_mutex_lock(&shards[i].lock);
+		fprintf(shards[i].out, "W\n");
+		fflush(shards[i].out);
+	}
+
+	for (int i = 0; i < shard_total; i++)
+	{
+		SHARD *shard = &shards[i];
+		int intent = -1;
+		int len;
+		while ((len = read_line(shard->in, &shard->reply, &shard->reply_size)) >= 0 &&
+			   strcmp(shard->reply, ".") != 0)
+		{
+			if (len >= 2 && shard->reply[0] == '[' && shard->reply[len - 1] == ']' &&
+				strchr(shard->reply, '=') == NULL)
+			{
+				intent = knowledge_intent(shard->reply + 1, len - 2);
+				continue;
+			}
+			if (intent < 0 || len == 0)
+				continue;
+
+			// Add the line to its intent's section.
+			if (lengths[intent] + len + 2 > sizes[intent])
+			{
+				size_t new_size = sizes[intent] == 0 ? 4096 : sizes[intent];
+				while (lengths[intent] + len + 2 > new_size)
+					new_size *= 2;
+				char *new_section = (char *)realloc(sections[intent], new_size);
+				if (new_section == NULL)
+					continue;
+				sections[intent] = new_section;
+				sizes[intent] = new_size;
+			}
+			memcpy(sections[intent] + lengths[intent], shard->reply, len);
+			lengths[intent] += len;
+			sections[intent][lengths[intent]++] = '\n';
+		}
+		pthread_mutex_unlock(&shard->lock);
+	}
+
+	for (int i = 0; i < MAX_NO_OF_INTENT - 1; i++)
+	{
+		if (lengths[i] > 0)
+		{
+			fprintf(f, "\n[%s]\n", all_intents[i].intent);
+			fwrite(sections[i], 1, lengths[i], f);
+		}
+		free(sections[i]);
+	}
+}
+
+/*
+ * Write the knowledge in every shard to a file as a stream of records, as
+ * knowledge_export() does. Each shard's records are copied to the file as they
+ * arrive, one shard after another.
+ *
+ * Input: as knowledge_export()
+ *
+ * Returns: the number of records written
+ */
+long shard_export(FILE *f, void (*progress)(long records))
+{
+	long records = 0;
+
+	for (int i = 0; i < shard_total; i++)
+	{
+		SHARD *shard = &shards[i];
+		int len;
+
+		pthread_mutex_lock(&shard->lock);
+		fprintf(shard->out, "X\n");
+		fflush(shard->out);
+
+		// A record always has tabs in it, so it cannot be mistaken for the
+		// line that ends the shard's answer.
+		while ((len = read_line(shard->in, &shard->reply, &shard->reply_size)) >= 0 &&
+			   strcmp(shard->reply, ".") != 0)
+		{
+			fwrite(shard->reply, 1, len, f);
+			fputc('\n', f);
+			if (++records % STREAM_CHUNK == 0)
+			{
+				fflush(f);
+				if (progress != NULL)
+					progress(records);
+			}
+		}
+		pthread_mutex_unlock(&shard->lock);
+	}
+
+	fflush(f);
+	return records;
+}
+
+/*
+ * Reset every shard.
+ */
+void shard_reset()
+{
+	shard_broadcast("R", NULL);
+}
+
+/*
+ * Count the questions in every shard.
+ *
+ * Returns: the total number of questions
+ */
+int shard_questions()
+{
+	return shard_broadcast("C", NULL);
+}
+
+/*
+ * Take a snapshot in every shard.
+ *
+ * Input and return value: as knowledge_snapshot()
+ */
+int shard_snapshot(const char *name)
+{
+	char request[MAX_INPUT + 2];
+	int status;
+
+	if (!sendable(name, strlen(name)))
+		return KB_INVALID;
+	snprintf(request, sizeof(request), "S\t%s", name);
+	shard_broadcast(request, &status);
+	return status;
+}
+
+/*
+ * Roll every shard back to a snapshot.
+ *
+ * Input and return value: as knowledge_rollback()
+ */
+int shard_rollback(const char *name)
+{
+	char request[MAX_INPUT + 2];
+	int status;
+
+	if (!sendable(name, strlen(name)) || strlen(name) >= MAX_INPUT)
+		return KB_NOTFOUND;
+	snprintf(request, sizeof(request), "U\t%s", name);
+	shard_broadcast(request, &status);
+	return status;
+}
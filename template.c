@@ -0,0 +1,204 @@
+/*
+ * ICT1002 (C Language) Group Project.
+ *
+ * This file implements templates: text with slots in it that are filled in
+ * each time it is used, such as "I don't know anything about {entity}.".
+ *
+ * template_compile() splits the text into its parts once: runs of plain text,
+ * and slots. template_render() then fills a template in by copying each part,
+ * or the value for each slot, straight into the caller's buffer, so rendering
+ * costs no more than a few calls to memcpy(). template_copy() is the copy
+ * they use, which can also be used to build up a response piece by piece.
+ *
+ * A slot is written as the name of what goes in it between braces; the names
+ * are those in slot_names below, in the order of the SLOT_* constants. A
+ * brace that does not start a slot is plain text.
+ */
+
+#include <string.h>
+#include "chat1002.h"
+
+/* the name of each kind of slot, by SLOT_* */
+static const char *slot_names[SLOT_KINDS] = {"entity", "user", "bot", "file", "count"};
+
+/*
+ * Find the kind of slot that starts a piece of text.
+ *
+ * Input:
+ *   s   - the text, starting at a '{'
+ *   len - the number of characters in the text
+ *
+ * Returns: the SLOT_* of the slot, or -1 if the text does not start with one
+ */
+static int slot_at(const char *s, int len)
+{
+	for (int i = 0; i < SLOT_KINDS; i++)
+	{
+		int name_len = strlen(slot_names[i]);
+		if (name_len + 2 <= len && s[name_len + 1] == '}' && strncmp(s + 1, slot_names[i], name_len) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * Copy text onto the end of what is already in a buffer, truncating it if the
+ * buffer is too small. The result is null-terminated.
+ *
+ * Input:
+ *   out - the buffer
+ *   at  - the number of characters already in the buffer
+ *   n   - the size of the buffer
+ *   s   - the text to copy (need not be null-terminated)
+ *   len - the number of characters to copy
+ *
+ * Returns: the number of characters in the buffer afterwards
+ */
+int template_copy(char *out, int at, int n, const char *s, int len)
+{
+	if (at >= n)
+		return at;
+
+	if (len > n - 1 - at)
+		len = n - 1 - at;
+	memcpy(out + at, s, len);
+	out[at + len] = '\0';
+	return at + len;
+}
+
+/*
+ * Split text into the parts of a template. The template refers to the text,
+ * which must last as long as the template is used. If the text has more parts
+ * than a template can hold, the rest of it is kept as plain text.
+ *
+ * Input:
+ *   text     - the text
+ *   len      - the number of characters in the text
+ *   template - receives the template
+ *
+ * Returns: the number of slots in the template
+ */
+int template_compile(const char *text, int len, TEMPLATE *template)
+{
+	int slots = 0;
+	int start = 0;
+
+	template->count = 0;
+	for (int i = 0; i < len && template->count < MAX_PARTS - 2; i++)
+	{
+		int slot = text[i] == '{' ? slot_at(text + i, len - i) : -1;
+		if (slot < 0)
+			continue;
+
+		// The plain text before the slot, then the slot.
+		if (i > start)
+		{
+			template->parts[template->count].text = text + start;
+			template->parts[template->count].length = i - start;
+			template->parts[template->count].slot = -1;
+			template->count++;
+		}
+		template->parts[template->count].text = NULL;
+		template->parts[template->count].length = 0;
+		template->parts[template->count].slot = slot;
+		template->count++;
+		slots++;
+
+		i += strlen(slot_names[slot]) + 1;
+		start = i + 1;
+	}
+
+	if (len > start)
+	{
+		template->parts[template->count].text = text + start;
+		template->parts[template->count].length = len - start;
+		template->parts[template->count].slot = -1;
+		template->count++;
+	}
+
+	return slots;
+}
+
+/*
+ * Fill in a template, truncating it if the buffer is too small. The result is
+ * null-terminated. A slot with no value is left empty.
+ *
+ * Input:
+ *   template - the template
+ *   slots    - the values for the slots
+ *   out      - a buffer to receive the text
+ *   n        - the size of the buffer
+ *
+ * Returns: the number of characters written, not counting the null
+ */
+int template_render(const TEMPLATE *template, const SLOTS *slots, char *out, int n)
+{
+	int len = 0;
+
+	if (n <= 0)
+		return 0;
+
+	out[0] = '\0';
+	for (int i = 0; i < template->count; i++)
+	{
+		const PART *part = &template->parts[i];
+		if (part->slot < 0)
+			len = template_copy(out, len, n, part->text, part->length);
+		else if (slots != NULL && slots->value[part->slot] != NULL)
+			len = template_copy(out, len, n, slots->value[part->slot], slots->length[part->slot]);
+	}
+
+	return len;
+}
+
+/*
+ * Determine whether text has any slots in it, i.e. whether it needs to be
+ * rendered as a template rather than used as it is.
+ *
+ * Input:
+ *   text - the text
+ *   len  - the number of characters in the text
+ *
+ * Returns: 1, if it has slots; 0, otherwise
+ */
+int template_has_slots(const char *text, int len)
+{
+	const char *brace = memchr(text, '{', len);
+	while (brace != NULL)
+	{
+		if (slot_at(brace, len - (brace - text)) >= 0)
+			return 1;
+		brace = memchr(brace + 1, '{', len - (brace + 1 - text));
+	}
+	return 0;
+}
+
+/*
+ * Write a number out in decimal, for a slot.
+ *
+ * Input:
+ *   value  - the number
+ *   buffer - a buffer of at least 21 characters to receive the digits
+ *
+ * Returns: the number of characters written (the result is not
+ * null-terminated)
+ */
+int template_number(long value, char *buffer)
+{
+	char digits[20];
+	int count = 0;
+	int len = 0;
+	unsigned long magnitude = value < 0 ? -(unsigned long)value : (unsigned long)value;
+
+	do
+	{
+		digits[count++] = '0' + magnitude % 10;
+		magnitude /= 10;
+	} while (magnitude > 0);
+
+	if (value < 0)
+		buffer[len++] = '-';
+	while (count > 0)
+		buffer[len++] = digits[--count];
+	return len;
+}
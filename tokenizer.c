@@ -0,0 +1,190 @@
+/*
+ * ICT1002 (C Language) Group Project.
+ *
+ * This file implements dividing a line of input into words.
+ *
+ * tokenize() walks the line exactly once and never modifies it. Each word is
+ * described by a TOKEN holding its offset and length in the line (with any
+ * trailing punctuation already removed) and a case-folded hash, so the rest
+ * of the chatbot can look at words in place instead of copying them out.
+ *
+ * Nothing in this file keeps state between calls, so it is safe to use from
+ * several threads at once (unlike strtok()).
+ */
+
+#include <ctype.h>
+#include <string.h>
+#include "chat1002.h"
+
+/* FNV-1a parameters used by hash_token() and tokenize() */
+#define HASH_SEED 2166136261UL
+#define HASH_PRIME 16777619UL
+
+/*
+ * Determine whether a character separates words.
+ *
+ * The delimiters are the same ones the main loop has always used: space,
+ * question mark, tab and newline (plus carriage return for Windows files).
+ */
+static int is_delimiter(char c)
+{
+	return c == ' ' || c == '?' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/*
+ * Add one character to a running case-folded hash.
+ */
+static unsigned long hash_step(unsigned long hash, char c)
+{
+	hash ^= (unsigned char)toupper((unsigned char)c);
+	return (hash * HASH_PRIME) & 0xffffffffUL;
+}
+
+/*
+ * Split a line of input into words.
+ *
+ * Input:
+ *   line   - the null-terminated line of input (not modified)
+ *   tokens - an array to receive the words
+ *   max    - the number of elements in tokens
+ *
+ * Returns: the number of words stored in tokens
+ */
+int tokenize(const char *line, TOKEN tokens[], int max)
+{
+	int inc = 0;
+	int i = 0;
+
+	while (inc < max)
+	{
+		// Skip delimiters between words.
+		while (line[i] != '\0' && is_delimiter(line[i]))
+			i++;
+		if (line[i] == '\0')
+			break;
+
+		// Hash the word as we go, remembering the hash and length as they were
+		// at the last character that was not punctuation, so trailing
+		// punctuation is dropped without a second pass.
+		int start = i;
+		int end = i;
+		unsigned long hash = HASH_SEED;
+		unsigned long word_hash = HASH_SEED;
+		for (; line[i] != '\0' && !is_delimiter(line[i]); i++)
+		{
+			hash = hash_step(hash, line[i]);
+			if (!ispunct((unsigned char)line[i]))
+			{
+				word_hash = hash;
+				end = i + 1;
+			}
+		}
+
+		// A word made up only of punctuation is not a word.
+		if (end == start)
+			continue;
+
+		tokens[inc].offset = start;
+		tokens[inc].length = end - start;
+		tokens[inc].hash = word_hash;
+		inc++;
+	}
+
+	return inc;
+}
+
+/*
+ * Compute the case-folded hash of a string, as stored by tokenize().
+ *
+ * Input:
+ *   s   - the string
+ *   len - the number of characters in s
+ *
+ * Returns: the hash
+ */
+unsigned long hash_token(const char *s, int len)
+{
+	unsigned long hash = HASH_SEED;
+	for (int i = 0; i < len; i++)
+		hash = hash_step(hash, s[i]);
+	return hash;
+}
+
+/*
+ * Find the slot of a word in a perfect hash table such as the one in vocab.c.
+ *
+ * Input:
+ *   hash         - hash_token() of the word
+ *   displacement - the displacement of the word's bucket
+ *   slots        - the number of slots in the table
+ *
+ * Returns: the slot, from 0 to slots - 1
+ */
+int vocab_slot(unsigned long hash, unsigned long displacement, int slots)
+{
+	unsigned long x = ((hash ^ displacement) * 2654435761UL) & 0xffffffffUL;
+	x ^= x >> 15;
+	return x % slots;
+}
+
+/*
+ * Compare a word in the input against a null-terminated string,
+ * case-insensitively.
+ *
+ * Input:
+ *   span  - the first character of the word
+ *   len   - the number of characters in the word
+ *   token - the null-terminated string to compare against
+ *
+ * Returns:
+ *   as strcmp()
+ */
+int compare_span(const char *span, int len, const char *token)
+{
+	int i = 0;
+	while (i < len && token[i] != '\0')
+	{
+		int a = toupper((unsigned char)span[i]);
+		int b = toupper((unsigned char)token[i]);
+		if (a != b)
+			return a < b ? -1 : 1;
+		i++;
+	}
+
+	if (i == len && token[i] == '\0')
+		return 0;
+	else if (i == len)
+		return -1;
+	else
+		return 1;
+}
+
+/*
+ * Utility function for comparing string case-insensitively.
+ *
+ * Input:
+ *   token1 - the first token
+ *   token2 - the second token
+ *
+ * Returns:
+ *   as strcmp()
+ */
+int compare_token(const char *token1, const char *token2)
+{
+	int i = 0;
+	while (token1[i] != '\0' && token2[i] != '\0')
+	{
+		if (toupper(token1[i]) < toupper(token2[i]))
+			return -1;
+		else if (toupper(token1[i]) > toupper(token2[i]))
+			return 1;
+		i++;
+	}
+
+	if (token1[i] == '\0' && token2[i] == '\0')
+		return 0;
+	else if (token1[i] == '\0')
+		return -1;
+	else
+		return 1;
+}
@@ -0,0 +1,64 @@
+/*
+ * ICT1002 (C Language) Group Project.
+ *
+ * This file is generated by vocabgen.c. Do not edit it; change the list of
+ * words in vocabgen.c and run vocabgen again instead.
+ */
+
+#include <stddef.h>
+#include "chat1002.h"
+
+#define VOCAB_WORDS 30
+#define VOCAB_BUCKETS 16
+
+/* the displacement of each bucket (see vocab_slot()) */
+static const unsigned long vocab_displacement[VOCAB_BUCKETS] = {2UL, 4UL, 1UL, 0UL, 8UL, 2UL, 18UL, 0UL, 39UL, 3UL, 0UL, 9UL, 135UL, 5UL, 0UL, 0UL};
+
+/* the words, each in its slot */
+static const VOCAB vocab_words[VOCAB_WORDS] = {
+	{"tell", VERB_TELL, -1, NULL, PRONOUN_NONE},
+	{"him", VERB_NONE, -1, NULL, PRONOUN_PERSON},
+	{"weather", VERB_NONE, -1, "Both good and bad weather should always be appreciated.", PRONOUN_NONE},
+	{"snapshot", VERB_SNAPSHOT, -1, NULL, PRONOUN_NONE},
+	{"that", VERB_NONE, -1, NULL, PRONOUN_THING},
+	{"they", VERB_NONE, -1, NULL, PRONOUN_PERSON},
+	{"how", VERB_QUESTION, 5, "An interesting question. I never really thought about it.", PRONOUN_NONE},
+	{"where", VERB_QUESTION, 3, NULL, PRONOUN_NONE},
+	{"save", VERB_SAVE, -1, NULL, PRONOUN_NONE},
+	{"this", VERB_NONE, -1, NULL, PRONOUN_THING},
+	{"rollback", VERB_ROLLBACK, -1, NULL, PRONOUN_NONE},
+	{"why", VERB_QUESTION, 4, NULL, PRONOUN_NONE},
+	{"her", VERB_NONE, -1, NULL, PRONOUN_PERSON},
+	{"she", VERB_NONE, -1, NULL, PRONOUN_PERSON},
+	{"life", VERB_NONE, -1, "Life always has it's ups and downs.", PRONOUN_NONE},
+	{"export", VERB_EXPORT, -1, NULL, PRONOUN_NONE},
+	{"quit", VERB_EXIT, -1, NULL, PRONOUN_NONE},
+	{"who", VERB_QUESTION, 0, NULL, PRONOUN_NONE},
+	{"reset", VERB_RESET, -1, NULL, PRONOUN_NONE},
+	{"import", VERB_IMPORT, -1, NULL, PRONOUN_NONE},
+	{"purpose", VERB_NONE, -1, "An interesting question. Currently, I am here for your personal needs but maybe I will mean more to someone else ;-;", PRONOUN_NONE},
+	{"them", VERB_NONE, -1, NULL, PRONOUN_PERSON},
+	{"he", VERB_NONE, -1, NULL, PRONOUN_PERSON},
+	{"exit", VERB_EXIT, -1, NULL, PRONOUN_NONE},
+	{"when", VERB_QUESTION, 2, NULL, PRONOUN_NONE},
+	{"hot", VERB_NONE, -1, "Know what else is hot? You.", PRONOUN_NONE},
+	{"what", VERB_QUESTION, 1, NULL, PRONOUN_NONE},
+	{"load", VERB_LOAD, -1, NULL, PRONOUN_NONE},
+	{"it", VERB_NONE, -1, NULL, PRONOUN_THING},
+	{"hello", VERB_NONE, -1, "Greetings.", PRONOUN_NONE}};
+
+/*
+ * Find a built-in word.
+ *
+ * Input:
+ *   word - the word (need not be null-terminated)
+ *   len  - the number of characters in the word
+ *   hash - hash_token() of the word
+ *
+ * Returns: the word, or NULL if it is not built in
+ */
+const VOCAB *vocab_find(const char *word, int len, unsigned long hash)
+{
+	const VOCAB *entry = &vocab_words[vocab_slot(hash, vocab_displacement[hash % VOCAB_BUCKETS], VOCAB_WORDS)];
+	return compare_span(word, len, entry->word) == 0 ? entry : NULL;
+}
@@ -0,0 +1,199 @@
+/*
+ * ICT1002 (C Language) Group Project.
+ *
+ * This file is a program that generates vocab.c, the table of words built into
+ * the chatbot: the commands, the question words, the smalltalk topics and the
+ * pronouns.
+ *
+ * Usage:
+ *   gcc -o vocabgen vocabgen.c tokenizer.c
+ *   ./vocabgen > vocab.c
+ *
+ * The table is a minimal perfect hash: every word has a slot of its own, and
+ * there are exactly as many slots as words. A word is placed by its
+ * hash_token() value (which tokenize() has already worked out for every word
+ * of input), first into a bucket and then into a slot chosen by the bucket's
+ * displacement. This program finds a displacement for every bucket that puts
+ * each word in a different slot, so recognising a word costs one hash and one
+ * comparison with the word in its slot.
+ *
+ * To add a word, add it to the list below and run this program again.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chat1002.h"
+
+/* the built-in words; question words must be in the same order as all_intents */
+static const VOCAB words[] = {
+	{"exit", VERB_EXIT, -1, NULL, PRONOUN_NONE},
+	{"quit", VERB_EXIT, -1, NULL, PRONOUN_NONE},
+	{"load", VERB_LOAD, -1, NULL, PRONOUN_NONE},
+	{"save", VERB_SAVE, -1, NULL, PRONOUN_NONE},
+	{"reset", VERB_RESET, -1, NULL, PRONOUN_NONE},
+	{"tell", VERB_TELL, -1, NULL, PRONOUN_NONE},
+	{"export", VERB_EXPORT, -1, NULL, PRONOUN_NONE},
+	{"import", VERB_IMPORT, -1, NULL, PRONOUN_NONE},
+	{"snapshot", VERB_SNAPSHOT, -1, NULL, PRONOUN_NONE},
+	{"rollback", VERB_ROLLBACK, -1, NULL, PRONOUN_NONE},
+	{"who", VERB_QUESTION, 0, NULL, PRONOUN_NONE},
+	{"what", VERB_QUESTION, 1, NULL, PRONOUN_NONE},
+	{"when", VERB_QUESTION, 2, NULL, PRONOUN_NONE},
+	{"where", VERB_QUESTION, 3, NULL, PRONOUN_NONE},
+	{"why", VERB_QUESTION, 4, NULL, PRONOUN_NONE},
+	{"how", VERB_QUESTION, 5, "An interesting question. I never really thought about it.", PRONOUN_NONE},
+	{"hello", VERB_NONE, -1, "Greetings.", PRONOUN_NONE},
+	{"weather", VERB_NONE, -1, "Both good and bad weather should always be appreciated.", PRONOUN_NONE},
+	{"life", VERB_NONE, -1, "Life always has it's ups and downs.", PRONOUN_NONE},
+	{"hot", VERB_NONE, -1, "Know what else is hot? You.", PRONOUN_NONE},
+	{"purpose", VERB_NONE, -1, "An interesting question. Currently, I am here for your personal needs but maybe I will mean more to someone else ;-;", PRONOUN_NONE},
+	{"it", VERB_NONE, -1, NULL, PRONOUN_THING},
+	{"this", VERB_NONE, -1, NULL, PRONOUN_THING},
+	{"that", VERB_NONE, -1, NULL, PRONOUN_THING},
+	{"he", VERB_NONE, -1, NULL, PRONOUN_PERSON},
+	{"she", VERB_NONE, -1, NULL, PRONOUN_PERSON},
+	{"him", VERB_NONE, -1, NULL, PRONOUN_PERSON},
+	{"her", VERB_NONE, -1, NULL, PRONOUN_PERSON},
+	{"they", VERB_NONE, -1, NULL, PRONOUN_PERSON},
+	{"them", VERB_NONE, -1, NULL, PRONOUN_PERSON}};
+
+#define WORD_COUNT (int)(sizeof(words) / sizeof(words[0]))
+#define BUCKET_COUNT (WORD_COUNT / 2 + 1)
+
+/* the names of the VERB_* and PRONOUN_* constants, by value */
+static const char *verb_names[] = {"VERB_NONE", "VERB_EXIT", "VERB_LOAD", "VERB_SAVE",
+								   "VERB_RESET", "VERB_TELL", "VERB_QUESTION", "VERB_EXPORT",
+								   "VERB_IMPORT", "VERB_SNAPSHOT", "VERB_ROLLBACK"};
+static const char *pronoun_names[] = {"PRONOUN_NONE", "PRONOUN_PERSON", "PRONOUN_THING"};
+
+/*
+ * Print a string as a C string literal.
+ */
+static void print_literal(const char *s)
+{
+	if (s == NULL)
+	{
+		printf("NULL");
+		return;
+	}
+	putchar('"');
+	for (; *s != '\0'; s++)
+	{
+		if (*s == '"' || *s == '\\')
+			putchar('\\');
+		putchar(*s);
+	}
+	putchar('"');
+}
+
+int main()
+{
+	int bucket_of[WORD_COUNT];
+	int bucket_size[BUCKET_COUNT] = {0};
+	unsigned long displacement[BUCKET_COUNT] = {0};
+	int slot_of[WORD_COUNT];
+	int word_in_slot[WORD_COUNT];
+
+	for (int i = 0; i < WORD_COUNT; i++)
+	{
+		bucket_of[i] = hash_token(words[i].word, strlen(words[i].word)) % BUCKET_COUNT;
+		bucket_size[bucket_of[i]]++;
+	}
+	for (int i = 0; i < WORD_COUNT; i++)
+		word_in_slot[i] = -1;
+
+	// Place the biggest buckets first, while there is the most room, trying
+	// displacements until every word in the bucket lands in an empty slot of
+	// its own.
+	for (int size = WORD_COUNT; size > 0; size--)
+	{
+		for (int b = 0; b < BUCKET_COUNT; b++)
+		{
+			if (bucket_size[b] != size)
+				continue;
+
+			for (unsigned long d = 0;; d++)
+			{
+				int placed = 0;
+				for (int i = 0; i < WORD_COUNT; i++)
+				{
+					if (bucket_of[i] != b)
+						continue;
+					int slot = vocab_slot(hash_token(words[i].word, strlen(words[i].word)), d, WORD_COUNT);
+					if (word_in_slot[slot] >= 0)
+						break;
+					word_in_slot[slot] = i;
+					slot_of[i] = slot;
+					placed++;
+				}
+				if (placed == size)
+				{
+					displacement[b] = d;
+					break;
+				}
+
+				// Take back the words that were placed and try the next one.
+				for (int i = 0; i < WORD_COUNT; i++)
+				{
+					if (bucket_of[i] == b && word_in_slot[slot_of[i]] == i)
+						word_in_slot[slot_of[i]] = -1;
+				}
+				if (d > 1000000)
+				{
+					fprintf(stderr, "vocabgen: could not place bucket %d\n", b);
+					return 1;
+				}
+			}
+		}
+	}
+
+	printf("/*\n");
+	printf(" * ICT1002 (C Language) Group Project.\n");
+	printf(" *\n");
+	printf(" * This file is generated by vocabgen.c. Do not edit it; change the list of\n");
+	printf(" * words in vocabgen.c and run vocabgen again instead.\n");
+	printf(" */\n");
+	printf("\n");
+	printf("#include <stddef.h>\n");
+	printf("#include \"chat1002.h\"\n");
+	printf("\n");
+	printf("#define VOCAB_WORDS %d\n", WORD_COUNT);
+	printf("#define VOCAB_BUCKETS %d\n", BUCKET_COUNT);
+	printf("\n");
+	printf("/* the displacement of each bucket (see vocab_slot()) */\n");
+	printf("static const unsigned long vocab_displacement[VOCAB_BUCKETS] = {");
+	for (int b = 0; b < BUCKET_COUNT; b++)
+		printf("%s%luUL", b > 0 ? ", " : "", displacement[b]);
+	printf("};\n");
+	printf("\n");
+	printf("/* the words, each in its slot */\n");
+	printf("static const VOCAB vocab_words[VOCAB_WORDS] = {\n");
+	for (int s = 0; s < WORD_COUNT; s++)
+	{
+		const VOCAB *word = &words[word_in_slot[s]];
+		printf("\t{");
+		print_literal(word->word);
+		printf(", %s, %d, ", verb_names[word->verb], word->intent);
+		print_literal(word->smalltalk);
+		printf(", %s}%s\n", pronoun_names[word->pronoun], s < WORD_COUNT - 1 ? "," : "};");
+	}
+	printf("\n");
+	printf("/*\n");
+	printf(" * Find a built-in word.\n");
+	printf(" *\n");
+	printf(" * Input:\n");
+	printf(" *   word - the word (need not be null-terminated)\n");
+	printf(" *   len  - the number of characters in the word\n");
+	printf(" *   hash - hash_token() of the word\n");
+	printf(" *\n");
+	printf(" * Returns: the word, or NULL if it is not built in\n");
+	printf(" */\n");
+	printf("const VOCAB *vocab_find(const char *word, int len, unsigned long hash)\n");
+	printf("{\n");
+	printf("\tconst VOCAB *entry = &vocab_words[vocab_slot(hash, vocab_displacement[hash %% VOCAB_BUCKETS], VOCAB_WORDS)];\n");
+	printf("\treturn compare_span(word, len, entry->word) == 0 ? entry : NULL;\n");
+	printf("}\n");
+
+	return 0;
+}